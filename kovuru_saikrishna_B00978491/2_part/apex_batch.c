@@ -0,0 +1,484 @@
+/*
+ * apex_batch.c
+ * Contains the apex_batch driver, it simulates every program of a manifest
+ * on its own APEX_CPU in one process and writes one CSV line per program.
+ * The programs are spread over a pool of threads with work stealing, every
+ * thread has a deque of programs, takes work from the bottom of its own and
+ * when that is empty steals from the top of another's, so a few long
+ * programs do not leave the other threads idle.
+ *
+ * Manifest, one program per line (# starts a comment):
+ *
+ *   <input_file> <max_cycles> [name=value ...]
+ *
+ * fast_forward runs the start of a program functionally, as in apex_sim,
+ * and trains the branch predictor on the way with bp_warming.
+ * The options of the other run modes have no effect on a job and are
+ * rejected on a manifest line.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+#define BATCH_LINE_SIZE 4096
+
+/* Prefixes of the options that only tune another run mode */
+static const char *const batch_ignored_options[] = {"batch_threads", "sample_", "interval_", "stress_",
+                                                     "sweep_",        "stats_",  "log_"};
+
+/* One program of the manifest and its result */
+typedef struct Batch_Job
+{
+    char *filename;
+    long max_cycles;
+    APEX_Config config;
+
+    const char *status; /* "halted", "fault", "limit" or "error" */
+    int64_t cycles;
+    int64_t insn_completed;
+    uint32_t state_hash;
+    double seconds;
+} Batch_Job;
+
+/* Deque of job indices, the owner works at the bottom and thieves at the top */
+typedef struct Batch_Deque
+{
+    pthread_mutex_t lock;
+    int *jobs;
+    int top;
+    int bottom;
+} Batch_Deque;
+
+typedef struct Batch_Pool
+{
+    Batch_Job *jobs;
+    Batch_Deque *deques;
+    int threads;
+    long steals; /* Updated with an atomic add */
+} Batch_Pool;
+
+typedef struct Batch_Worker
+{
+    Batch_Pool *pool;
+    int id;
+} Batch_Worker;
+
+static uint32_t
+fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Hash of the architectural state: pc, zero flag, registers and data memory */
+static uint32_t
+hash_state(const APEX_CPU *cpu)
+{
+    uint32_t hash = 2166136261u;
+
+    hash = fnv1a(hash, &cpu->pc, sizeof(cpu->pc));
+    hash = fnv1a(hash, &cpu->zero_flag, sizeof(cpu->zero_flag));
+    hash = fnv1a(hash, cpu->regs, sizeof(cpu->regs));
+    hash = fnv1a(hash, cpu->data_memory, sizeof(cpu->data_memory));
+    return hash;
+}
+
+static void
+run_job(Batch_Job *job)
+{
+    struct timespec start, end;
+    APEX_CPU *cpu;
+    int stopped = APEX_CYCLE_RUNNING;
+    int simulated = FALSE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cpu = APEX_cpu_init_with_config(job->filename, &job->config);
+    if (!cpu)
+    {
+        fprintf(stderr, "APEX_Error: Unable to initialize CPU for %s\n", job->filename);
+        job->status = "error";
+        return;
+    }
+    if (job->config.fast_forward > 0)
+    {
+        int status = APEX_cpu_run_warming(cpu, job->config.fast_forward);
+
+        /* The program ended before the pipeline had anything to simulate */
+        if (status != APEX_FUNC_LIMIT)
+        {
+            stopped = status == APEX_FUNC_HALTED ? APEX_CYCLE_HALTED : APEX_CYCLE_FAULT;
+        }
+    }
+    while (stopped == APEX_CYCLE_RUNNING && cpu->clock < job->max_cycles)
+    {
+        stopped = APEX_cpu_cycle(cpu);
+        simulated = TRUE;
+    }
+    /* Same count as the display mode prints, the clock does not advance past HALT or a fault */
+    job->status = stopped == APEX_CYCLE_FAULT ? "fault" : (stopped ? "halted" : "limit");
+    job->cycles = stopped && simulated ? cpu->clock + 1 : cpu->clock;
+    job->insn_completed = cpu->insn_completed;
+    job->state_hash = hash_state(cpu);
+    APEX_cpu_stop(cpu);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Next job of the worker's own deque, -1 when it is empty */
+static int
+take_own(Batch_Deque *deque)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+    {
+        job = deque->jobs[--deque->bottom];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+/* Oldest job of another worker's deque, -1 when it is empty */
+static int
+steal(Batch_Deque *deque)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+    {
+        job = deque->jobs[deque->top++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static void *
+batch_worker(void *arg)
+{
+    Batch_Worker *worker = arg;
+    Batch_Pool *pool = worker->pool;
+
+    for (;;)
+    {
+        int job = take_own(&pool->deques[worker->id]);
+        int i;
+
+        /* No job is ever added, so once every deque is empty the batch is done */
+        for (i = 1; job < 0 && i < pool->threads; ++i)
+        {
+            job = steal(&pool->deques[(worker->id + i) % pool->threads]);
+            if (job >= 0)
+            {
+                __atomic_fetch_add(&pool->steals, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if (job < 0)
+        {
+            return NULL;
+        }
+        run_job(&pool->jobs[job]);
+    }
+}
+
+/* TRUE for an option of another run mode, it would change nothing in a job */
+static int
+is_ignored_option(const char *option)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(batch_ignored_options) / sizeof(batch_ignored_options[0]); ++i)
+    {
+        if (strncmp(option, batch_ignored_options[i], strlen(batch_ignored_options[i])) == 0)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Reads the manifest into *jobs_out, every job starts from the options in
+ * 'config'. Returns the number of jobs or -1 on error.
+ */
+static int
+read_manifest(const char *filename, const APEX_Config *config, Batch_Job **jobs_out)
+{
+    char line[BATCH_LINE_SIZE];
+    Batch_Job *jobs = NULL;
+    int count = 0, capacity = 0, line_no = 0;
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to open manifest %s\n", filename);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *comment = strchr(line, '#');
+        char *field, *end, *save;
+        Batch_Job *job;
+
+        line_no++;
+        if (comment)
+        {
+            *comment = '\0';
+        }
+        field = strtok_r(line, " \t\r\n", &save);
+        if (!field)
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            Batch_Job *grown;
+
+            capacity = capacity ? capacity * 2 : 64;
+            grown = realloc(jobs, capacity * sizeof(Batch_Job));
+            if (!grown)
+            {
+                goto error;
+            }
+            jobs = grown;
+        }
+        job = &jobs[count];
+        memset(job, 0, sizeof(Batch_Job));
+        job->config = *config;
+        job->filename = strdup(field);
+        if (!job->filename)
+        {
+            goto error;
+        }
+        count++;
+
+        field = strtok_r(NULL, " \t\r\n", &save);
+        job->max_cycles = field ? strtol(field, &end, 0) : 0;
+        if (!field || *end != '\0' || job->max_cycles <= 0)
+        {
+            fprintf(stderr, "APEX_Error: %s:%d needs a cycle limit after the program\n", filename, line_no);
+            goto error;
+        }
+        while ((field = strtok_r(NULL, " \t\r\n", &save)))
+        {
+            if (is_ignored_option(field))
+            {
+                fprintf(stderr, "APEX_Error: %s:%d: %s has no effect on a batch job\n", filename, line_no, field);
+                goto error;
+            }
+            if (APEX_config_set(&job->config, field) != 0)
+            {
+                fprintf(stderr, "APEX_Error: %s:%d has a bad option\n", filename, line_no);
+                goto error;
+            }
+        }
+    }
+    fclose(fp);
+    *jobs_out = jobs;
+    return count;
+
+error:
+    fclose(fp);
+    while (count > 0)
+    {
+        free(jobs[--count].filename);
+    }
+    free(jobs);
+    return -1;
+}
+
+/* Writes a CSV field, quoted when it holds a comma, a quote or a line break */
+static void
+write_csv_field(FILE *fp, const char *field)
+{
+    if (!strpbrk(field, ",\"\r\n"))
+    {
+        fputs(field, fp);
+        return;
+    }
+    fputc('"', fp);
+    for (; *field; ++field)
+    {
+        /* A quote inside a quoted field is doubled */
+        if (*field == '"')
+        {
+            fputc('"', fp);
+        }
+        fputc(*field, fp);
+    }
+    fputc('"', fp);
+}
+
+static int
+write_csv(const char *filename, const Batch_Job *jobs, int count)
+{
+    FILE *fp = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+    int i, ok;
+
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", filename);
+        return -1;
+    }
+    fprintf(fp, "program,max_cycles,status,cycles,insn_completed,state_hash,seconds\n");
+    for (i = 0; i < count; ++i)
+    {
+        const Batch_Job *job = &jobs[i];
+
+        write_csv_field(fp, job->filename);
+        fprintf(fp, ",%ld,%s,%" PRId64 ",%" PRId64 ",%08x,%.6f\n", job->max_cycles, job->status, job->cycles, job->insn_completed,
+                job->state_hash, job->seconds);
+    }
+    ok = fp == stdout ? fflush(fp) == 0 : fclose(fp) == 0;
+    if (!ok)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc_all, char const *argv_all[])
+{
+    APEX_Config config;
+    const char *argv[argc_all];
+    int argc = 0;
+    Batch_Pool pool;
+    Batch_Worker *workers;
+    pthread_t *threads;
+    struct timespec start, end;
+    int count, started = 0, errors = 0, i;
+
+    // options of the form name=value apply to every program, a manifest line can override them.
+    APEX_config_init(&config);
+    config.quiet = TRUE;
+    for (i = 0; i < argc_all; ++i)
+    {
+        if (i > 0 && strchr(argv_all[i], '='))
+        {
+            if (APEX_config_set(&config, argv_all[i]) != 0)
+            {
+                APEX_config_print_usage();
+                exit(1);
+            }
+            continue;
+        }
+        argv[argc++] = argv_all[i];
+    }
+    if (argc != 3)
+    {
+        fprintf(stderr, "APEX_Help: Usage %s <manifest> <output.csv | -> [name=value ...]\n", argv[0]);
+        APEX_config_print_usage();
+        exit(1);
+    }
+
+    count = read_manifest(argv[1], &config, &pool.jobs);
+    if (count < 0)
+    {
+        exit(1);
+    }
+    pool.threads = APEX_config_resolve_threads(config.batch_threads);
+    if (pool.threads > count)
+    {
+        pool.threads = count > 0 ? count : 1;
+    }
+    pool.steals = 0;
+    pool.deques = calloc(pool.threads, sizeof(Batch_Deque));
+    workers = calloc(pool.threads, sizeof(Batch_Worker));
+    threads = calloc(pool.threads, sizeof(pthread_t));
+    if (!pool.deques || !workers || !threads)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the thread pool\n");
+        exit(1);
+    }
+
+    // programs are dealt round-robin, manifest order is kept inside every deque.
+    for (i = 0; i < pool.threads; ++i)
+    {
+        Batch_Deque *deque = &pool.deques[i];
+
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->jobs = malloc((count / pool.threads + 1) * sizeof(int));
+        if (!deque->jobs)
+        {
+            fprintf(stderr, "APEX_Error: Unable to allocate the thread pool\n");
+            exit(1);
+        }
+    }
+    for (i = count - 1; i >= 0; --i)
+    {
+        Batch_Deque *deque = &pool.deques[i % pool.threads];
+
+        deque->jobs[deque->bottom++] = i;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < pool.threads; ++i)
+    {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        if (pthread_create(&threads[i], NULL, batch_worker, &workers[i]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    // with no thread at all the jobs still run, here.
+    if (started == 0)
+    {
+        workers[0].pool = &pool;
+        workers[0].id = 0;
+        batch_worker(&workers[0]);
+    }
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < count; ++i)
+    {
+        errors += strcmp(pool.jobs[i].status, "error") == 0;
+    }
+    fprintf(stderr, "APEX_BATCH: %d programs on %d threads in %.3f s, %ld steals, %d errors\n", count,
+                    started ? started : 1, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, pool.steals,
+                    errors);
+    if (write_csv(argv[2], pool.jobs, count) != 0)
+    {
+        errors++;
+    }
+
+    for (i = 0; i < pool.threads; ++i)
+    {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].jobs);
+    }
+    for (i = 0; i < count; ++i)
+    {
+        free(pool.jobs[i].filename);
+    }
+    free(pool.jobs);
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    return errors ? 1 : 0;
+}
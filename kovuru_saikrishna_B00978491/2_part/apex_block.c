@@ -0,0 +1,356 @@
+/*
+ * apex_block.c
+ * Contains the basic block translation cache of the functional interpreter.
+ * The program is cut into blocks that end at BZ, BNZ or HALT, every block is
+ * translated once into a flat array of micro-ops and blocks are chained to
+ * their successors, so a loop runs block to block without going back to
+ * code memory. With the JIT dispatch, blocks that run often enough are
+ * handed to apex_jit.c and run as native code from then on
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apex_cpu.h"
+#include "apex_func.h"
+#include "apex_macros.h"
+
+/* One translated block, keyed by the code memory index it starts at */
+typedef struct APEX_Block
+{
+    int start;                   /* Code memory index of the first micro-op */
+    int count;                   /* Micro-ops, including the terminator */
+    int branch;                  /* BR_* of the last micro-op, BR_NONE falls through */
+    int taken;                   /* Index the branch goes to, -1 when outside the program */
+    struct APEX_Block *next;     /* Chained fall-through successor, NULL until first used */
+    struct APEX_Block *taken_to; /* Chained branch successor, NULL until first used */
+    int heat;                    /* Times the block ran while not compiled */
+    APEX_Jit_Fn native;          /* Compiled body (all micro-ops but a branch), NULL if interpreted */
+    APEX_Instruction ops[];      /* Micro-ops, operands resolved at translation */
+} APEX_Block;
+
+typedef struct APEX_Block_Cache
+{
+    APEX_Block **at; /* Block starting at every code memory index, NULL if none yet */
+    long blocks;     /* Blocks translated */
+    long entries;    /* Blocks entered */
+    long chained;    /* Entries that followed a chain pointer */
+    APEX_Jit *jit;   /* Native code buffer, NULL unless the JIT dispatch is used */
+    long native;     /* Micro-ops completed by native code */
+    long bails;      /* Native runs that handed the rest of a block back to the interpreter */
+} APEX_Block_Cache;
+
+static APEX_Block_Cache *
+get_block_cache(APEX_CPU *cpu)
+{
+    if (!cpu->block_cache)
+    {
+        APEX_Block_Cache *cache = calloc(1, sizeof(APEX_Block_Cache));
+
+        if (!cache)
+        {
+            return NULL;
+        }
+        cache->at = calloc(cpu->code_memory_size, sizeof(APEX_Block *));
+        if (!cache->at)
+        {
+            free(cache);
+            return NULL;
+        }
+        if (cpu->config.func_dispatch == FUNC_DISPATCH_JIT)
+        {
+            cache->jit = APEX_jit_create();
+        }
+        cpu->block_cache = cache;
+    }
+    return cpu->block_cache;
+}
+
+/*
+ * Translates the block starting at 'start', it takes instructions up to and
+ * including the first BZ, BNZ or HALT, or up to the end of the program
+ */
+static APEX_Block *
+translate_block(const APEX_CPU *cpu, int start)
+{
+    APEX_Block *block;
+    int end = start;
+    int i;
+
+    while (end < cpu->code_memory_size && end - start < MAX_BLOCK_OPS)
+    {
+        unsigned char opcode = cpu->code_memory[end++].opcode;
+
+        if (opcode < APEX_OPCODE_LIMIT && apex_isa[opcode].branch != BR_NONE)
+        {
+            break;
+        }
+    }
+
+    block = malloc(sizeof(APEX_Block) + (end - start) * sizeof(APEX_Instruction));
+    if (!block)
+    {
+        return NULL;
+    }
+    block->start = start;
+    block->count = end - start;
+    block->next = NULL;
+    block->taken_to = NULL;
+    block->heat = 0;
+    block->native = NULL;
+    for (i = 0; i < block->count; ++i)
+    {
+        block->ops[i] = cpu->code_memory[start + i];
+    }
+
+    block->branch = BR_NONE;
+    block->taken = -1;
+    if (block->ops[block->count - 1].opcode < APEX_OPCODE_LIMIT)
+    {
+        block->branch = apex_isa[block->ops[block->count - 1].opcode].branch;
+    }
+    if (block->branch == BR_Z || block->branch == BR_NZ)
+    {
+        int last = end - 1;
+        int target = cpu->branch_target[last] >= 0 ? cpu->branch_target[last]
+                                                   : last + block->ops[block->count - 1].imm / 4;
+
+        block->taken = (target >= 0 && target < cpu->code_memory_size) ? target : -1;
+    }
+    return block;
+}
+
+/*
+ * Runs 'count' straight-line micro-ops, none of them is a branch. Returns
+ * the micro-ops completed, fewer than 'count' when the next one faulted.
+ */
+static int
+run_micro_ops(APEX_CPU *cpu, const APEX_Instruction *ops, int count, int start)
+{
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        switch (ops[i].opcode)
+        {
+#define APEX_BLOCK_CASE(name, mnem, opc, fmt, src, dst, fu, alu, mem, br, zf)                          \
+    case opc:                                                                                          \
+        if (execute_insn(cpu, &ops[i], start + i, src, dst, alu, mem, BR_NONE, zf) == APEX_FUNC_FAULT) \
+        {                                                                                              \
+            return i;                                                                                  \
+        }                                                                                              \
+        break;
+
+            APEX_ISA_TABLE(APEX_BLOCK_CASE)
+
+#undef APEX_BLOCK_CASE
+        }
+    }
+    return count;
+}
+
+/*
+ * Runs the first 'count' micro-ops of a block (its body, the branch is done
+ * by the caller), through native code once the block is hot. Returns the
+ * micro-ops completed, as run_micro_ops.
+ */
+static int
+run_block_body(APEX_CPU *cpu, APEX_Block_Cache *cache, APEX_Block *block, int count)
+{
+    int done = 0;
+
+    if (cache->jit && count > 0)
+    {
+        if (!block->native && ++block->heat == cpu->config.jit_threshold)
+        {
+            block->native = APEX_jit_compile(cache->jit, block->ops, count);
+        }
+        if (block->native)
+        {
+            done = block->native(cpu);
+            cache->native += done;
+            if (done < count)
+            {
+                cache->bails++;
+            }
+        }
+    }
+    return done + run_micro_ops(cpu, block->ops + done, count - done, block->start + done);
+}
+
+/*
+ * Block-to-block dispatch of the functional interpreter, same contract as the
+ * per-instruction loops in apex_func.c: stops after HALT (counted), at the
+ * instruction limit, or when the next index is outside the program
+ */
+int
+APEX_block_run(APEX_CPU *cpu, int *index_io, long max_insns, long *executed_out)
+{
+    APEX_Block_Cache *cache = get_block_cache(cpu);
+    const long budget = max_insns ? max_insns : -1;
+    long executed = 0;
+    int index = *index_io;
+    APEX_Block *block = NULL;
+    int status;
+
+    if (!cache)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the block cache\n");
+        return APEX_FUNC_ERROR;
+    }
+
+    for (;;)
+    {
+        APEX_Block **link = NULL;
+        int body, done;
+
+        if (budget >= 0 && executed == budget)
+        {
+            status = APEX_FUNC_LIMIT;
+            break;
+        }
+
+        /* Follow the chain of the previous block, or look the block up */
+        if (block)
+        {
+            int taken = index != block->start + block->count;
+
+            link = taken ? &block->taken_to : &block->next;
+        }
+        if (link && *link)
+        {
+            block = *link;
+            cache->chained++;
+        }
+        else
+        {
+            if (index < 0 || index >= cpu->code_memory_size)
+            {
+                status = APEX_FUNC_ERROR;
+                break;
+            }
+            if (!cache->at[index])
+            {
+                cache->at[index] = translate_block(cpu, index);
+                if (!cache->at[index])
+                {
+                    fprintf(stderr, "APEX_Error: Unable to translate block at pc(%d)\n", 4000 + index * 4);
+                    status = APEX_FUNC_ERROR;
+                    break;
+                }
+                cache->blocks++;
+            }
+            block = cache->at[index];
+            if (link)
+            {
+                *link = block;
+            }
+        }
+        cache->entries++;
+
+        /* Not enough budget left for the whole block, stop inside it */
+        if (budget >= 0 && budget - executed < block->count)
+        {
+            int partial = budget - executed;
+
+            done = run_micro_ops(cpu, block->ops, partial, block->start);
+            executed += done;
+            index = block->start + done;
+            status = done < partial ? APEX_FUNC_ERROR : APEX_FUNC_LIMIT;
+            break;
+        }
+
+        body = block->branch == BR_NONE ? block->count : block->count - 1;
+        done = run_block_body(cpu, cache, block, body);
+        if (done < body)
+        {
+            /* The run stops in front of the micro-op that faulted */
+            executed += done;
+            index = block->start + done;
+            status = APEX_FUNC_ERROR;
+            break;
+        }
+        executed += block->count;
+        if (block->branch == BR_HALT)
+        {
+            index = block->start + block->count - 1;
+            status = APEX_FUNC_HALTED;
+            break;
+        }
+        index = block->start + block->count;
+        if (block->branch == BR_NONE)
+        {
+            continue;
+        }
+
+        if ((block->branch == BR_Z && cpu->zero_flag == TRUE) ||
+            (block->branch == BR_NZ && cpu->zero_flag == FALSE))
+        {
+            if (block->taken < 0)
+            {
+                /* Same as the other loops, the pc is left at the bad target */
+                const APEX_Instruction *br = &block->ops[block->count - 1];
+
+                index = block->start + block->count - 1 + br->imm / 4;
+                status = APEX_FUNC_ERROR;
+                break;
+            }
+            index = block->taken;
+        }
+    }
+
+    *index_io = index;
+    *executed_out = executed;
+    return status;
+}
+
+/*
+ * Prints how well the cache did, an entry is a hit when the block was
+ * already translated
+ */
+void
+APEX_block_cache_print_stats(const APEX_CPU *cpu)
+{
+    const APEX_Block_Cache *cache = cpu->block_cache;
+    long hits;
+
+    if (!cache)
+    {
+        return;
+    }
+    hits = cache->entries - cache->blocks;
+    printf("APEX_BLOCK_CACHE: blocks = %ld, entries = %ld, hit rate = %.2f%%, chained = %.2f%%\n",
+           cache->blocks, cache->entries, cache->entries ? 100.0 * hits / cache->entries : 0.0,
+           cache->entries ? 100.0 * cache->chained / cache->entries : 0.0);
+    if (cpu->config.func_dispatch == FUNC_DISPATCH_JIT)
+    {
+        APEX_jit_print_stats(cache->jit);
+        printf("APEX_JIT: native insns = %ld (%.2f%% of %" PRId64 "), bails to the interpreter = %ld\n", cache->native,
+               cpu->insn_completed ? 100.0 * cache->native / cpu->insn_completed : 0.0, cpu->insn_completed,
+               cache->bails);
+    }
+}
+
+void
+APEX_block_cache_free(APEX_CPU *cpu)
+{
+    APEX_Block_Cache *cache = cpu->block_cache;
+    int i;
+
+    if (!cache)
+    {
+        return;
+    }
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        free(cache->at[i]);
+    }
+    free(cache->at);
+    APEX_jit_free(cache->jit);
+    free(cache);
+    cpu->block_cache = NULL;
+}
@@ -0,0 +1,226 @@
+/*
+ * apex_bpred.c
+ * Contains the branch predictor. Fetch asks it where to go on after a
+ * BZ/BNZ, the int unit tells it the outcome once the branch resolves and
+ * squashes what fetch brought in when the prediction was wrong.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_bpred.h"
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+static const char *const bp_names[BP_COUNT] = {"not-taken", "btfn", "bimodal", "gshare"};
+
+/* Counter of the branch at code memory index 'insn', gshare folds in the history it was predicted with */
+static unsigned char *
+counter_of(APEX_CPU *cpu, int insn, unsigned int history)
+{
+    unsigned int index = insn;
+
+    if (cpu->config.branch_predictor == BP_GSHARE)
+    {
+        index ^= history & ((1u << cpu->config.bp_history_bits) - 1);
+    }
+    return &cpu->bpred.counters[index & ((1u << cpu->config.bp_table_bits) - 1)];
+}
+
+static APEX_Btb_Entry *
+btb_entry_of(APEX_CPU *cpu, int insn)
+{
+    return &cpu->bpred.btb[insn % cpu->config.btb_entries];
+}
+
+/* Moves the counter towards the outcome and puts a taken branch in the BTB */
+static void
+update(APEX_CPU *cpu, int insn, unsigned int history, int taken)
+{
+    unsigned char *counter;
+
+    /* The static not-taken predictor has nothing to learn */
+    if (cpu->config.branch_predictor == BP_NOT_TAKEN)
+    {
+        return;
+    }
+    counter = counter_of(cpu, insn, history);
+    if (taken)
+    {
+        APEX_Btb_Entry *entry = btb_entry_of(cpu, insn);
+
+        if (*counter < 3)
+        {
+            (*counter)++;
+        }
+        entry->pc = 4000 + 4 * insn;
+        entry->target = entry->pc + cpu->code_memory[insn].imm;
+    }
+    else if (*counter > 0)
+    {
+        (*counter)--;
+    }
+}
+
+/* Weakly not-taken counters, an empty BTB and no history */
+void
+APEX_bpred_reset(APEX_CPU *cpu)
+{
+    memset(cpu->bpred.counters, 1, sizeof(cpu->bpred.counters));
+    memset(cpu->bpred.btb, 0, sizeof(cpu->bpred.btb));
+    cpu->bpred.history = 0;
+}
+
+/*
+ * Predicts the BZ/BNZ in the fetch latch 'stage' and returns the pc fetch
+ * goes on at. Going on at the target needs the branch to be in the BTB, a
+ * branch that is not goes on at pc + 4 whatever the counters say.
+ */
+int
+APEX_bpred_predict(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    APEX_Bpred *bp = &cpu->bpred;
+    const APEX_Btb_Entry *entry;
+    int taken;
+
+    stage->predicted = FALSE;
+    stage->history = bp->history;
+    if (cpu->config.branch_predictor == BP_NOT_TAKEN)
+    {
+        return stage->pc + 4;
+    }
+
+    entry = btb_entry_of(cpu, stage->insn);
+    if (entry->pc != stage->pc)
+    {
+        cpu->stats.btb_misses++;
+        taken = FALSE;
+    }
+    else if (cpu->config.branch_predictor == BP_BTFN)
+    {
+        taken = entry->target <= stage->pc;
+    }
+    else
+    {
+        taken = *counter_of(cpu, stage->insn, bp->history) >= 2;
+    }
+    bp->history = (bp->history << 1) | taken;
+    stage->predicted = taken;
+    return taken ? entry->target : stage->pc + 4;
+}
+
+/*
+ * Trains the predictor with the outcome of a BZ/BNZ that has resolved and
+ * returns TRUE when fetch went the wrong way after it. The global history
+ * is then rebuilt from the one the branch was predicted with, which drops
+ * what younger branches fetched on the wrong path pushed.
+ */
+int
+APEX_bpred_resolve(APEX_CPU *cpu, const CPU_Stage *stage, int taken)
+{
+    const int mispredicted = taken != stage->predicted;
+
+    cpu->stats.branches++;
+    if (mispredicted)
+    {
+        cpu->bpred.history = (stage->history << 1) | taken;
+    }
+    if (cpu->bpred_rows)
+    {
+        APEX_Bpred_Row *row = &cpu->bpred_rows[stage->insn];
+
+        row->executed++;
+        row->taken += taken;
+        row->mispredicted += mispredicted;
+    }
+    update(cpu, stage->insn, stage->history, taken);
+    return mispredicted;
+}
+
+/*
+ * Trains the predictor with a BZ/BNZ the functional interpreter executed,
+ * so a pipeline started after a fast-forward finds it warm
+ */
+void
+APEX_bpred_train(APEX_CPU *cpu, int insn, int taken)
+{
+    const unsigned int history = cpu->bpred.history;
+
+    update(cpu, insn, history, taken);
+    cpu->bpred.history = (history << 1) | taken;
+}
+
+/* TRUE when the tables only send fetch to pcs inside code memory, for tables read from a file */
+int
+APEX_bpred_is_valid(const APEX_CPU *cpu, const APEX_Bpred *bpred)
+{
+    const int end = 4000 + 4 * cpu->code_memory_size;
+    int i;
+
+    for (i = 0; i < (1 << BP_MAX_TABLE_BITS); ++i)
+    {
+        if (bpred->counters[i] > 3)
+        {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < BTB_MAX_ENTRIES; ++i)
+    {
+        const APEX_Btb_Entry *entry = &bpred->btb[i];
+
+        if (entry->pc != 0 && (entry->pc < 4000 || entry->pc >= end || entry->pc % 4 != 0 ||
+                               entry->target < 4000 || entry->target >= end || entry->target % 4 != 0))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Starts counting the outcomes of every static branch from this cycle on, returns 0 on success */
+int
+APEX_bpred_start(APEX_CPU *cpu)
+{
+    free(cpu->bpred_rows);
+    cpu->bpred_rows = calloc(cpu->code_memory_size, sizeof(APEX_Bpred_Row));
+    return cpu->bpred_rows ? 0 : -1;
+}
+
+/* Prints the accuracy of the predictor, then of every branch since APEX_bpred_start */
+void
+APEX_bpred_print(const APEX_CPU *cpu)
+{
+    const int64_t branches = cpu->stats.branches;
+    const int64_t mispredicted = cpu->stats.flushes;
+    int i;
+
+    printf("APEX_BPRED: predictor = %s, branches = %" PRId64 ", mispredicted = %" PRId64
+           ", accuracy = %.2f%%, btb misses = %" PRId64 "\n",
+           bp_names[cpu->config.branch_predictor], branches, mispredicted,
+           branches ? 100.0 * (branches - mispredicted) / branches : 0.0, cpu->stats.btb_misses);
+    if (!cpu->bpred_rows)
+    {
+        return;
+    }
+
+    printf("\n%-6s %-20s %-10s %-10s %-12s %s\n", "pc", "instruction", "executed", "taken", "mispredicted",
+           "accuracy");
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        const APEX_Bpred_Row *row = &cpu->bpred_rows[i];
+        char text[64];
+
+        if (!row->executed)
+        {
+            continue;
+        }
+        APEX_format_instruction(text, sizeof(text), &cpu->code_memory[i]);
+        printf("%-6d %-20s %-10" PRId64 " %-10" PRId64 " %-12" PRId64 " %.2f%%\n", 4000 + 4 * i, text, row->executed,
+               row->taken, row->mispredicted, 100.0 * (row->executed - row->mispredicted) / row->executed);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * apex_bpred.h
+ * Contains the state of the branch predictor fetch consults for every
+ * BZ/BNZ, the 2-bit counters, the branch target buffer and the global
+ * history, and the per-branch accuracy rows
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_BPRED_H_
+#define _APEX_BPRED_H_
+
+#include <stdint.h>
+
+#include "apex_macros.h"
+
+/* Values of the branch_predictor option */
+enum
+{
+  BP_NOT_TAKEN, /* static, fetch always goes on at pc + 4 */
+  BP_BTFN,      /* static, backward taken and forward not taken, for branches in the BTB */
+  BP_BIMODAL,   /* 2-bit counters indexed by the pc */
+  BP_GSHARE,    /* 2-bit counters indexed by the pc xor the global history */
+  BP_COUNT
+};
+
+/* One entry of the direct-mapped branch target buffer */
+typedef struct APEX_Btb_Entry
+{
+  int pc;     /* Pc of the branch, 0 for an empty entry */
+  int target; /* Pc it goes to when taken */
+} APEX_Btb_Entry;
+
+/*
+ * Tables of the predictor. They are long-lived like the contents of a
+ * real one, a detailed cpu started from a master gets them as they are.
+ */
+typedef struct APEX_Bpred
+{
+  unsigned char counters[1 << BP_MAX_TABLE_BITS]; /* 2-bit saturating counters, taken from 2 up */
+  APEX_Btb_Entry btb[BTB_MAX_ENTRIES];
+  unsigned int history; /* Outcomes of the last branches, newest in bit 0, updated speculatively at fetch */
+} APEX_Bpred;
+
+/* Outcomes of one static BZ/BNZ */
+typedef struct APEX_Bpred_Row
+{
+  int64_t executed;
+  int64_t taken;
+  int64_t mispredicted;
+} APEX_Bpred_Row;
+
+#endif
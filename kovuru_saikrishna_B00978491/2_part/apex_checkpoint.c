@@ -0,0 +1,371 @@
+/*
+ * apex_checkpoint.c
+ * Contains functions to save the simulator state to a checkpoint file and
+ * restore it, a restored cpu carries on cycle for cycle as the one that
+ * was saved
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_checkpoint.h"
+#include "apex_cpu.h"
+#include "apex_isa.h"
+#include "apex_macros.h"
+
+static uint32_t
+fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Hash of the program, field by field so padding inside APEX_Instruction
+ * does not matter
+ */
+static uint32_t
+hash_code_memory(const APEX_CPU *cpu)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        const APEX_Instruction *ins = &cpu->code_memory[i];
+        unsigned char fields[5] = {ins->opcode, ins->rd, ins->rs1, ins->rs2, ins->rs3};
+
+        hash = fnv1a(hash, fields, sizeof(fields));
+        hash = fnv1a(hash, &ins->imm, sizeof(ins->imm));
+    }
+    return hash;
+}
+
+/*
+ * Counters and BTB entries of the predictor a checkpoint stores, the ones
+ * the options index. The static not-taken predictor never changes its
+ * tables, they stay as APEX_bpred_reset left them.
+ */
+static void
+bpred_extent(const APEX_CPU *cpu, size_t *counters, size_t *btb_entries)
+{
+    const int stored = cpu->config.branch_predictor != BP_NOT_TAKEN;
+
+    *counters = stored ? (size_t)1 << cpu->config.bp_table_bits : 0;
+    *btb_entries = stored ? (size_t)cpu->config.btb_entries : 0;
+}
+
+/*
+ * Writes the state of the cpu to 'filename'. Returns 0 on success.
+ */
+int
+APEX_checkpoint_save(const APEX_CPU *cpu, const char *filename)
+{
+    APEX_Checkpoint_Header header;
+    APEX_Checkpoint_Core core;
+    int32_t *runs;
+    size_t words = 0;
+    size_t counters, btb_entries;
+    uint32_t checksum;
+    FILE *fp;
+    int i, ok;
+
+    /* Worst case is a run for every other word */
+    runs = malloc((DATA_MEMORY_SIZE / 2 + 1) * 2 * sizeof(int32_t) + DATA_MEMORY_SIZE * sizeof(int32_t));
+    if (!runs)
+    {
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, APEX_CHECKPOINT_MAGIC, sizeof(APEX_CHECKPOINT_MAGIC));
+    header.version = APEX_CHECKPOINT_VERSION;
+    header.code_count = cpu->code_memory_size;
+    header.code_hash = hash_code_memory(cpu);
+#define APEX_CHECKPOINT_SAVE_TIMING(name) header.timing.name = cpu->config.name;
+    APEX_CHECKPOINT_TIMING(APEX_CHECKPOINT_SAVE_TIMING)
+#undef APEX_CHECKPOINT_SAVE_TIMING
+
+    for (i = 0; i < DATA_MEMORY_SIZE;)
+    {
+        int start;
+
+        if (cpu->data_memory[i] == 0)
+        {
+            ++i;
+            continue;
+        }
+        start = i;
+        while (i < DATA_MEMORY_SIZE && cpu->data_memory[i] != 0)
+        {
+            ++i;
+        }
+        runs[words++] = start;
+        runs[words++] = i - start;
+        memcpy(&runs[words], &cpu->data_memory[start], (i - start) * sizeof(int32_t));
+        words += i - start;
+        header.run_count++;
+    }
+
+    memset(&core, 0, sizeof(core));
+    core.pc = cpu->pc;
+    core.clock = cpu->clock;
+    core.insn_completed = cpu->insn_completed;
+    core.zero_flag = cpu->zero_flag;
+    core.fetch_from_next_cycle = cpu->fetch_from_next_cycle;
+    core.fu_stalled = cpu->fu_stalled;
+    core.fetch_seq = cpu->fetch_seq;
+    core.cpi_fetch = cpu->cpi.fetch;
+    core.cpi_issue = cpu->cpi.issue;
+    core.cpi_complete = cpu->cpi.complete;
+    memcpy(core.regs, cpu->regs, sizeof(core.regs));
+    memcpy(core.regCheck, cpu->regCheck, sizeof(core.regCheck));
+    core.fetch = cpu->fetch;
+    core.decode = cpu->decode;
+    core.executing_count = cpu->executing_count;
+    memcpy(core.fu_ready, cpu->fu_ready, sizeof(core.fu_ready));
+    core.completion_count = cpu->completion_count;
+    core.stats = cpu->stats;
+    core.bp_history = cpu->bpred.history;
+    bpred_extent(cpu, &counters, &btb_entries);
+
+    checksum = fnv1a(2166136261u, &header, sizeof(header));
+    checksum = fnv1a(checksum, &core, sizeof(core));
+    checksum = fnv1a(checksum, cpu->executing, cpu->executing_count * sizeof(CPU_Stage));
+    checksum = fnv1a(checksum, cpu->completion, cpu->completion_count * sizeof(CPU_Stage));
+    checksum = fnv1a(checksum, cpu->bpred.counters, counters);
+    checksum = fnv1a(checksum, cpu->bpred.btb, btb_entries * sizeof(APEX_Btb_Entry));
+    checksum = fnv1a(checksum, runs, words * sizeof(int32_t));
+
+    fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", filename);
+        free(runs);
+        return -1;
+    }
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(&core, sizeof(core), 1, fp) == 1 &&
+         fwrite(cpu->executing, sizeof(CPU_Stage), cpu->executing_count, fp) == (size_t)cpu->executing_count &&
+         fwrite(cpu->completion, sizeof(CPU_Stage), cpu->completion_count, fp) == (size_t)cpu->completion_count &&
+         fwrite(cpu->bpred.counters, 1, counters, fp) == counters &&
+         fwrite(cpu->bpred.btb, sizeof(APEX_Btb_Entry), btb_entries, fp) == btb_entries &&
+         fwrite(runs, sizeof(int32_t), words, fp) == words && fwrite(&checksum, sizeof(checksum), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    free(runs);
+    if (!ok)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+stage_is_valid(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    return stage->insn >= 0 && stage->insn < cpu->code_memory_size;
+}
+
+/* Counts the write of 'stage' in 'writers' when it holds an instruction that writes a register */
+static void
+count_writer(const APEX_CPU *cpu, const CPU_Stage *stage, int32_t *writers)
+{
+    const APEX_Instruction *ins = &cpu->code_memory[stage->insn];
+
+    if (stage->has_insn && (apex_isa[ins->opcode].dst & OPND_RD))
+    {
+        writers[ins->rd]++;
+    }
+}
+
+/*
+ * TRUE when every regCheck count is the number of decoded instructions still
+ * in flight that write the register, in an FU or in the completion buffer.
+ * Decode counts a writer in and writeback counts it out, any other count
+ * would stall on or free a register wrongly. The entries must already be valid.
+ */
+static int
+reg_check_is_valid(const APEX_CPU *cpu, const APEX_Checkpoint_Core *core, const CPU_Stage *executing,
+                   const CPU_Stage *completion)
+{
+    int32_t writers[REG_FILE_SIZE];
+    int i;
+
+    memset(writers, 0, sizeof(writers));
+    for (i = 0; i < core->executing_count; ++i)
+    {
+        count_writer(cpu, &executing[i], writers);
+    }
+    for (i = 0; i < core->completion_count; ++i)
+    {
+        count_writer(cpu, &completion[i], writers);
+    }
+    return memcmp(writers, core->regCheck, sizeof(writers)) == 0;
+}
+
+/*
+ * Replaces the state of the cpu with the one saved in 'filename'. The cpu
+ * must have the same program loaded. Nothing is changed unless the whole
+ * file is valid. Returns 0 on success.
+ */
+int
+APEX_checkpoint_restore(APEX_CPU *cpu, const char *filename)
+{
+    APEX_Checkpoint_Header header;
+    APEX_Checkpoint_Core core;
+    CPU_Stage executing[COMPLETION_BUFFER_SIZE];
+    CPU_Stage completion[COMPLETION_BUFFER_SIZE];
+    APEX_Bpred bpred;
+    size_t counters, btb_entries;
+    int data_memory[DATA_MEMORY_SIZE];
+    uint32_t checksum, stored;
+    unsigned int run;
+    FILE *fp;
+    int i;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to open checkpoint %s\n", filename);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, APEX_CHECKPOINT_MAGIC, sizeof(APEX_CHECKPOINT_MAGIC)) != 0 ||
+        header.version != APEX_CHECKPOINT_VERSION)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a version %d APEX checkpoint\n", filename, APEX_CHECKPOINT_VERSION);
+        fclose(fp);
+        return -1;
+    }
+    if (header.code_count != (uint32_t)cpu->code_memory_size || header.code_hash != hash_code_memory(cpu))
+    {
+        fprintf(stderr, "APEX_Error: %s was saved from a different program\n", filename);
+        fclose(fp);
+        return -1;
+    }
+#define APEX_CHECKPOINT_CHECK_TIMING(name)                                                              \
+    if (header.timing.name != cpu->config.name)                                                         \
+    {                                                                                                   \
+        fprintf(stderr, "APEX_Error: %s was saved with " #name "=%d, resume it with the same options\n", \
+                filename, header.timing.name);                                                          \
+        fclose(fp);                                                                                     \
+        return -1;                                                                                      \
+    }
+    APEX_CHECKPOINT_TIMING(APEX_CHECKPOINT_CHECK_TIMING)
+#undef APEX_CHECKPOINT_CHECK_TIMING
+
+    checksum = fnv1a(2166136261u, &header, sizeof(header));
+    if (fread(&core, sizeof(core), 1, fp) != 1 || core.executing_count < 0 || core.completion_count < 0 ||
+        core.executing_count + core.completion_count > COMPLETION_BUFFER_SIZE ||
+        fread(executing, sizeof(CPU_Stage), core.executing_count, fp) != (size_t)core.executing_count ||
+        fread(completion, sizeof(CPU_Stage), core.completion_count, fp) != (size_t)core.completion_count)
+    {
+        goto corrupt;
+    }
+    /* The timing options match, so the tables stored are the ones this cpu indexes */
+    bpred = cpu->bpred;
+    bpred.history = core.bp_history;
+    bpred_extent(cpu, &counters, &btb_entries);
+    if (fread(bpred.counters, 1, counters, fp) != counters ||
+        fread(bpred.btb, sizeof(APEX_Btb_Entry), btb_entries, fp) != btb_entries)
+    {
+        goto corrupt;
+    }
+    checksum = fnv1a(checksum, &core, sizeof(core));
+    checksum = fnv1a(checksum, executing, core.executing_count * sizeof(CPU_Stage));
+    checksum = fnv1a(checksum, completion, core.completion_count * sizeof(CPU_Stage));
+    checksum = fnv1a(checksum, bpred.counters, counters);
+    checksum = fnv1a(checksum, bpred.btb, btb_entries * sizeof(APEX_Btb_Entry));
+
+    memset(data_memory, 0, sizeof(data_memory));
+    for (run = 0; run < header.run_count; ++run)
+    {
+        int32_t extent[2];
+
+        if (fread(extent, sizeof(int32_t), 2, fp) != 2 || extent[0] < 0 || extent[1] <= 0 ||
+            extent[0] > DATA_MEMORY_SIZE - extent[1] ||
+            fread(&data_memory[extent[0]], sizeof(int32_t), extent[1], fp) != (size_t)extent[1])
+        {
+            goto corrupt;
+        }
+        checksum = fnv1a(checksum, extent, sizeof(extent));
+        checksum = fnv1a(checksum, &data_memory[extent[0]], extent[1] * sizeof(int32_t));
+    }
+    if (fread(&stored, sizeof(stored), 1, fp) != 1 || stored != checksum || fgetc(fp) != EOF)
+    {
+        goto corrupt;
+    }
+    fclose(fp);
+
+    if (!stage_is_valid(cpu, &core.fetch) || !stage_is_valid(cpu, &core.decode))
+    {
+        goto invalid;
+    }
+    for (i = 0; i < core.executing_count; ++i)
+    {
+        if (!stage_is_valid(cpu, &executing[i]) || executing[i].unit < 0 || executing[i].unit >= FU_MAX_UNITS ||
+            executing[i].cycles_left < 1)
+        {
+            goto invalid;
+        }
+    }
+    for (i = 0; i < core.completion_count; ++i)
+    {
+        if (!stage_is_valid(cpu, &completion[i]))
+        {
+            goto invalid;
+        }
+    }
+    if (!reg_check_is_valid(cpu, &core, executing, completion))
+    {
+        goto invalid;
+    }
+    if ((uint32_t)core.cpi_fetch >= APEX_CPI_COUNT || (uint32_t)core.cpi_issue >= APEX_CPI_COUNT ||
+        (uint32_t)core.cpi_complete >= APEX_CPI_COUNT || !APEX_bpred_is_valid(cpu, &bpred))
+    {
+        goto invalid;
+    }
+
+    cpu->pc = core.pc;
+    cpu->clock = core.clock;
+    cpu->insn_completed = core.insn_completed;
+    cpu->zero_flag = core.zero_flag;
+    cpu->fetch_from_next_cycle = core.fetch_from_next_cycle;
+    cpu->fu_stalled = core.fu_stalled;
+    cpu->fetch_seq = core.fetch_seq;
+    cpu->cpi.fetch = core.cpi_fetch;
+    cpu->cpi.issue = core.cpi_issue;
+    cpu->cpi.complete = core.cpi_complete;
+    memcpy(cpu->regs, core.regs, sizeof(cpu->regs));
+    memcpy(cpu->regCheck, core.regCheck, sizeof(cpu->regCheck));
+    cpu->fetch = core.fetch;
+    cpu->decode = core.decode;
+    memcpy(cpu->executing, executing, core.executing_count * sizeof(CPU_Stage));
+    cpu->executing_count = core.executing_count;
+    memcpy(cpu->fu_ready, core.fu_ready, sizeof(cpu->fu_ready));
+    memcpy(cpu->completion, completion, core.completion_count * sizeof(CPU_Stage));
+    cpu->completion_count = core.completion_count;
+    cpu->stats = core.stats;
+    cpu->bpred = bpred;
+    /* Snapshots go on from the restored cycle */
+    APEX_stats_free(cpu);
+    APEX_stats_start(cpu);
+    memcpy(cpu->data_memory, data_memory, sizeof(cpu->data_memory));
+    return 0;
+
+corrupt:
+    fclose(fp);
+invalid:
+    fprintf(stderr, "APEX_Error: %s is truncated or corrupt\n", filename);
+    return -1;
+}
@@ -0,0 +1,90 @@
+/*
+ * apex_checkpoint.h
+ * Contains the checkpoint file format (.apexckp), a snapshot of the whole
+ * simulator state that a later run resumes from
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_CHECKPOINT_H_
+#define _APEX_CHECKPOINT_H_
+
+#include <stdint.h>
+
+#include "apex_cpu.h"
+
+#define APEX_CHECKPOINT_MAGIC "APEXCKP"
+/* Bump whenever the layout below or CPU_Stage changes */
+#define APEX_CHECKPOINT_VERSION 8
+
+/* Options the timing of the pipeline depends on, a checkpoint only resumes
+ * under the values it was saved with */
+#define APEX_CHECKPOINT_TIMING(X)                                                                           \
+  X(int_latency) X(int_units) X(int_pipelined) X(int_interval)                                            \
+  X(mul_latency) X(mul_units) X(mul_pipelined) X(mul_interval)                                            \
+  X(div_latency) X(div_units) X(div_pipelined) X(div_interval)                                            \
+  X(load_latency) X(load_units) X(load_pipelined) X(load_interval)                                        \
+  X(forwarding) X(wb_ports) X(completion_size)                                                            \
+  X(branch_predictor) X(bp_table_bits) X(bp_history_bits) X(btb_entries)
+
+#define APEX_CHECKPOINT_TIMING_FIELD(name) int32_t name;
+typedef struct APEX_Checkpoint_Timing
+{
+  APEX_CHECKPOINT_TIMING(APEX_CHECKPOINT_TIMING_FIELD)
+} APEX_Checkpoint_Timing;
+#undef APEX_CHECKPOINT_TIMING_FIELD
+
+/*
+ * Layout of a checkpoint file, all fields in host byte order:
+ *
+ *   header | core state | FU entries | completion buffer | predictor tables |
+ *   data memory runs | checksum (uint32)
+ *
+ * Only the entries in use are stored, executing_count of the FUs and then
+ * completion_count of the completion buffer, oldest first. The predictor
+ * tables are the 1 << bp_table_bits counters and the btb_entries BTB
+ * entries the options give, none for the static not-taken predictor that
+ * never changes them.
+ * Data memory is stored as run_count runs of non-zero words, every run is
+ * its start address, its length and then the words themselves. The
+ * checksum is FNV-1a over everything before it.
+ */
+typedef struct APEX_Checkpoint_Header
+{
+  char magic[8];       /* APEX_CHECKPOINT_MAGIC, NUL padded */
+  uint32_t version;    /* APEX_CHECKPOINT_VERSION */
+  uint32_t code_count; /* Instructions of the program the checkpoint belongs to */
+  uint32_t code_hash;  /* Hash of that program, a checkpoint only resumes the same program */
+  uint32_t run_count;  /* Runs of non-zero data memory words */
+  APEX_Checkpoint_Timing timing;
+} APEX_Checkpoint_Header;
+
+/* Pipeline and architectural state, everything but data memory */
+typedef struct APEX_Checkpoint_Core
+{
+  int32_t pc;
+  int64_t clock;
+  int64_t insn_completed;
+  int32_t zero_flag;
+  int32_t fetch_from_next_cycle;
+  int32_t fu_stalled;
+  int64_t fetch_seq;
+  int32_t cpi_fetch;
+  int32_t cpi_issue;
+  int32_t cpi_complete;
+  int32_t regs[REG_FILE_SIZE];
+  int32_t regCheck[REG_FILE_SIZE];
+  CPU_Stage fetch;
+  CPU_Stage decode;
+  int32_t executing_count;  /* Entries of the FUs that follow */
+  int64_t fu_ready[FU_COUNT][FU_MAX_UNITS];
+  int32_t completion_count; /* Entries of the completion buffer that follow them */
+  APEX_Stats stats;
+  uint32_t bp_history; /* Global history of the predictor, its tables follow the entries */
+} APEX_Checkpoint_Core;
+
+int APEX_checkpoint_save(const APEX_CPU *cpu, const char *filename);
+int APEX_checkpoint_restore(APEX_CPU *cpu, const char *filename);
+
+#endif
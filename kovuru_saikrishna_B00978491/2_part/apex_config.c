@@ -0,0 +1,95 @@
+/*
+ * apex_config.c
+ * Contains functions to set the run-time options of the APEX simulator
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "apex_config.h"
+
+/*
+ * Sets every option to its default value
+ */
+void
+APEX_config_init(APEX_Config *config)
+{
+#define APEX_CONFIG_DEFAULT(name, def, ...) config->name = def;
+    APEX_CONFIG_OPTIONS(APEX_CONFIG_DEFAULT)
+#undef APEX_CONFIG_DEFAULT
+}
+
+/*
+ * Parses one "name=value" option. Returns 0 on success, -1 if the option is
+ * unknown or its value is out of range.
+ */
+int
+APEX_config_set(APEX_Config *config, const char *option)
+{
+    const char *equals = strchr(option, '=');
+    size_t name_len;
+    char *value_end;
+    long value;
+
+    if (!equals)
+    {
+        return -1;
+    }
+    name_len = equals - option;
+    value = strtol(equals + 1, &value_end, 0);
+    if (value_end == equals + 1 || *value_end != '\0')
+    {
+        fprintf(stderr, "APEX_Error: option '%s' needs a number\n", option);
+        return -1;
+    }
+
+#define APEX_CONFIG_MATCH(name, def, min, max, help)                                      \
+    if (name_len == strlen(#name) && strncmp(option, #name, name_len) == 0)               \
+    {                                                                                     \
+        if (value < (min) || value > (max))                                               \
+        {                                                                                 \
+            fprintf(stderr, "APEX_Error: %s must be between %d and %d\n", #name, min, max); \
+            return -1;                                                                    \
+        }                                                                                 \
+        config->name = value;                                                             \
+        return 0;                                                                         \
+    }
+    APEX_CONFIG_OPTIONS(APEX_CONFIG_MATCH)
+#undef APEX_CONFIG_MATCH
+
+    fprintf(stderr, "APEX_Error: unknown option '%.*s'\n", (int)name_len, option);
+    return -1;
+}
+
+/*
+ * Prints every option with its default value
+ */
+void
+APEX_config_print_usage(void)
+{
+    fprintf(stderr, "Options (name=value):\n");
+#define APEX_CONFIG_USAGE(name, def, min, max, help) \
+    fprintf(stderr, "  %-22s %s (default %d)\n", #name, help, def);
+    APEX_CONFIG_OPTIONS(APEX_CONFIG_USAGE)
+#undef APEX_CONFIG_USAGE
+}
+
+/*
+ * Turns a thread count option into a real thread count, 0 means one thread
+ * per online CPU
+ */
+int
+APEX_config_resolve_threads(int threads)
+{
+    if (threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    return threads;
+}
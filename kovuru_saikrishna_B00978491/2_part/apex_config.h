@@ -0,0 +1,85 @@
+/*
+ * apex_config.h
+ * Contains the run-time options of the APEX simulator
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_CONFIG_H_
+#define _APEX_CONFIG_H_
+
+/*
+ * Run-time options, given on the command line as name=value.
+ *
+ * X(name, default, min, max, help)
+ */
+#define APEX_CONFIG_OPTIONS(X)                                                          \
+  X(quiet, 0, 0, 1, "no code memory listing or per-stage messages")                                       \
+  X(log_async, 1, 0, 1, "format the per-stage messages on a thread of their own")                       \
+  X(log_ring_size, 4096, 2, 1048576, "records the per-stage message ring holds")                        \
+  X(log_drop, 0, 0, 1, "drop per-stage messages when the ring is full instead of waiting")              \
+  X(int_latency, 1, 1, 64, "cycles an instruction spends in an int unit")                              \
+  X(int_units, 1, 1, 4, "int units (ALUs), decode issues to any free one")                              \
+  X(int_pipelined, 0, 0, 1, "an int unit takes a new instruction every int_interval cycles")            \
+  X(int_interval, 1, 1, 64, "cycles between two instructions entering a pipelined int unit")            \
+  X(mul_latency, 1, 1, 64, "cycles an instruction spends in a MUL unit")                                \
+  X(mul_units, 1, 1, 4, "MUL units, decode issues to any free one")                                     \
+  X(mul_pipelined, 0, 0, 1, "a MUL unit takes a new instruction every mul_interval cycles")              \
+  X(mul_interval, 1, 1, 64, "cycles between two instructions entering a pipelined MUL unit")            \
+  X(div_latency, 1, 1, 64, "cycles a DIV spends in a DIV unit")                                         \
+  X(div_units, 1, 1, 4, "DIV units, decode issues to any free one")                                     \
+  X(div_pipelined, 0, 0, 1, "a DIV unit takes a new instruction every div_interval cycles")              \
+  X(div_interval, 1, 1, 64, "cycles between two instructions entering a pipelined DIV unit")            \
+  X(load_latency, 1, 1, 64, "cycles a load or store spends in a LOAD unit")                             \
+  X(load_units, 1, 1, 4, "LOAD units, decode issues to any free one")                                   \
+  X(load_pipelined, 0, 0, 1, "a LOAD unit takes a new instruction every load_interval cycles")           \
+  X(load_interval, 1, 1, 64, "cycles between two instructions entering a pipelined LOAD unit")          \
+  X(forwarding, 0, 0, 1, "forward results from the FU outputs to decode")                        \
+  X(wb_ports, 1, 1, 8, "results writeback retires per cycle, oldest first")                             \
+  X(completion_size, 8, 1, 64, "instructions issued and not yet written back, at most")                 \
+  X(branch_predictor, 0, 0, 3, "fetch predicts BZ/BNZ (0 = not taken, 1 = BTFN, 2 = bimodal, 3 = gshare)") \
+  X(bp_table_bits, 10, 1, 12, "log2 of the 2-bit counters of the bimodal and gshare predictors")         \
+  X(bp_history_bits, 8, 0, 12, "branch outcomes of the global history gshare hashes with the pc")       \
+  X(btb_entries, 64, 1, 1024, "entries of the direct-mapped branch target buffer")                       \
+  X(bp_warming, 1, 0, 1, "train the branch predictor during functional fast-forwards")                  \
+  X(parse_threads, 1, 0, 1024, "threads used to parse the input file (0 = one per CPU)")         \
+  X(fast_forward, 0, 0, 2147483647, "instructions run functionally before the pipeline starts")        \
+  X(func_dispatch, 0, 0, 3, "functional interpreter dispatch (0 = threaded code, 1 = switch, 2 = block cache, 3 = JIT)") \
+  X(jit_threshold, 16, 1, 2147483647, "times a block runs before the JIT compiles it")                  \
+  X(sample_interval, 10000, 1, 2147483647, "instructions from the start of one sample to the next")     \
+  X(sample_warmup, 200, 0, 2147483647, "instructions simulated in detail before each measured window")   \
+  X(sample_window, 1000, 1, 2147483647, "instructions measured in detail per sample")                     \
+  X(interval_size, 1000000, 1, 2147483647, "instructions per interval of a parallel run")                 \
+  X(interval_warmup, 1000, 0, 2147483647, "instructions of the previous interval simulated before each one") \
+  X(interval_threads, 0, 0, 1024, "threads of a parallel run (0 = one per CPU)")                        \
+  X(stress_cpus, 16, 1, 1024, "cpus (one thread each) of a stress run")                                 \
+  X(stress_runs, 4, 1, 2147483647, "times every cpu of a stress run simulates the program")               \
+  X(batch_threads, 0, 0, 1024, "threads of apex_batch (0 = one per CPU)")                               \
+  X(sweep_threads, 0, 0, 1024, "threads of a sweep run (0 = one per CPU)")                              \
+  X(stats_interval, 0, 0, 2147483647, "cycles between snapshots of the stats counters (0 = none)")
+
+/* Values of func_dispatch, threaded code falls back to the switch when the
+ * compiler has no labels as values and the JIT to the block cache when the
+ * host is not x86-64 */
+enum
+{
+  FUNC_DISPATCH_THREADED,
+  FUNC_DISPATCH_SWITCH,
+  FUNC_DISPATCH_BLOCK,
+  FUNC_DISPATCH_JIT /* block cache, hot blocks compiled to native code */
+};
+
+#define APEX_CONFIG_FIELD(name, ...) int name;
+typedef struct APEX_Config
+{
+  APEX_CONFIG_OPTIONS(APEX_CONFIG_FIELD)
+} APEX_Config;
+#undef APEX_CONFIG_FIELD
+
+void APEX_config_init(APEX_Config *config);
+int APEX_config_set(APEX_Config *config, const char *option);
+void APEX_config_print_usage(void);
+int APEX_config_resolve_threads(int threads);
+
+#endif
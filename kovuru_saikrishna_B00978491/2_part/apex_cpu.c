@@ -6,119 +6,146 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "apex_cpu.h"
+#include "apex_func.h"
+#include "apex_log.h"
 #include "apex_macros.h"
+#include "apex_object.h"
 
 /* Converts the PC(4000 series) into array index for code writeback
  *
  * Note: You are not supposed to edit this function
  */
 
-struct flagCheck check;
-// Used these variables to implement teh stall functionality.
-int inUse = 1;
-int notInUse = 0;
-// to check if the register values are empty, I used while stalling.
-int isRegisterValueEmpty = 0;
-int mul_counter = 3;
-int load_counter = 4;
-
 static int
 get_code_memory_index_from_pc(const int pc)
 {
     return (pc - 4000) / 4;
 }
 
-static void
-print_instruction(const CPU_Stage *stage)
+/* TRUE when pc points into code memory */
+static int
+pc_is_valid(const APEX_CPU *cpu, int pc)
 {
-    switch (stage->opcode)
-    {
-    case OPCODE_ADD:
-    case OPCODE_SUB:
-    case OPCODE_MUL:
-    case OPCODE_DIV:
-    case OPCODE_AND:
-    case OPCODE_OR:
-    case OPCODE_XOR:
-    case OPCODE_LDR:
-    {
-        // since all the abouve OPCODE functions need the same stage variables rd, rs1,rs2 used them in common.
-        printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
-               stage->rs2);
-        break;
-    }
+    return pc >= 4000 && get_code_memory_index_from_pc(pc) < cpu->code_memory_size;
+}
 
-    case OPCODE_MOVC:
-    {
-        printf("%s,R%d,#%d ", stage->opcode_str, stage->rd, stage->imm);
-        break;
-    }
+static void
+print_instruction(const APEX_Instruction *ins)
+{
+    char text[64];
 
-    case OPCODE_LOAD:
-    case OPCODE_ADDL:
-    case OPCODE_SUBL:
-    {
-        // above three OPCODE functions need rd, rs1, imm.
-        printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
-               stage->imm);
-        break;
-    }
+    APEX_format_instruction(text, sizeof(text), ins);
+    printf("%s ", text);
+}
 
-    case OPCODE_STORE:
-    {
-        // store takes the immegiate value and rs2.
-        printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2,
-               stage->imm);
-        break;
-    }
+/* Text of an instruction as the display prints it, "ADD,R1,R2,R3" */
+void
+APEX_format_instruction(char *text, size_t size, const APEX_Instruction *ins)
+{
+    const unsigned char *field = apex_isa_format_fields[apex_isa[ins->opcode].format];
+    size_t len = snprintf(text, size, "%s", get_opcode_str(ins->opcode));
 
-    case OPCODE_STR:
+    // operands are printed in the same order as they are written in the input file.
+    for (; *field && len < size; ++field)
     {
-        // functionality is same as STORE but has the rs3 value.
-        printf("%s,R%d,R%d,R%d", stage->opcode_str, stage->rs1, stage->rs2, stage->rs3);
-        break;
+        switch (*field)
+        {
+        case OPND_RD:
+            len += snprintf(text + len, size - len, ",R%d", ins->rd);
+            break;
+        case OPND_RS1:
+            len += snprintf(text + len, size - len, ",R%d", ins->rs1);
+            break;
+        case OPND_RS2:
+            len += snprintf(text + len, size - len, ",R%d", ins->rs2);
+            break;
+        case OPND_RS3:
+            len += snprintf(text + len, size - len, ",R%d", ins->rs3);
+            break;
+        case OPND_IMM:
+            len += snprintf(text + len, size - len, ",#%d", ins->imm);
+            break;
+        }
     }
+}
 
-    case OPCODE_BZ:
-    case OPCODE_BNZ:
-    {
-        // since BZ and BNZ accepts only immediate value.
-        printf("%s,#%d ", stage->opcode_str, stage->imm);
-        break;
-    }
+/*
+ * Prints why the instruction at 'pc' stops the program: a DIV divides by
+ * zero, anything else accesses data memory at 'address', out of range
+ */
+void
+APEX_print_fault(const APEX_Instruction *ins, int pc, int address)
+{
+    char text[64];
 
-    case OPCODE_HALT:
-    case OPCODE_NOP:
+    APEX_format_instruction(text, sizeof(text), ins);
+    if (apex_isa[ins->opcode].alu == ALU_DIV)
     {
-        // we just take the opcode entred and nothing ither than that.
-        printf("%s", stage->opcode_str);
-        break;
+        fprintf(stderr, "APEX_Error: %s at pc(%d) divides by zero\n", text, pc);
     }
-
-    case OPCODE_CMP:
+    else
     {
-        // compare takes the two registers and compate the values.
-        printf("%s,R%d,R%d ", stage->opcode_str, stage->rs1, stage->rs2);
-        break;
-    }
+        fprintf(stderr, "APEX_Error: %s at pc(%d) accesses data memory address %d, outside 0..%d\n", text, pc,
+                address, DATA_MEMORY_SIZE - 1);
     }
 }
 
+/* Names the display prints for a stage holding an instruction, and for an empty one */
+static const char *const stage_names[APEX_STAGE_COUNT] = {
+    "Instruction at FETCH STAGE --->           ",
+    "Instruction at DECODE_RF_STAGE --->          ",
+    "Instruction at int EX STAGE --->                 ",
+    "Instruction at MUL EX STAGE --->                 ",
+    "Instruction at LOAD EX STAGE --->                 ",
+    "Instruction at WRITEBACK_STAGE --->       ",
+    "Instruction at DIV EX STAGE --->                 ",
+};
+static const char *const empty_stage_names[APEX_STAGE_COUNT] = {
+    "Instruction at FETCH STAGE --->           ",
+    "Instruction at DECODE_RF_STAGE --->      ",
+    "Instruction at int EX STAGE --->            ",
+    "Instruction at MUL EX STAGE --->            ",
+    "Instruction at LOAD EX STAGE --->            ",
+    "Instruction at WRITEBACK_STAGE --->      ",
+    "Instruction at DIV EX STAGE --->            ",
+};
+
 /* Debug function which prints the CPU stage content
  *
  * Note: You can edit this function to print in more detail
  */
 static void
-print_stage_content(const char *name, const CPU_Stage *stage)
+print_stage_content(const APEX_CPU *cpu, const APEX_Log_Record *record)
 {
-    printf("%-15s: pc(%d) ", name, stage->pc);
-    print_instruction(stage);
+    if (record->empty)
+    {
+        printf("%s: EMPTY\n", empty_stage_names[record->stage]);
+        return;
+    }
+    printf("%-15s: pc(%d) ", stage_names[record->stage], record->pc);
+    print_instruction(&cpu->code_memory[record->insn]);
     printf("\n");
+    // the MUL stage always printed its EMPTY line as well, the display output keeps it.
+    if (record->stage == APEX_STAGE_MUL)
+    {
+        printf("%s: EMPTY\n", empty_stage_names[record->stage]);
+    }
+}
+
+static void
+print_cycle_banner(int64_t clock)
+{
+    printf("--------------------------------------------\n");
+    // as mentioned in the specifications clock cyle has to be printed from '1'.
+    printf("Clock Cycle #: %" PRId64 "\n", clock);
+    printf("--------------------------------------------\n");
 }
 
 /* Debug function which prints the register file
@@ -126,7 +153,7 @@ print_stage_content(const char *name, const CPU_Stage *stage)
  * Note: You are not supposed to edit this function
  */
 static void
-print_reg_file(const APEX_CPU *cpu)
+print_reg_file(const int *regs)
 {
     int i;
 
@@ -134,765 +161,970 @@ print_reg_file(const APEX_CPU *cpu)
 
     for (int i = 0; i < REG_FILE_SIZE / 2; ++i)
     {
-        printf("R%-3d[%-3d] ", i, cpu->regs[i]);
+        printf("R%-3d[%-3d] ", i, regs[i]);
     }
 
     printf("\n");
 
     for (i = (REG_FILE_SIZE / 2); i < REG_FILE_SIZE; ++i)
     {
-        printf("R%-3d[%-3d] ", i, cpu->regs[i]);
+        printf("R%-3d[%-3d] ", i, regs[i]);
     }
 
     printf("\n");
 }
 
+/* Prints one record of the display, on the simulation thread or on the
+ * writer thread of the log, 'arg' is the cpu */
+static void
+print_display_record(const APEX_Log_Record *record, void *arg)
+{
+    switch (record->kind)
+    {
+    case APEX_LOG_CYCLE:
+        print_cycle_banner(record->clock);
+        break;
+    case APEX_LOG_STAGE:
+        print_stage_content(arg, record);
+        break;
+    case APEX_LOG_REGS:
+        print_reg_file(record->regs);
+        break;
+    case APEX_LOG_DROPPED:
+        printf("APEX_LOG: %" PRId64 " records dropped\n", record->clock);
+        break;
+    }
+}
+
+/* The display observer's arg is its log, NULL prints on the simulation thread */
+static void
+display_record(const APEX_CPU *cpu, void *arg, const APEX_Log_Record *record)
+{
+    if (arg)
+    {
+        APEX_log_push(arg, record);
+    }
+    else
+    {
+        print_display_record(record, (void *)cpu);
+    }
+}
+
+static void
+display_cycle_begin(const APEX_CPU *cpu, void *arg)
+{
+    APEX_Log_Record record = {.kind = APEX_LOG_CYCLE, .clock = cpu->clock + 1};
+
+    display_record(cpu, arg, &record);
+}
+
+static void
+display_stage(const APEX_CPU *cpu, APEX_Stage_Id id, const CPU_Stage *stage, void *arg)
+{
+    APEX_Log_Record record = {.kind = APEX_LOG_STAGE, .stage = id, .empty = !stage};
+
+    // the DIV units are not a stage of the original pipeline, they are only shown while in use.
+    if (!stage && id == APEX_STAGE_DIV)
+    {
+        return;
+    }
+    if (stage)
+    {
+        record.pc = stage->pc;
+        record.insn = stage->insn;
+    }
+    display_record(cpu, arg, &record);
+}
+
+static void
+display_cycle_end(const APEX_CPU *cpu, void *arg)
+{
+    APEX_Log_Record record = {.kind = APEX_LOG_REGS};
+
+    memcpy(record.regs, cpu->regs, sizeof(record.regs));
+    display_record(cpu, arg, &record);
+}
+
+static void
+display_sync(const APEX_CPU *cpu, void *arg)
+{
+    (void)cpu;
+    if (arg)
+    {
+        APEX_log_drain(arg);
+    }
+}
+
+/* Observer printing what the display and simulate modes show every cycle,
+ * every run takes its own copy to register */
+static const APEX_Observer display_observer = {display_cycle_begin, display_stage, display_cycle_end, display_sync,
+                                               NULL, NULL};
+
+/* Registers the display, formatted on a thread of its own with log_async */
+static void
+start_display(APEX_CPU *cpu, APEX_Observer *display)
+{
+    if (cpu->config.log_async)
+    {
+        // without a writer thread the display is printed on this thread, as with log_async=0.
+        display->arg = APEX_log_open(print_display_record, cpu, cpu->config.log_ring_size,
+                                     cpu->config.log_drop ? APEX_LOG_DROP : APEX_LOG_BLOCK);
+    }
+    APEX_cpu_add_observer(cpu, display);
+}
+
+static void
+stop_display(APEX_CPU *cpu, APEX_Observer *display)
+{
+    APEX_cpu_remove_observer(cpu, display);
+    if (display->arg)
+    {
+        long dropped = APEX_log_close(display->arg);
+
+        display->arg = NULL;
+        if (dropped)
+        {
+            fprintf(stderr, "APEX_LOG: %ld records dropped, the ring was full\n", dropped);
+        }
+    }
+}
+
+/* Tells every observer what a stage held this cycle, NULL when it was empty */
+static void
+notify_stage(const APEX_CPU *cpu, APEX_Stage_Id id, const CPU_Stage *stage)
+{
+    const APEX_Observer *observer;
+
+    for (observer = cpu->observers; observer; observer = observer->next)
+    {
+        if (observer->stage)
+        {
+            observer->stage(cpu, id, stage, observer->arg);
+        }
+    }
+}
+
 /*
  * Fetch Stage of APEX Pipeline
  *
  * Note: You are free to edit this function according to your implementation
  */
-static void
-APEX_fetch(APEX_CPU *cpu)
+static inline __attribute__((always_inline)) void
+APEX_fetch(APEX_CPU *cpu, const int observed)
 {
-    APEX_Instruction *current_ins;
-
     if (cpu->fetch.has_insn)
     {
         /* This fetches new branch target instruction from next cycle */
         if (cpu->fetch_from_next_cycle == TRUE)
         {
             cpu->fetch_from_next_cycle = FALSE;
+            cpu->cpi.fetch = APEX_CPI_BRANCH;
 
             /* Skip this cycle*/
             return;
         }
 
+        /* Nothing to fetch at a pc outside code memory, decode gets a bubble. Writeback stops
+         * the program once nothing older is left that could still branch away from it */
+        if (!pc_is_valid(cpu, cpu->pc))
+        {
+            if (cpu->decode.is_stalled == cpu->check.notInUse)
+            {
+                cpu->decode.has_insn = FALSE;
+            }
+            if (observed)
+            {
+                notify_stage(cpu, APEX_STAGE_FETCH, NULL);
+            }
+            return;
+        }
+
         /* Store current PC in fetch latch */
         cpu->fetch.pc = cpu->pc;
+        cpu->fetch.seq = cpu->fetch_seq;
+
+        /* Index into code memory using this pc, later stages read the
+         * instruction fields through this index */
+        cpu->fetch.insn = get_code_memory_index_from_pc(cpu->pc);
 
-        /* Index into code writeback using this pc and copy all instruction fields
-         * into fetch latch  */
-        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
-        strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
-        cpu->fetch.opcode = current_ins->opcode;
-        cpu->fetch.rd = current_ins->rd;
-        cpu->fetch.rs1 = current_ins->rs1;
-        cpu->fetch.rs2 = current_ins->rs2;
-        cpu->fetch.imm = current_ins->imm;
-
-        if (cpu->decode.is_stalled != notInUse || cpu->decode.is_stalled == inUse)
+        if (cpu->decode.is_stalled != cpu->check.notInUse || cpu->decode.is_stalled == cpu->check.inUse)
         {
             // nothing to increment as the stalling is needed set is_stalled true
             // just setting the value 1 as it has to be stalled.
-            cpu->fetch.is_stalled = inUse;
+            cpu->fetch.is_stalled = cpu->check.inUse;
+            cpu->stats.fetch_stall++;
         }
         /* Stop fetching new instructions if HALT is fetched */
-        else if (cpu->fetch.opcode == OPCODE_HALT)
+        else if (cpu->code_memory[cpu->fetch.insn].opcode == OPCODE_HALT)
         {
-            if (cpu->decode.is_stalled == notInUse)
+            if (cpu->decode.is_stalled == cpu->check.notInUse)
             {
                 // commented as interrupting o/p
                 //  printf("\nFETCH stage HALT\n");
                 cpu->decode = cpu->fetch;
+                cpu->fetch_seq++;
+                cpu->cpi.fetch = APEX_CPI_BASE;
                 // if the instruction is HALT we should not receve any of the new instructions so setting fetch.has_insn to false.
                 cpu->fetch.has_insn = FALSE;
             }
         }
-        else if (cpu->decode.is_stalled == notInUse)
+        else if (cpu->decode.is_stalled == cpu->check.notInUse)
         {
+            const int branch = apex_isa[cpu->code_memory[cpu->fetch.insn].opcode].branch;
+
             /* Update PC for next instruction */
-            // incements the PC and takes the next instruction only when stall is not in use
-            cpu->pc += 4;
+            // incements the PC and takes the next instruction only when stall is not in use, after a
+            // BZ/BNZ the predictor says where fetch goes on and the int unit squashes if it was wrong.
+            if (branch == BR_Z || branch == BR_NZ)
+            {
+                cpu->pc = APEX_bpred_predict(cpu, &cpu->fetch);
+            }
+            else
+            {
+                cpu->pc += 4;
+            }
 
             /* Copy data from fetch latch to decode latch*/
 
             cpu->decode = cpu->fetch;
+            cpu->fetch_seq++;
+            cpu->cpi.fetch = APEX_CPI_BASE;
         }
 
         // printing the stage content
-        if (ENABLE_DEBUG_MESSAGES)
+        if (observed)
         {
-            print_stage_content("Instruction at FETCH STAGE --->           ", &cpu->fetch);
+            notify_stage(cpu, APEX_STAGE_FETCH, &cpu->fetch);
         }
     }
 
-    else if (cpu->fetch.opcode != OPCODE_HALT)
+    else if (cpu->code_memory[cpu->fetch.insn].opcode != OPCODE_HALT)
     {
-        if (cpu->decode.is_stalled == notInUse)
+        if (cpu->decode.is_stalled == cpu->check.notInUse)
         {
             // if not halt or stalled, pass the fetch data instructions to decode.
             cpu->decode = cpu->fetch;
         }
     }
-    else if (ENABLE_DEBUG_MESSAGES)
+    else
     {
         // else just display "empty" .
         // cpu->decode = cpu->fetch;
         cpu->fetch.has_insn = FALSE;
-        printf("Instruction at FETCH STAGE --->           : EMPTY\n");
+        if (observed)
+        {
+            notify_stage(cpu, APEX_STAGE_FETCH, NULL);
+        }
     }
 }
 
-/*
- * Decode Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
- */
-static void
-APEX_decode(APEX_CPU *cpu)
+/* Timing of one FU class, from its options */
+typedef struct FU_Class
 {
+    int latency;
+    int units;
+    int interval; /* Cycles from one instruction entering an instance to the next */
+} FU_Class;
 
-    if (cpu->decode.has_insn && cpu->decode.is_stalled == notInUse)
+static inline __attribute__((always_inline)) FU_Class
+fu_class(const APEX_CPU *cpu, int fu)
+{
+    const APEX_Config *config = &cpu->config;
+
+    // an iterative unit takes the next instruction once it is done with one.
+    switch (fu)
     {
-        int addressOfRegisterOne = 0;
-        int addressOfRegisterTwo = 0;
-        int addressOfRegisterThree = 0;
-        int valueInReg1 = 0;
-        int valueInReg2 = 0;
-        int valueInReg3 = 0;
-        /* Read operands from register file based on the instruction type */
-        switch (cpu->decode.opcode)
-        {
-        case OPCODE_ADD:
-        case OPCODE_SUB:
-        case OPCODE_DIV:
-        case OPCODE_MUL:
-        case OPCODE_AND:
-        case OPCODE_OR:
-        case OPCODE_XOR:
-        case OPCODE_LDR:
-        {
-            // only enter when the register values are empty if not it goes to else
-            if (cpu->regCheck[cpu->decode.rs1] == isRegisterValueEmpty && cpu->regCheck[cpu->decode.rs2] == isRegisterValueEmpty)
-            {
-                addressOfRegisterOne = cpu->decode.rs1;
-                valueInReg1 = cpu->regs[addressOfRegisterOne];
-                // passing theh value of rs1 in register to rs1_value and same operaion to rs2_value.
-                cpu->decode.rs1_value = valueInReg1;
-
-                addressOfRegisterTwo = cpu->decode.rs2;
-                valueInReg2 = cpu->regs[addressOfRegisterTwo];
-
-                cpu->decode.rs2_value = valueInReg2;
-                // settign the value to the new register
-
-                cpu->regCheck[cpu->decode.rd] = inUse;
-                addressOfRegisterOne = 0;
-                valueInReg1 = 0;
-                addressOfRegisterTwo = 0;
-                valueInReg2 = 0;
-            }
-            else
-            {
-                // since the register values are not empty some value has been aready set and has to be moved to stall.
-                cpu->decode.is_stalled = inUse;
-                cpu->fetch.is_stalled = inUse;
-            }
-            break;
-        }
+    case FU_MUL:
+        return (FU_Class){config->mul_latency, config->mul_units,
+                          config->mul_pipelined ? config->mul_interval : config->mul_latency};
+    case FU_DIV:
+        return (FU_Class){config->div_latency, config->div_units,
+                          config->div_pipelined ? config->div_interval : config->div_latency};
+    case FU_MEM:
+        return (FU_Class){config->load_latency, config->load_units,
+                          config->load_pipelined ? config->load_interval : config->load_latency};
+    default:
+        return (FU_Class){config->int_latency, config->int_units,
+                          config->int_pipelined ? config->int_interval : config->int_latency};
+    }
+}
 
-        case OPCODE_LOAD:
-        case OPCODE_ADDL:
-        case OPCODE_SUBL:
+/* First instance of FU class 'fu' that takes an instruction this cycle, -1 when none does */
+static inline __attribute__((always_inline)) int
+free_unit(const APEX_CPU *cpu, int fu)
+{
+    const int units = fu_class(cpu, fu).units;
+    int unit;
+
+    for (unit = 0; unit < units; ++unit)
+    {
+        if (cpu->fu_ready[fu][unit] <= cpu->clock)
         {
-            if (cpu->regCheck[cpu->decode.rs1] == isRegisterValueEmpty)
-            {
-                addressOfRegisterOne = cpu->decode.rs1;
-                valueInReg1 = cpu->regs[addressOfRegisterOne];
-                // passing theh value of rs1 in register to rs1_value and same operaion to rs2_value.
-                cpu->decode.rs1_value = valueInReg1;
-
-                cpu->regCheck[cpu->decode.rd] = inUse;
-                addressOfRegisterOne = 0;
-                valueInReg1 = 0;
-            }
-            else
-            {
-                // in the else part since the register values are not empty some value has been aready set and has to be moved to stall.
-                cpu->decode.is_stalled = inUse;
-                cpu->fetch.is_stalled = inUse;
-            }
-            break;
+            return unit;
         }
+    }
+    return -1;
+}
 
-        case OPCODE_STORE:
-        {
-            if (cpu->regCheck[cpu->decode.rs1] == isRegisterValueEmpty && cpu->regCheck[cpu->decode.rs2] == isRegisterValueEmpty)
-            {
-                addressOfRegisterOne = cpu->decode.rs1;
-                valueInReg1 = cpu->regs[addressOfRegisterOne];
-                // passing theh value of rs1 in register to rs1_value and same operaion to rs2_value.
-                cpu->decode.rs1_value = valueInReg1;
+/*
+ * Fetch number of the oldest instruction still in an FU, INT64_MAX when
+ * they are all empty. A completed instruction with the same number is no
+ * older, only HALT is issued again with the number it already has.
+ */
+static inline __attribute__((always_inline)) int64_t
+oldest_executing(const APEX_CPU *cpu)
+{
+    return cpu->executing_count ? cpu->executing[0].seq : INT64_MAX;
+}
 
-                addressOfRegisterTwo = cpu->decode.rs2;
-                valueInReg2 = cpu->regs[addressOfRegisterTwo];
+/* Instructions issued and not written back yet, decode issues no more than completion_size */
+static inline __attribute__((always_inline)) int
+in_flight(const APEX_CPU *cpu)
+{
+    return cpu->completion_count + cpu->executing_count;
+}
 
-                cpu->decode.rs2_value = valueInReg2;
+/* TRUE while a BZ/BNZ is in an int unit, decode issues nothing past it until it has resolved */
+static inline __attribute__((always_inline)) int
+branch_executing(const APEX_CPU *cpu)
+{
+    int i;
 
-                cpu->decode.rd = inUse;
-                addressOfRegisterOne = 0;
-                valueInReg1 = 0;
-                addressOfRegisterTwo = 0;
-                valueInReg2 = 0;
-            }
-            else
-            {
-                cpu->decode.is_stalled = inUse;
-                cpu->fetch.is_stalled = inUse;
-            }
-            break;
-        }
+    for (i = 0; i < cpu->executing_count; ++i)
+    {
+        const int branch = apex_isa[cpu->code_memory[cpu->executing[i].insn].opcode].branch;
 
-        case OPCODE_STR:
+        if (branch == BR_Z || branch == BR_NZ)
         {
-            if (cpu->regCheck[cpu->decode.rs1] == isRegisterValueEmpty && cpu->regCheck[cpu->decode.rs2] == isRegisterValueEmpty && cpu->regCheck[cpu->decode.rs3] == isRegisterValueEmpty)
-            {
-                addressOfRegisterOne = cpu->decode.rs1;
-                valueInReg1 = cpu->regs[addressOfRegisterOne];
-                cpu->decode.rs1_value = valueInReg1;
-
-                addressOfRegisterTwo = cpu->decode.rs2;
-                valueInReg2 = cpu->regs[addressOfRegisterTwo];
-                cpu->decode.rs2_value = valueInReg2;
-
-                addressOfRegisterThree = cpu->decode.rs3;
-                valueInReg3 = cpu->regs[addressOfRegisterThree];
-                cpu->decode.rs1_value = valueInReg3;
-
-                cpu->decode.rd = inUse;
-
-                addressOfRegisterOne = 0;
-                valueInReg1 = 0;
-                addressOfRegisterTwo = 0;
-                valueInReg2 = 0;
-                addressOfRegisterThree = 0;
-                valueInReg3 = 0;
-            }
-            else
-            {
-                cpu->decode.is_stalled = inUse;
-                cpu->fetch.is_stalled = inUse;
-            }
-
-            break;
+            return TRUE;
         }
+    }
+    return FALSE;
+}
 
-        case OPCODE_MOVC:
-        {
-            cpu->regCheck[cpu->decode.rd] = inUse;
-            /* MOVC doesn't have register operands */
-            break;
-        }
+/*
+ * Moves a finished instruction from its FU into the completion buffer,
+ * kept in age order as the FUs may finish out of order. Decode never has
+ * more in flight than the buffer holds, so there is always room.
+ */
+static inline __attribute__((always_inline)) void
+complete_instruction(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    int i = cpu->completion_count++;
 
-        case OPCODE_NOP:
-        case OPCODE_HALT:
-        case OPCODE_BZ:
-        case OPCODE_BNZ:
-        {
-            // just setting those operations are in use.
-            cpu->decode.rd = inUse;
-            break;
-        }
+    for (; i > 0 && cpu->completion[i - 1].seq > stage->seq; --i)
+    {
+        cpu->completion[i] = cpu->completion[i - 1];
+    }
+    cpu->completion[i] = *stage;
+}
 
-        case OPCODE_CMP:
+/* TRUE when a store older than 'seq' has not written memory yet */
+static inline __attribute__((always_inline)) int
+older_store_pending(const APEX_CPU *cpu, int64_t seq)
+{
+    int i;
+
+    for (i = 0; i < cpu->completion_count && cpu->completion[i].seq < seq; ++i)
+    {
+        if (apex_isa[cpu->code_memory[cpu->completion[i].insn].opcode].mem == MEM_STORE)
         {
-            if (cpu->regCheck[cpu->decode.rs1] == isRegisterValueEmpty && cpu->regCheck[cpu->decode.rs2] == isRegisterValueEmpty)
-            {
-                addressOfRegisterOne = cpu->decode.rs1;
-                valueInReg1 = cpu->regs[addressOfRegisterOne];
-                // passing theh value of rs1 in register to rs1_value and same operaion to rs2_value.
-                cpu->decode.rs1_value = valueInReg1;
-
-                addressOfRegisterTwo = cpu->decode.rs2;
-                valueInReg2 = cpu->regs[addressOfRegisterTwo];
-                cpu->decode.rs2_value = valueInReg2;
-
-                addressOfRegisterOne = 0;
-                valueInReg1 = 0;
-                addressOfRegisterTwo = 0;
-                valueInReg2 = 0;
-                cpu->decode.rd = inUse;
-            }
-            else
-            {
-                cpu->decode.is_stalled = inUse;
-                cpu->fetch.is_stalled = inUse;
-            }
-            break;
-        }
+            return TRUE;
         }
-        if (cpu->decode.is_stalled == notInUse)
+    }
+    // with more than one LOAD unit it may still be executing, instructions done this cycle are in the buffer.
+    for (i = 0; i < cpu->executing_count && cpu->executing[i].seq < seq; ++i)
+    {
+        if (cpu->executing[i].has_insn &&
+            apex_isa[cpu->code_memory[cpu->executing[i].insn].opcode].mem == MEM_STORE)
         {
-            // printf("decode.opcode_str : %s\n", cpu->decode.opcode_str);
-            // char condition = cpu->decode.opcode_str;
-            switch (cpu->decode.opcode)
-            {
-            case OPCODE_MUL:
-            {
-                cpu->mul_operation = cpu->decode;
-                break;
-            }
-            case OPCODE_LOAD:
-            case OPCODE_STORE:
-            case OPCODE_LDR:
-            case OPCODE_STR:
-            {
-                cpu->load_operations = cpu->decode;
-                break;
-            }
-            default:
-            {
-                cpu->int_operations = cpu->decode;
-                break;
-            }
-            }
-            print_stage_content("Instruction at DECODE_RF_STAGE --->          ", &cpu->decode);
+            return TRUE;
         }
-        else
+    }
+    return FALSE;
+}
+
+/* Where decode can take a source register from */
+enum
+{
+    SOURCE_BUSY,     /* still being computed, decode has to wait */
+    SOURCE_REGS,     /* the register file */
+    SOURCE_FORWARDED /* an FU output in the completion buffer, with forwarding */
+};
+
+/*
+ * Tells where source register 'reg' can be read from. With forwarding the
+ * youngest write of 'reg' in the completion buffer is taken when no other
+ * write of it is still executing, '*producer' is then that entry, NULL
+ * otherwise.
+ */
+static inline __attribute__((always_inline)) int
+source_of(const APEX_CPU *cpu, int reg, const CPU_Stage **producer)
+{
+    int writes = 0;
+    int i;
+
+    *producer = NULL;
+    if (cpu->regCheck[reg] == cpu->check.isRegisterValueEmpty)
+    {
+        return SOURCE_REGS;
+    }
+    if (!cpu->config.forwarding)
+    {
+        return SOURCE_BUSY;
+    }
+    for (i = 0; i < cpu->completion_count; ++i)
+    {
+        const APEX_Instruction *ins = &cpu->code_memory[cpu->completion[i].insn];
+
+        if ((apex_isa[ins->opcode].dst & OPND_RD) && ins->rd == reg)
         {
-            // I'm not checking "ENABLE_DEBUG_MESSAGES" because it is TRUE bu default and if passes every time.
-            printf("Instruction at DECODE_RF_STAGE --->      : EMPTY\n");
+            *producer = &cpu->completion[i];
+            writes++;
         }
     }
+    return writes && writes == cpu->regCheck[reg] ? SOURCE_FORWARDED : SOURCE_BUSY;
 }
-static void
-int_operations(APEX_CPU *cpu)
+
+static inline __attribute__((always_inline)) int
+source_is_busy(const APEX_CPU *cpu, int reg)
 {
+    const CPU_Stage *producer;
 
-    if (cpu->int_operations.has_insn)
+    return source_of(cpu, reg, &producer) == SOURCE_BUSY;
+}
+
+/* Reads a source register from where source_of found it, 'forwarded' is set for an FU output */
+static inline __attribute__((always_inline)) int
+read_source(APEX_CPU *cpu, int reg, int *forwarded)
+{
+    const CPU_Stage *producer;
+
+    if (source_of(cpu, reg, &producer) == SOURCE_FORWARDED)
     {
-        /* int_operations logic based on instruction type */
-        switch (cpu->int_operations.opcode)
-        {
-        case OPCODE_ADD:
-        {
-            cpu->int_operations.result_buffer = cpu->int_operations.rs1_value + cpu->int_operations.rs2_value;
-            // printf("\n Executing Addition %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.rs2_value);
+        cpu->stats.forwarded[apex_isa[cpu->code_memory[producer->insn].opcode].fu]++;
+        *forwarded = TRUE;
+        return producer->result_buffer;
+    }
+    return cpu->regs[reg];
+}
 
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
-            {
-                cpu->zero_flag = TRUE;
-            }
-            else
-            {
-                cpu->zero_flag = FALSE;
-            }
-            // setZeroFlagBasedOnResultBuffer(cpu);
-            break;
-        }
+/*
+ * Reads the zero flag for a BZ/BNZ in decode into 'flag': the flag of the
+ * youngest instruction in flight that sets it, or the one of the register
+ * file once they have all been written back. Returns FALSE while that
+ * instruction is still executing. An FU sets the flag in its latch, so
+ * instructions finishing out of order do not see each other's flag.
+ */
+static inline __attribute__((always_inline)) int
+read_zero_flag(const APEX_CPU *cpu, int *flag)
+{
+    int64_t executing = -1;
+    int i;
 
-        case OPCODE_ADDL:
+    for (i = cpu->executing_count - 1; i >= 0; --i)
+    {
+        if (apex_isa[cpu->code_memory[cpu->executing[i].insn].opcode].zero_flag != ZF_NONE)
         {
-            cpu->int_operations.result_buffer = cpu->int_operations.rs1_value + cpu->int_operations.imm;
-            // printf("\n Executing ADDL %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.imm);
-
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
-            {
-                cpu->zero_flag = TRUE;
-            }
-            else
-            {
-                cpu->zero_flag = FALSE;
-            }
-            // setZeroFlagBasedOnResultBuffer(cpu);
+            executing = cpu->executing[i].seq;
             break;
         }
-
-        case OPCODE_SUBL:
+    }
+    for (i = cpu->completion_count - 1; i >= 0; --i)
+    {
+        if (apex_isa[cpu->code_memory[cpu->completion[i].insn].opcode].zero_flag != ZF_NONE)
         {
-            cpu->int_operations.result_buffer = cpu->int_operations.rs1_value - cpu->int_operations.imm;
-            // printf("\n Executing SUBL %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.imm);
-
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
-            {
-                cpu->zero_flag = TRUE;
-            }
-            else
-            {
-                cpu->zero_flag = FALSE;
-            }
-            // setZeroFlagBasedOnResultBuffer(cpu);
             break;
         }
+    }
+    if (i >= 0 && cpu->completion[i].seq > executing)
+    {
+        *flag = cpu->completion[i].zero_flag;
+        return TRUE;
+    }
+    if (executing >= 0)
+    {
+        return FALSE;
+    }
+    *flag = cpu->zero_flag;
+    return TRUE;
+}
 
-        case OPCODE_SUB:
-        {
-            cpu->int_operations.result_buffer = cpu->int_operations.rs1_value - cpu->int_operations.rs2_value;
-            // printf("\n Executing Substraction %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.rs2_value);
+/*
+ * Decode Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static inline __attribute__((always_inline)) void
+APEX_decode(APEX_CPU *cpu, const int observed)
+{
+    // a stalled instruction is looked at again every cycle, what it waits for may have been written
+    // back, forwarded or freed in this one (writeback only clears stalls when it writes a register).
+    if (cpu->fu_stalled || cpu->decode.is_stalled != cpu->check.notInUse)
+    {
+        cpu->fu_stalled = FALSE;
+        cpu->decode.is_stalled = cpu->check.notInUse;
+        cpu->fetch.is_stalled = cpu->check.notInUse;
+    }
 
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
-            {
-                cpu->zero_flag = TRUE;
-            }
-            else
-            {
-                cpu->zero_flag = FALSE;
-            }
-            // setZeroFlagBasedOnResultBuffer(cpu);
-            break;
+    if (cpu->decode.has_insn && cpu->decode.is_stalled == cpu->check.notInUse)
+    {
+        const APEX_Instruction *ins = &cpu->code_memory[cpu->decode.insn];
+        const APEX_Opcode_Info *info = &apex_isa[ins->opcode];
+
+        int zero_flag = FALSE;
+        int unit = -1;
+
+        // the source mask of the ISA table tells which registers have to be free (or forwarded)
+        // before the instruction can read them, if any of them is still in use we stall. BZ and BNZ
+        // wait in the same way for the instruction setting their zero flag.
+        if (((info->src & OPND_RS1) && source_is_busy(cpu, ins->rs1)) ||
+            ((info->src & OPND_RS2) && source_is_busy(cpu, ins->rs2)) ||
+            ((info->src & OPND_RS3) && source_is_busy(cpu, ins->rs3)) ||
+            ((info->branch == BR_Z || info->branch == BR_NZ) && !read_zero_flag(cpu, &zero_flag)))
+        {
+            cpu->decode.is_stalled = cpu->check.inUse;
+            cpu->fetch.is_stalled = cpu->check.inUse;
         }
-        case OPCODE_DIV:
+        // nothing is issued past a BZ/BNZ that has not resolved yet (with 1-cycle int units it
+        // always has, the FUs run before decode).
+        else if (branch_executing(cpu))
         {
-            cpu->int_operations.result_buffer = cpu->int_operations.rs1_value / cpu->int_operations.rs2_value;
-            // printf("\n Executing Division %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.rs2_value);
-
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
-            {
-                cpu->zero_flag = TRUE;
-            }
-            else
-            {
-                cpu->zero_flag = FALSE;
-            }
-            // setZeroFlagBasedOnResultBuffer(cpu);
-            break;
+            cpu->fu_stalled = TRUE;
+            cpu->decode.is_stalled = cpu->check.inUse;
+            cpu->fetch.is_stalled = cpu->check.inUse;
         }
-
-        case OPCODE_AND:
+        // the FUs overlap, any instance of the class the instruction needs that takes one this
+        // cycle will do, plus a completion buffer entry.
+        else if ((unit = free_unit(cpu, info->fu)) < 0 || in_flight(cpu) >= cpu->config.completion_size)
         {
-            cpu->int_operations.result_buffer = cpu->int_operations.rs1_value & cpu->int_operations.rs2_value;
-            // printf("\n Executing AND %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.rs2_value);
-
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
-            {
-                cpu->zero_flag = TRUE;
-            }
-            else
+            if (unit < 0)
             {
-                cpu->zero_flag = FALSE;
+                cpu->stats.stall_fu[info->fu]++;
             }
-            // setZeroFlagBasedOnResultBuffer(cpu);
-            break;
+            cpu->fu_stalled = TRUE;
+            cpu->decode.is_stalled = cpu->check.inUse;
+            cpu->fetch.is_stalled = cpu->check.inUse;
         }
-        case OPCODE_OR:
+        else
         {
-            cpu->int_operations.result_buffer = cpu->int_operations.rs1_value | cpu->int_operations.rs2_value;
-            // printf("\n Executing OR %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.rs2_value);
+            int forwarded = FALSE;
 
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
+            cpu->decode.zero_flag = zero_flag;
+            /* Read operands from register file based on the instruction type */
+            if (info->src & OPND_RS1)
             {
-                cpu->zero_flag = TRUE;
+                cpu->decode.rs1_value = read_source(cpu, ins->rs1, &forwarded);
             }
-            else
+            if (info->src & OPND_RS2)
             {
-                cpu->zero_flag = FALSE;
+                cpu->decode.rs2_value = read_source(cpu, ins->rs2, &forwarded);
             }
-            // setZeroFlagBasedOnResultBuffer(cpu);
-            break;
-        }
-        case OPCODE_XOR:
-        {
-            cpu->int_operations.result_buffer = cpu->int_operations.rs1_value ^ cpu->int_operations.rs2_value;
-            // printf("\n Executing XOR %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.rs2_value);
-
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
+            if (info->src & OPND_RS3)
             {
-                cpu->zero_flag = TRUE;
+                cpu->decode.rs3_value = read_source(cpu, ins->rs3, &forwarded);
             }
-            else
+            // without the forwarded operands decode would have waited a cycle for writeback.
+            if (forwarded)
             {
-                cpu->zero_flag = FALSE;
+                cpu->stats.stall_forwarded++;
             }
-            // setZeroFlagBasedOnResultBuffer(cpu);
-            break;
-        }
-
-        case OPCODE_BZ:
-        {
-            if (cpu->zero_flag == TRUE)
+            // the destination register is marked in use until writeback clears it. regCheck counts
+            // the pending writes so that the first of two writes to the same register does not
+            // free it while the second one is still in flight.
+            if (info->dst & OPND_RD)
             {
-                /* Calculate new PC, and send it to fetch unit */
-                cpu->pc = cpu->int_operations.pc + cpu->int_operations.imm;
-
-                /* Since we are using reverse callbacks for pipeline stages,
-                 * this will prevent the new instruction from being fetched in the current cycle*/
-                cpu->fetch_from_next_cycle = TRUE;
-
-                /* Flush previous stages */
-                cpu->decode.has_insn = FALSE;
-
-                /* Make sure fetch stage is enabled to start fetching from new PC */
-                cpu->fetch.has_insn = TRUE;
+                cpu->regCheck[ins->rd]++;
             }
-            break;
         }
 
-        case OPCODE_BNZ:
+        if (cpu->decode.is_stalled == cpu->check.notInUse)
         {
-            if (cpu->zero_flag == FALSE)
-            {
-                /* Calculate new PC, and send it to fetch unit */
-                cpu->pc = cpu->int_operations.pc + cpu->int_operations.imm;
+            const FU_Class fu = fu_class(cpu, info->fu);
 
-                /* Since we are using reverse callbacks for pipeline stages,
-                 * this will prevent the new instruction from being fetched in the current cycle*/
-                cpu->fetch_from_next_cycle = TRUE;
-
-                /* Flush previous stages */
-                cpu->decode.has_insn = FALSE;
-
-                /* Make sure fetch stage is enabled to start fetching from new PC */
-                cpu->fetch.has_insn = TRUE;
+            cpu->decode.unit = unit;
+            cpu->decode.cycles_left = fu.latency;
+            cpu->fu_ready[info->fu][unit] = cpu->clock + fu.interval;
+            cpu->executing[cpu->executing_count++] = cpu->decode;
+            if (observed)
+            {
+                notify_stage(cpu, APEX_STAGE_DECODE, &cpu->decode);
             }
-            break;
         }
+        else if (observed)
+        {
+            notify_stage(cpu, APEX_STAGE_DECODE, NULL);
+        }
+    }
 
-        case OPCODE_MOVC:
+    // a cycle the instruction in decode could not be issued, the bubble left in the FUs carries
+    // the reason down to writeback. With no instruction it is whatever fetch left instead.
+    if (!cpu->decode.has_insn)
+    {
+        cpu->cpi.issue = cpu->cpi.fetch;
+    }
+    else if (cpu->decode.is_stalled == cpu->check.notInUse)
+    {
+        cpu->cpi.issue = APEX_CPI_BASE;
+    }
+    else
+    {
+        if (cpu->fu_stalled && branch_executing(cpu))
+        {
+            cpu->cpi.issue = APEX_CPI_BRANCH;
+        }
+        else if (cpu->fu_stalled)
+        {
+            cpu->cpi.issue = APEX_CPI_STRUCTURAL;
+            cpu->stats.stall_structural++;
+        }
+        else
         {
-            // right away passses the vlaues ot teh reulst Buffer and sets to the register value
-            cpu->int_operations.result_buffer = cpu->int_operations.imm;
+            const APEX_Instruction *ins = &cpu->code_memory[cpu->decode.insn];
+            const APEX_Opcode_Info *info = &apex_isa[ins->opcode];
 
-            /* Set the zero flag based on the result buffer */
-            if (cpu->int_operations.result_buffer == 0)
-            {
-                cpu->zero_flag = TRUE;
-            }
-            else
+            cpu->cpi.issue = APEX_CPI_DATA;
+            cpu->stats.stall_data++;
+            if ((info->src & OPND_RS1) && source_is_busy(cpu, ins->rs1))
             {
-                cpu->zero_flag = FALSE;
+                cpu->stats.stall_data_reg[ins->rs1]++;
             }
-            break;
-        }
-
-        case OPCODE_CMP:
-        {
-            if (cpu->int_operations.rs1_value == cpu->int_operations.rs2_value)
+            else if ((info->src & OPND_RS2) && source_is_busy(cpu, ins->rs2))
             {
-                // printf("\nRegister values are equal\n");
-                cpu->zero_flag = TRUE;
+                cpu->stats.stall_data_reg[ins->rs2]++;
             }
-            else
+            else if ((info->src & OPND_RS3) && source_is_busy(cpu, ins->rs3))
             {
-                // printf("\nRegister values are not equal\n");
-                cpu->zero_flag = FALSE;
+                cpu->stats.stall_data_reg[ins->rs3]++;
             }
-            break;
-        }
-        case OPCODE_NOP:
-        case OPCODE_HALT:
-        {
-            // no int_operations operations for NOP and HALT.
-            break;
-        }
         }
+    }
+}
 
-        /* Copy data from int_operations latch to writeback latch*/
-        cpu->writeback = cpu->int_operations;
-        cpu->int_operations.has_insn = FALSE;
+/* TRUE for a data memory address a load or store can access */
+static inline __attribute__((always_inline)) int
+address_is_valid(int address)
+{
+    return (unsigned int)address < DATA_MEMORY_SIZE;
+}
 
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Instruction at int EX STAGE --->                 ", &cpu->int_operations);
-        }
+/*
+ * TRUE when the instruction that finished in 'stage' divided by zero or
+ * accessed data memory out of range, it must not retire
+ */
+static inline __attribute__((always_inline)) int
+stage_faulted(const APEX_Opcode_Info *info, const CPU_Stage *stage)
+{
+    return (info->alu == ALU_DIV && stage->rs2_value == 0) ||
+           (info->mem != MEM_NONE && !address_is_valid(stage->memory_address));
+}
+
+/*
+ * TRUE when fetch is held at a pc outside code memory and no instruction is
+ * left in flight that could still branch away from it
+ */
+static inline __attribute__((always_inline)) int
+fetch_faulted(const APEX_CPU *cpu)
+{
+    return cpu->fetch.has_insn && !pc_is_valid(cpu, cpu->pc) && !cpu->decode.has_insn &&
+           cpu->executing_count == 0 && cpu->completion_count == 0;
+}
+
+/*
+ * Computes the result (or the memory address for loads and stores) of the
+ * instruction held in an FU latch and updates the zero flag as the ISA table says
+ */
+static void
+execute_stage(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    const APEX_Instruction *ins = &cpu->code_memory[stage->insn];
+    const APEX_Opcode_Info *info = &apex_isa[ins->opcode];
+    int a, b, value;
+
+    if (info->mem == MEM_STORE)
+    {
+        // rs1 holds the value being stored, the address comes from rs2 and rs3 or the immediate.
+        a = stage->rs2_value;
+        b = (info->src & OPND_RS3) ? stage->rs3_value : ins->imm;
     }
-
     else
     {
-        // I'm not checking "ENABLE_DEBUG_MESSAGES" because it is TRUE bu default and if passes every time.
-        printf("Instruction at int EX STAGE --->            : EMPTY\n");
+        a = stage->rs1_value;
+        b = (info->src & OPND_RS2) ? stage->rs2_value : ins->imm;
     }
-}
-static void
-mul_operation(APEX_CPU *cpu)
-{
-    if (cpu->mul_operation.has_insn)
-    {
-        // if (mul_counter == 0)
-        // {
-        cpu->mul_operation.result_buffer = cpu->mul_operation.rs1_value * cpu->mul_operation.rs2_value;
-        // printf("\n Executing Multiplication %d %d \n", cpu->int_operations.rs1_value, cpu->int_operations.rs2_value);
 
-        /* Set the zero flag based on the result buffer */
-        if (cpu->mul_operation.result_buffer == 0)
+    if (info->alu != ALU_NONE)
+    {
+        // a DIV by zero gets no result, writeback stops the program when it gets there.
+        value = (info->alu == ALU_DIV && b == 0) ? 0 : apex_alu(info->alu, a, b);
+        if (info->mem == MEM_NONE)
         {
-            cpu->zero_flag = TRUE;
+            stage->result_buffer = value;
         }
         else
         {
-            cpu->zero_flag = FALSE;
+            stage->memory_address = value;
         }
-        cpu->writeback = cpu->mul_operation;
-        cpu->mul_operation.has_insn = FALSE;
+    }
+
+    if (info->mem == MEM_LOAD)
+    {
+        stage->result_buffer = address_is_valid(stage->memory_address) ? cpu->data_memory[stage->memory_address] : 0;
+    }
+    else if (info->mem == MEM_STORE)
+    {
+        stage->result_buffer = stage->rs1_value;
+    }
+
+    /* Set the zero flag based on the result buffer, writeback copies it to the cpu */
+    if (info->zero_flag == ZF_RESULT)
+    {
+        stage->zero_flag = (stage->result_buffer == 0) ? TRUE : FALSE;
+    }
+    else if (info->zero_flag == ZF_COMPARE)
+    {
+        stage->zero_flag = (stage->rs1_value == stage->rs2_value) ? TRUE : FALSE;
+    }
+}
+
+/*
+ * One cycle of an instruction in its FU. In its last cycle the result is
+ * computed and it moves to the completion buffer, a load waits there until
+ * the older stores have written memory in writeback. A BZ/BNZ fetch
+ * mispredicted redirects fetch as it resolves.
+ */
+static inline __attribute__((always_inline)) void
+execute_cycle(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    const APEX_Instruction *ins = &cpu->code_memory[stage->insn];
+    const APEX_Opcode_Info *info = &apex_isa[ins->opcode];
 
-        if (ENABLE_DEBUG_MESSAGES)
+    cpu->stats.fu_busy[info->fu]++;
+    if (stage->cycles_left > 1)
+    {
+        stage->cycles_left--;
+        return;
+    }
+    if (info->mem == MEM_LOAD && older_store_pending(cpu, stage->seq))
+    {
+        // the unit takes nothing else while the load is held in it.
+        if (cpu->fu_ready[info->fu][stage->unit] <= cpu->clock)
         {
-            print_stage_content("Instruction at MUL EX STAGE --->                 ", &cpu->mul_operation);
+            cpu->fu_ready[info->fu][stage->unit] = cpu->clock + 1;
         }
-        // }
-        // mul_counter--;
+        return;
     }
+    execute_stage(cpu, stage);
 
-    if (ENABLE_DEBUG_MESSAGES)
+    if ((info->branch == BR_Z || info->branch == BR_NZ) &&
+        APEX_bpred_resolve(cpu, stage, info->branch == BR_Z ? stage->zero_flag == TRUE : stage->zero_flag == FALSE))
     {
-        // I'm not checking "ENABLE_DEBUG_MESSAGES" because it is TRUE bu default and if passes every time.
-        printf("Instruction at MUL EX STAGE --->            : EMPTY\n");
+        /* Calculate new PC, and send it to fetch unit */
+        cpu->pc = stage->predicted ? stage->pc + 4 : stage->pc + ins->imm;
+
+        /* Since we are using reverse callbacks for pipeline stages,
+         * this will prevent the new instruction from being fetched in the current cycle*/
+        cpu->fetch_from_next_cycle = TRUE;
+
+        /* Flush previous stages */
+        cpu->decode.has_insn = FALSE;
+        cpu->cpi.fetch = APEX_CPI_BRANCH;
+        cpu->stats.flushes++;
+        // an instruction fetch was still holding is gone as well, its number is not given again.
+        cpu->fetch_seq++;
+
+        /* Make sure fetch stage is enabled to start fetching from new PC */
+        cpu->fetch.has_insn = TRUE;
     }
+
+    /* Copy data from the FU to the completion buffer */
+    complete_instruction(cpu, stage);
+    stage->has_insn = FALSE;
 }
-static void
-load_operations(APEX_CPU *cpu)
+
+/*
+ * Execute stage of APEX Pipeline, every FU instance. Observers see the
+ * instructions of the int, MUL, DIV and LOAD units in that order, an
+ * instruction that finished this cycle included.
+ */
+static inline __attribute__((always_inline)) void
+APEX_execute(APEX_CPU *cpu, const int observed)
 {
-    if (cpu->load_operations.has_insn)
+    static const struct
     {
-        // if (load_counter == 0)
-        // {
-        /* int_operations logic based on instruction type */
-        switch (cpu->load_operations.opcode)
-        {
+        int fu;
+        APEX_Stage_Id id;
+    } classes[FU_COUNT] = {
+        {FU_INT, APEX_STAGE_INT}, {FU_MUL, APEX_STAGE_MUL}, {FU_DIV, APEX_STAGE_DIV}, {FU_MEM, APEX_STAGE_LOAD}};
+    int c, i, kept;
 
-        case OPCODE_LOAD:
-        {
-            // cpu->int_operations.memory_address = cpu->int_operations.memory_address + 9;
-            // printf(" \n address before load operation %d \n ", cpu->int_operations.memory_address);
-            cpu->load_operations.memory_address = cpu->load_operations.rs1_value + cpu->load_operations.imm;
-            // printf(" \n address after load operaion %d \n ", cpu->int_operations.memory_address);
-            // initially I set a values "MOVC R9,#10" and "MOVC R3,#20"
-            //'MOVC R9,#10' later few steps I have run the command 'LOAD R9,R3,#4'
-            // now the value R3+4=24 --> 24th address values has to be set to "R9" sine we don't know the value at address 24
-            // the R9 value has been reset to "0".
-            break;
-        }
+    for (c = 0; c < FU_COUNT; ++c)
+    {
+        int busy = FALSE;
 
-        case OPCODE_LDR:
+        for (i = 0; i < cpu->executing_count; ++i)
         {
-            cpu->load_operations.memory_address = cpu->load_operations.rs1_value + cpu->load_operations.rs2_value;
-            // printf("\n int_operations stage LDR MemoryAddress: %d rs1_value: %d rs2_value :%d\n", cpu->int_operations.memory_address, cpu->int_operations.rs1_value, cpu->int_operations.rs2_value);
-            break;
-        }
+            CPU_Stage *stage = &cpu->executing[i];
 
-        case OPCODE_STORE:
+            if (apex_isa[cpu->code_memory[stage->insn].opcode].fu != classes[c].fu)
+            {
+                continue;
+            }
+            busy = TRUE;
+            execute_cycle(cpu, stage);
+            if (observed)
+            {
+                notify_stage(cpu, classes[c].id, stage);
+            }
+        }
+        if (!busy && observed)
         {
-            // though there is nothign to int_operations rs1 value since we have to set that value into the writeback address of rs2+imm
-            // we set send it to the result buffer.
-            cpu->load_operations.result_buffer = cpu->load_operations.rs1_value;
-            cpu->load_operations.memory_address = cpu->load_operations.rs2_value + cpu->load_operations.imm;
-            break;
+            notify_stage(cpu, classes[c].id, NULL);
         }
+    }
 
-        case OPCODE_STR:
+    // what finished has moved to the completion buffer, the rest stays in issue order.
+    for (i = 0, kept = 0; i < cpu->executing_count; ++i)
+    {
+        if (cpu->executing[i].has_insn)
         {
-            // though there is nothign to int_operations rs1 value since we have to set that value into the writeback address of rs2+rs3
-            // we set send it to the result buffer.
-            cpu->load_operations.result_buffer = cpu->load_operations.rs1_value;
-            cpu->load_operations.memory_address = cpu->load_operations.rs2_value + cpu->load_operations.rs3_value;
-
-            break;
-        }
+            cpu->executing[kept++] = cpu->executing[i];
         }
-        cpu->writeback = cpu->load_operations;
-        cpu->load_operations.has_insn = FALSE;
+    }
+    cpu->executing_count = kept;
+}
 
-        /* Copy data from int_operations latch to writeback latch*/
+/*
+ * Charges a retiring instruction with its cycle and the bubble cycles
+ * since the instruction before it. With more than one writeback port the
+ * cycle goes to the first one retiring in it, 'first' is FALSE for the others.
+ */
+static void
+charge_cpi(APEX_CPU *cpu, int insn, int first)
+{
+    APEX_Cpi_Row *row = &cpu->cpi.rows[insn];
+    int i;
 
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Instruction at LOAD EX STAGE --->                 ", &cpu->load_operations);
-        }
-        // }
-        // load_counter--;
+    row->retired++;
+    if (!first)
+    {
+        return;
     }
-    else
+    row->cycles[APEX_CPI_BASE]++;
+    for (i = 0; i < APEX_CPI_COUNT; ++i)
     {
-        // I'm not checking "ENABLE_DEBUG_MESSAGES" because it is TRUE bu default and if passes every time.
-        printf("Instruction at LOAD EX STAGE --->            : EMPTY\n");
+        row->cycles[i] += cpu->cpi.pending[i];
+        cpu->cpi.pending[i] = 0;
     }
 }
 
 /*
  * Writeback Stage of APEX Pipeline
  *
+ * Retires up to wb_ports instructions of the completion buffer, oldest
+ * first, and none younger than what is still executing so the
+ * register file and memory are written in program order.
+ *
  * Note: You are free to edit this function according to your implementation
  */
-static int
-APEX_writeback(APEX_CPU *cpu)
+static inline __attribute__((always_inline)) int
+APEX_writeback(APEX_CPU *cpu, const int observed)
 {
+    const int64_t oldest = oldest_executing(cpu);
+    int retired = 0;
 
-    if (cpu->writeback.has_insn)
+    if (fetch_faulted(cpu))
     {
-        /* Write result to register file based on instruction type */
-        switch (cpu->writeback.opcode)
+        /* The program has run out of code memory, as the functional interpreter reports it */
+        fprintf(stderr, "APEX_Error: pc(%d) is outside code memory\n", cpu->pc);
+        return APEX_CYCLE_FAULT;
+    }
+
+    while (retired < cpu->config.wb_ports && cpu->completion_count > 0 && cpu->completion[0].seq <= oldest)
+    {
+        /* Taken out of the buffer first, observers see the entry after it has moved on */
+        const CPU_Stage stage = cpu->completion[0];
+        const APEX_Instruction *ins = &cpu->code_memory[stage.insn];
+        const APEX_Opcode_Info *info = &apex_isa[ins->opcode];
+
+        if (stage_faulted(info, &stage))
         {
-        case OPCODE_ADD:
-        case OPCODE_SUB:
-        case OPCODE_DIV:
-        case OPCODE_MUL:
-        case OPCODE_AND:
-        case OPCODE_OR:
-        case OPCODE_XOR:
-        case OPCODE_ADDL:
-        case OPCODE_SUBL:
-        case OPCODE_LOAD:
-        case OPCODE_LDR:
-        case OPCODE_MOVC:
+            /* The program stops in front of it, as the functional interpreter does */
+            APEX_print_fault(ins, stage.pc, stage.memory_address);
+            return APEX_CYCLE_FAULT;
+        }
+        cpu->completion_count--;
+        memmove(&cpu->completion[0], &cpu->completion[1], cpu->completion_count * sizeof(CPU_Stage));
+
+        /* Write result to register file based on instruction type */
+        if (info->dst & OPND_RD)
         {
             // settingt hte result buffer to write back stage.
-            cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+            cpu->regs[ins->rd] = stage.result_buffer;
             // settig all the registers are not in use and make them not stalled.
-            cpu->regCheck[cpu->writeback.rd] = notInUse;
-            cpu->fetch.is_stalled = notInUse;
-            cpu->decode.is_stalled = notInUse;
-            break;
+            cpu->regCheck[ins->rd]--;
+            cpu->fetch.is_stalled = cpu->check.notInUse;
+            cpu->decode.is_stalled = cpu->check.notInUse;
         }
-
-        case OPCODE_STORE:
-        case OPCODE_STR:
+        else if (info->mem == MEM_STORE)
         {
-
-            cpu->data_memory[cpu->writeback.memory_address] = cpu->writeback.result_buffer;
-            break;
+            cpu->data_memory[stage.memory_address] = stage.result_buffer;
         }
-
-        case OPCODE_NOP:
-        case OPCODE_HALT:
-        case OPCODE_CMP:
-        case OPCODE_BZ:
-        case OPCODE_BNZ:
+        // nothing to write back for CMP, branches, NOP and HALT.
+        if (info->zero_flag != ZF_NONE)
         {
-            // no implementation for CMP in writeback stage as we are just comparing the both the register values.
-            // no operations for NOP and HALT.
-            // as mentioned in the documentation Bz abd BNZ has been implemented I just left empty
-            break;
-        }
+            cpu->zero_flag = stage.zero_flag;
         }
 
         cpu->insn_completed++;
-        cpu->writeback.has_insn = FALSE;
+        cpu->stats.retired_opcode[ins->opcode]++;
+        if (!retired)
+        {
+            cpu->stats.cpi[APEX_CPI_BASE]++;
+        }
+        if (cpu->cpi.rows)
+        {
+            charge_cpi(cpu, stage.insn, !retired);
+        }
+        retired++;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (observed)
         {
-            print_stage_content("Instruction at WRITEBACK_STAGE --->       ", &cpu->writeback);
+            notify_stage(cpu, APEX_STAGE_WRITEBACK, &stage);
         }
 
-        if (cpu->writeback.opcode == OPCODE_HALT)
+        if (ins->opcode == OPCODE_HALT)
         {
             /* Stop the APEX simulator */
-            return TRUE;
+            return APEX_CYCLE_HALTED;
         }
     }
-    else
+
+    if (!retired)
     {
-        // print_stage_content("Instruction at WRITEBACK_STAGE --->       ", &cpu->writeback);
-        // I'm not checking "ENABLE_DEBUG_MESSAGES" because it is TRUE bu default and if passes every time.
-        printf("Instruction at WRITEBACK_STAGE --->      : EMPTY\n");
+        // nothing retires, fetch having stopped at HALT comes before what the bubble was left by.
+        const int category = cpu->fetch.has_insn ? cpu->cpi.complete : APEX_CPI_DRAIN;
+
+        cpu->stats.cpi[category]++;
+        if (cpu->cpi.rows)
+        {
+            cpu->cpi.pending[category]++;
+        }
+        if (observed)
+        {
+            notify_stage(cpu, APEX_STAGE_WRITEBACK, NULL);
+        }
     }
 
     /* Default */
-    return 0;
+    return APEX_CYCLE_RUNNING;
 }
 // implicit declaration of function 'print_state_of_architectural_register_file' is invalid in C99 while declaring at last
 void print_state_of_architectural_register_file(APEX_CPU *cpu)
 {
     printf("\n================== STATE OF ARCHITECTURAL REGISTER FILE ================\n");
 
-    for (int i = 0; i < (sizeof(cpu->regs) / sizeof(cpu->regs[0])); i++)
+    for (int i = 0; i < REG_FILE_SIZE; i++)
     {
         char status[10];
         if (cpu->regCheck[i])
@@ -920,49 +1152,196 @@ void print_state_of_data_memory(APEX_CPU *cpu)
     }
 }
 
-void APEX_cpu_display_simulate_show_mem(APEX_CPU *cpu, int cyclesEntred, const char *functionType)
+/* One clock cycle, 'observed' is a constant so the headless copy has no observer calls at all */
+static inline __attribute__((always_inline)) int
+run_cycle(APEX_CPU *cpu, const int observed)
 {
-    // if display is entred in commandLine
-    //  display function has to just display the executions till the number of cycles is reached mentioned in the command line.
-    if (strcmp(functionType, "display") == 0)
+    int stopped = APEX_writeback(cpu, observed);
+
+    if (stopped != APEX_CYCLE_RUNNING)
     {
-        printf("\n display   @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@   display\n");
-        // int initialCount = cyclesEntred;
-        for (int i = 0; i < cyclesEntred; cyclesEntred--)
-        // decremetning the cycles and comparing they are not equal to 0.
+        return stopped;
+    }
+    APEX_execute(cpu, observed);
+    // what writeback gets next cycle, an FU still counting down holds back everything behind it.
+    if (cpu->completion_count > 0 && cpu->completion[0].seq <= oldest_executing(cpu))
+    {
+        cpu->cpi.complete = APEX_CPI_BASE;
+    }
+    else if (oldest_executing(cpu) != INT64_MAX)
+    {
+        cpu->cpi.complete = APEX_CPI_STRUCTURAL;
+    }
+    else
+    {
+        cpu->cpi.complete = cpu->cpi.issue;
+    }
+    APEX_decode(cpu, observed);
+    APEX_fetch(cpu, observed);
+    cpu->clock++;
+    if (cpu->clock == cpu->stats_next)
+    {
+        APEX_stats_snapshot(cpu);
+    }
+    return APEX_CYCLE_RUNNING;
+}
+
+static int
+run_cycle_headless(APEX_CPU *cpu)
+{
+    return run_cycle(cpu, FALSE);
+}
+
+static int
+run_cycle_observed(APEX_CPU *cpu)
+{
+    return run_cycle(cpu, TRUE);
+}
+
+/*
+ * Simulates one clock cycle, the registered observers see every stage.
+ * Returns APEX_CYCLE_HALTED when HALT retired and APEX_CYCLE_FAULT when the
+ * next instruction to retire faulted (the clock then stays at that cycle),
+ * APEX_CYCLE_RUNNING otherwise
+ */
+int
+APEX_cpu_cycle(APEX_CPU *cpu)
+{
+    return cpu->observers ? run_cycle_observed(cpu) : run_cycle_headless(cpu);
+}
+
+/*
+ * Adds an observer, it is called after the ones already registered. The
+ * observer belongs to the caller and must stay valid until it is removed.
+ */
+void
+APEX_cpu_add_observer(APEX_CPU *cpu, APEX_Observer *observer)
+{
+    APEX_Observer **link = &cpu->observers;
+
+    while (*link)
+    {
+        link = &(*link)->next;
+    }
+    observer->next = NULL;
+    *link = observer;
+}
+
+void
+APEX_cpu_remove_observer(APEX_CPU *cpu, APEX_Observer *observer)
+{
+    APEX_Observer **link = &cpu->observers;
+
+    while (*link && *link != observer)
+    {
+        link = &(*link)->next;
+    }
+    if (*link)
+    {
+        *link = observer->next;
+    }
+}
+
+/* Lets every observer catch up before the engine prints or returns */
+static void
+sync_observers(const APEX_CPU *cpu)
+{
+    const APEX_Observer *observer;
+
+    for (observer = cpu->observers; observer; observer = observer->next)
+    {
+        if (observer->sync)
+        {
+            observer->sync(cpu, observer->arg);
+        }
+    }
+}
+
+/*
+ * The cycle engine, simulates up to max_cycles cycles (no limit when
+ * negative), stopping at HALT or a fault. With single_step it waits for
+ * the user after every cycle. Returns APEX_RUN_HALTED, APEX_RUN_FAULT,
+ * APEX_RUN_LIMIT or APEX_RUN_QUIT.
+ */
+int
+APEX_cpu_run_cycles(APEX_CPU *cpu, long max_cycles, int single_step)
+{
+    const APEX_Observer *observer;
+    long cycle;
+    int stopped;
+
+    for (cycle = 0; max_cycles < 0 || cycle < max_cycles; ++cycle)
+    {
+        for (observer = cpu->observers; observer; observer = observer->next)
+        {
+            if (observer->cycle_begin)
+            {
+                observer->cycle_begin(cpu, observer->arg);
+            }
+        }
+        stopped = APEX_cpu_cycle(cpu);
+        if (stopped == APEX_CYCLE_FAULT)
         {
-            // the same functionality as in the function "APEX_cpu_run(APEX_CPU *cpu)" but with out the single_step functionality
-            // since the display method displays ony the no. of cycles entred.
-            if (ENABLE_DEBUG_MESSAGES)
+            sync_observers(cpu);
+            printf("APEX_CPU: Simulation Stopped, cycles = %" PRId64 " instructions = %" PRId64 "\n", cpu->clock + 1,
+                   cpu->insn_completed);
+            return APEX_RUN_FAULT;
+        }
+        if (stopped)
+        {
+            /* Halt in writeback stage */
+            sync_observers(cpu);
+            printf("APEX_CPU: Simulation Complete, cycles = %" PRId64 " instructions = %" PRId64 "\n", cpu->clock + 1,
+                   cpu->insn_completed);
+            return APEX_RUN_HALTED;
+        }
+        for (observer = cpu->observers; observer; observer = observer->next)
+        {
+            if (observer->cycle_end)
             {
-                printf("--------------------------------------------\n");
-                // as mentioned in the specifications clock cyle has to be printed from '1'.
-                int clockCycle = cpu->clock + 1;
-                printf("Clock Cycle #: %d\n", clockCycle);
-                printf("--------------------------------------------\n");
+                observer->cycle_end(cpu, observer->arg);
             }
-            // whole this functionality is in "APEX_cpu_run(APEX_CPU *cpu)"
-            if (APEX_writeback(cpu))
+        }
+
+        if (single_step)
+        {
+            char user_prompt_val;
+
+            sync_observers(cpu);
+            printf("Press any key to advance CPU Clock or <q> to quit:\n");
+            if (scanf("%c", &user_prompt_val) != 1 || (user_prompt_val == 'Q') || (user_prompt_val == 'q'))
             {
-                int clockCycle = cpu->clock + 1;
-                /* Halt in writeback stage */
-                printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", clockCycle, cpu->insn_completed);
-                break;
+                printf("APEX_CPU: Simulation Stopped, cycles = %" PRId64 " instructions = %" PRId64 "\n", cpu->clock,
+                       cpu->insn_completed);
+                return APEX_RUN_QUIT;
             }
-            // followed teh same functionality as in "APEX_cpu_run(APEX_CPU *cpu)" because the
-            // fetch decode int_operations writeback and writeBack stages are same
-            int_operations(cpu);
-            mul_operation(cpu);
-            load_operations(cpu);
-            APEX_decode(cpu);
-            APEX_fetch(cpu);
-            print_reg_file(cpu);
-            // incerementing teh clock cycles in cpu as it should go to new instruction every time
-            cpu->clock++;
         }
-        // we dont need even 'q' or 'Q' because the cycles run at a time and stop at last.
-        // so not needed to quit the operation being int_operationsd.
+    }
+    sync_observers(cpu);
+    return APEX_RUN_LIMIT;
+}
+
+// returns TRUE when the program stopped on a fault (a DIV by zero, a data memory access or a pc out of range)
+// or the mode could not be set up.
+int APEX_cpu_display_simulate_show_mem(APEX_CPU *cpu, int cyclesEntred, const char *functionType)
+{
+    APEX_Observer display = display_observer;
+    int faulted = FALSE;
+
+    // display and simulate print every stage and the register file each cycle, unless the
+    // debug messages are compiled out or the run is quiet.
+    if (ENABLE_DEBUG_MESSAGES && !cpu->quiet &&
+        (strcmp(functionType, "display") == 0 || strcmp(functionType, "simulate") == 0))
+    {
+        start_display(cpu, &display);
+    }
 
+    // if display is entred in commandLine
+    //  display function has to just display the executions till the number of cycles is reached mentioned in the command line.
+    if (strcmp(functionType, "display") == 0)
+    {
+        printf("\n display   @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@   display\n");
+        faulted = (APEX_cpu_run_cycles(cpu, cyclesEntred, FALSE) == APEX_RUN_FAULT);
         // since we are supposed to display the state of architectural registers and state of data writeback
         // i'm caling print_state_of_architectural_register_file(APEX_CPU *cpu) and print_state_of_data_memory(APEX_CPU *cpu) functions
         print_state_of_architectural_register_file(cpu);
@@ -972,119 +1351,94 @@ void APEX_cpu_display_simulate_show_mem(APEX_CPU *cpu, int cyclesEntred, const c
     // if simulate is entred in command line
     else if (strcmp(functionType, "simulate") == 0)
     {
-        char user_prompt_val;
         printf("\nsimulate   #########################################################    simulate\n");
-        for (int i = 0; i < cyclesEntred; --cyclesEntred)
+        // the cycles entred run at once, then the simulation carries on one step at a time as in
+        // "APEX_cpu_run(APEX_CPU *cpu)" until HALT or 'q'.
+        int status = APEX_cpu_run_cycles(cpu, cyclesEntred, FALSE);
+
+        if (status == APEX_RUN_LIMIT)
         {
-            // the same functionality as in the function "APEX_cpu_run(APEX_CPU *cpu)" but with out the single_step functionality
-            // since the display method displays ony the no. of cycles entred.
-            if (ENABLE_DEBUG_MESSAGES)
-            {
-                printf("--------------------------------------------\n");
-                // as mentioned in the specifications clock cyle has to be printed from '1'.
-                int clockCycle = cpu->clock + 1;
-                printf("Clock Cycle #: %d\n", clockCycle);
-                printf("--------------------------------------------\n");
-            }
-            // whole this functionality is in "APEX_cpu_run(APEX_CPU *cpu)"
-            if (APEX_writeback(cpu))
-            {
-                int clockCycle = cpu->clock + 1;
-                /* Halt in writeback stage */
-                printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", clockCycle, cpu->insn_completed);
-                break;
-            }
-            // followed teh same functionality as in "APEX_cpu_run(APEX_CPU *cpu)" because the
-            // fetch decode int_operations writeback and writeBack stages are same
-            int_operations(cpu);
-            mul_operation(cpu);
-            load_operations(cpu);
-            APEX_decode(cpu);
-            APEX_fetch(cpu);
-            print_reg_file(cpu);
-            // incerementing teh clock cycles in cpu as it should go to new instruction every time
-            cpu->clock++;
+            status = APEX_cpu_run_cycles(cpu, -1, cpu->single_step);
         }
+        faulted = (status == APEX_RUN_FAULT);
+        print_state_of_architectural_register_file(cpu);
+        print_state_of_data_memory(cpu);
+    }
 
-        // same as in the "APEX_cpu_run(APEX_CPU *cpu)" fuctnion, since we are supposed to int_operations the instructions prefered in the command line argument
-        // and if the whole numner of cycles are 100 for example, and if the command line argument is 80 we will run only the 80 cycles adn
-        // then iniitate the single_step function.
+    // functional runs the program without the pipeline, one instruction at a time, the number
+    // entred is the instruction limit (0 runs until HALT). Only the final state is printed.
+    else if (strcmp(functionType, "functional") == 0)
+    {
+        int status = APEX_cpu_run_functional(cpu, cyclesEntred);
 
-        // here we are initiating the single step. which is already implemented in "APEX_cpu_run(APEX_CPU *cpu)"
-        while (TRUE)
-        {
-            if (ENABLE_DEBUG_MESSAGES)
-            {
-                printf("--------------------------------------------\n");
-                // as mentioned in the specifications clock cyle has to be printed from '1'.
-                int clockCycle = cpu->clock + 1;
-                printf("Clock Cycle #: %d\n", clockCycle);
-                printf("--------------------------------------------\n");
-            }
+        printf("APEX_CPU: Functional run %s, instructions = %" PRId64 "\n",
+               status == APEX_FUNC_HALTED ? "complete" : (status == APEX_FUNC_LIMIT ? "stopped" : "failed"),
+               cpu->insn_completed);
+        faulted = (status == APEX_FUNC_ERROR);
+        APEX_block_cache_print_stats(cpu);
+        print_state_of_architectural_register_file(cpu);
+        print_state_of_data_memory(cpu);
+    }
 
-            if (APEX_writeback(cpu))
-            {
-                int clockCycle = cpu->clock + 1;
-                /* Halt in writeback stage */
-                printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", clockCycle, cpu->insn_completed);
-                break;
-            }
+    // sample runs the program functionally and only simulates short windows in the pipeline, the
+    // number entred is the instruction limit (0 runs until HALT). See apex_sample.c.
+    else if (strcmp(functionType, "sample") == 0)
+    {
+        faulted = (APEX_cpu_run_sampled(cpu, cyclesEntred) == APEX_FUNC_ERROR);
+        print_state_of_architectural_register_file(cpu);
+        print_state_of_data_memory(cpu);
+    }
 
-            int_operations(cpu);
-            mul_operation(cpu);
-            load_operations(cpu);
-            APEX_decode(cpu);
-            APEX_fetch(cpu);
+    // parallel cuts the run into intervals with a functional pass and simulates them in the pipeline on
+    // separate threads, the number entred is the instruction limit (0 runs until HALT). See apex_interval.c.
+    else if (strcmp(functionType, "parallel") == 0)
+    {
+        faulted = (APEX_cpu_run_intervals(cpu, cyclesEntred) == APEX_FUNC_ERROR);
+        print_state_of_architectural_register_file(cpu);
+        print_state_of_data_memory(cpu);
+    }
 
-            print_reg_file(cpu);
+    // cpi runs the number of cycles entred headless and prints the CPI stack, where every cycle went,
+    // for the whole program and per instruction. See apex_stats.c.
+    else if (strcmp(functionType, "cpi") == 0)
+    {
+        int status;
 
-            if (cpu->single_step)
-            {
-                printf("Press any key to advance CPU Clock or <q> to quit:\n");
-                scanf("%c", &user_prompt_val);
-
-                if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
-                {
-                    int clockCycle = cpu->clock + 1;
-                    printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", clockCycle, cpu->insn_completed);
-                    break;
-                }
-            }
-            cpu->clock++;
+        if (APEX_cpi_start(cpu) != 0)
+        {
+            fprintf(stderr, "APEX_Error: Unable to allocate the CPI stack\n");
+            return TRUE;
         }
-        // since we are supposed to display the state of architectural registers and state of data writeback
-        // i'm caling print_state_of_architectural_register_file(APEX_CPU *cpu) and print_state_of_data_memory(APEX_CPU *cpu) functions
-        print_state_of_architectural_register_file(cpu);
-        print_state_of_data_memory(cpu);
+        status = APEX_cpu_run_cycles(cpu, cyclesEntred, FALSE);
+        faulted = (status == APEX_RUN_FAULT);
+        // same cycle count as the display mode prints, the clock does not advance past HALT or a fault
+        APEX_cpi_print(cpu, status == APEX_RUN_HALTED || faulted ? cpu->clock + 1 : cpu->clock);
     }
 
-    // show_mem method displays the no. of instructions entred and prints the state of architecture
-    else if (strcmp(functionType, "show_mem") == 0)
+    // branch runs the number of cycles entred headless and prints how well fetch predicted the BZ/BNZ,
+    // for the whole program and per branch. See apex_bpred.c.
+    else if (strcmp(functionType, "branch") == 0)
     {
-        for (int i = 0; i < cyclesEntred; cyclesEntred--)
+        if (APEX_bpred_start(cpu) != 0)
         {
-            if (APEX_writeback(cpu))
-            {
-                int clockCycle = cpu->clock + 1;
-                /* Halt in writeback stage */
-                printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", clockCycle, cpu->insn_completed);
-                // break;
-            }
-            // followed teh same functionality as in "APEX_cpu_run(APEX_CPU *cpu)" because the
-            // fetch decode int_operations writeback and writeBack stages are same
-            int_operations(cpu);
-            mul_operation(cpu);
-            load_operations(cpu);
-            APEX_decode(cpu);
-            APEX_fetch(cpu);
-            // tried not to print the register file as we don't want to print all those in the show_mem stage.
-            // print_reg_file(cpu);
-            // incerementing teh clock cycles in cpu as it should go to new instruction every time
-            cpu->clock++;
+            fprintf(stderr, "APEX_Error: Unable to allocate the branch rows\n");
+            return TRUE;
         }
+        faulted = (APEX_cpu_run_cycles(cpu, cyclesEntred, FALSE) == APEX_RUN_FAULT);
+        APEX_bpred_print(cpu);
+    }
+
+    // show_mem method displays the no. of instructions entred and prints the state of architecture,
+    // no observer is registered so the cycles run headless.
+    else if (strcmp(functionType, "show_mem") == 0)
+    {
+        faulted = (APEX_cpu_run_cycles(cpu, cyclesEntred, FALSE) == APEX_RUN_FAULT);
         print_state_of_architectural_register_file(cpu);
         print_state_of_data_memory(cpu);
     }
+
+    stop_display(cpu, &display);
+    return faulted;
 }
 /*
  * This function creates and initializes APEX cpu.
@@ -1093,6 +1447,18 @@ void APEX_cpu_display_simulate_show_mem(APEX_CPU *cpu, int cyclesEntred, const c
  */
 APEX_CPU *
 APEX_cpu_init(const char *filename)
+{
+    APEX_Config config;
+
+    APEX_config_init(&config);
+    return APEX_cpu_init_with_config(filename, &config);
+}
+
+/*
+ * Same as APEX_cpu_init, with the run-time options given by the caller
+ */
+APEX_CPU *
+APEX_cpu_init_with_config(const char *filename, const APEX_Config *config)
 {
     int i;
     APEX_CPU *cpu;
@@ -1108,22 +1474,53 @@ APEX_cpu_init(const char *filename)
     {
         return NULL;
     }
+    cpu->config = *config;
 
     /* Initialize PC, Registers and all pipeline stages */
     cpu->pc = 4000;
     memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
     memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
     cpu->single_step = ENABLE_SINGLE_STEP;
-
-    /* Parse input file and create code writeback */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
-    if (!cpu->code_memory)
+    cpu->quiet = cpu->config.quiet;
+    // Used these values to implement the stall functionality.
+    cpu->check.inUse = 1;
+    cpu->check.notInUse = 0;
+    // to check if the register values are empty, I used while stalling.
+    cpu->check.isRegisterValueEmpty = 0;
+    APEX_stats_start(cpu);
+    APEX_cpi_reset(cpu);
+    APEX_bpred_reset(cpu);
+
+    /* An assembled .apexo image is mapped and used as code memory as it is,
+     * anything else is parsed as an assembly file */
+    if (APEX_object_is_image(filename))
     {
-        free(cpu);
-        return NULL;
+        if (APEX_object_load(cpu, filename) != 0)
+        {
+            free(cpu);
+            return NULL;
+        }
+    }
+    else
+    {
+        /* Parse input file and create code memory */
+        cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size,
+                                              APEX_config_resolve_threads(cpu->config.parse_threads));
+        if (!cpu->code_memory)
+        {
+            free(cpu);
+            return NULL;
+        }
+        cpu->branch_target = resolve_branch_targets(cpu->code_memory, cpu->code_memory_size);
+        if (!cpu->branch_target)
+        {
+            free(cpu->code_memory);
+            free(cpu);
+            return NULL;
+        }
     }
 
-    if (ENABLE_DEBUG_MESSAGES)
+    if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
     {
         fprintf(stderr,
                 "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
@@ -1135,7 +1532,7 @@ APEX_cpu_init(const char *filename)
 
         for (i = 0; i < cpu->code_memory_size; ++i)
         {
-            printf("%-9s %-9d %-9d %-9d %-9d %-9d\n", cpu->code_memory[i].opcode_str,
+            printf("%-9s %-9d %-9d %-9d %-9d %-9d\n", get_opcode_str(cpu->code_memory[i].opcode),
                    cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
                    cpu->code_memory[i].rs2, cpu->code_memory[i].rs3, cpu->code_memory[i].imm);
         }
@@ -1152,54 +1549,20 @@ APEX_cpu_init(const char *filename)
  *
  * Note: You are free to edit this function according to your implementation
  */
-void APEX_cpu_run(APEX_CPU *cpu)
+int APEX_cpu_run(APEX_CPU *cpu)
 {
-    char user_prompt_val;
+    APEX_Observer display = display_observer;
+    int faulted;
 
-    while (TRUE)
+    if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
     {
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            printf("--------------------------------------------\n");
-            // as mentioned in the specifications clock cyle has to be printed from '1'.
-            int clockCycle = cpu->clock + 1;
-            printf("Clock Cycle #: %d\n", clockCycle);
-            printf("--------------------------------------------\n");
-        }
-
-        if (APEX_writeback(cpu))
-        {
-            int clockCycle = cpu->clock + 1;
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", clockCycle, cpu->insn_completed);
-            break;
-        }
-
-        int_operations(cpu);
-        mul_operation(cpu);
-        load_operations(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-
-        print_reg_file(cpu);
-
-        if (cpu->single_step)
-        {
-            printf("Press any key to advance CPU Clock or <q> to quit:\n");
-            scanf("%c", &user_prompt_val);
-
-            if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
-            {
-                int clockCycle = cpu->clock + 1;
-                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", clockCycle, cpu->insn_completed);
-                break;
-            }
-        }
-        cpu->clock++;
-        // print_state_of_architectural_register_file(cpu);
+        start_display(cpu, &display);
     }
+    faulted = (APEX_cpu_run_cycles(cpu, -1, cpu->single_step) == APEX_RUN_FAULT);
+    stop_display(cpu, &display);
     print_state_of_architectural_register_file(cpu);
     print_state_of_data_memory(cpu);
+    return faulted;
 }
 
 /*
@@ -1209,6 +1572,17 @@ void APEX_cpu_run(APEX_CPU *cpu)
  */
 void APEX_cpu_stop(APEX_CPU *cpu)
 {
-    free(cpu->code_memory);
+    if (cpu->image)
+    {
+        munmap(cpu->image, cpu->image_size);
+    }
+    else
+    {
+        free(cpu->code_memory);
+        free((int *)cpu->branch_target);
+    }
+    free(cpu->threaded_code);
+    APEX_block_cache_free(cpu);
+    APEX_stats_free(cpu);
     free(cpu);
 }
\ No newline at end of file
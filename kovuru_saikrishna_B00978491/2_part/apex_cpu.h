@@ -9,42 +9,43 @@
 #ifndef _APEX_CPU_H_
 #define _APEX_CPU_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "apex_bpred.h"
+#include "apex_config.h"
 #include "apex_macros.h"
+#include "apex_stats.h"
 
+/* Values of the stall flags, kept per cpu so that cpus on different threads
+ * share nothing */
 struct flagCheck
 {
   int inUse;
   int notInUse;
   int isRegisterValueEmpty;
-} flagCheck;
+};
 
-/* Format of an APEX instruction  */
+/* Format of a predecoded APEX instruction (12 bytes), the mnemonic is
+ * rebuilt from the opcode only when printing */
 typedef struct APEX_Instruction
 {
-  char opcode_str[128];
-  int opcode;
-  int rd;
-  int rs1;
-  int rs2;
+  unsigned char opcode;
+  unsigned char rd;
+  unsigned char rs1;
+  unsigned char rs2;
   // added for STR as STR's input looks like "STR R3,R4,R5" and we need the third variable,
   // and in addition R3 is also a known value unless like rd
-  int rs3;
+  unsigned char rs3;
   int imm;
 } APEX_Instruction;
 
-/* Model of CPU stage latch */
+/* Model of CPU stage latch, static fields are read through the code memory
+ * index so only the dynamic operand values travel down the pipeline */
 typedef struct CPU_Stage
 {
   int pc;
-  char opcode_str[128];
-  int opcode;
-  int rs1;
-  int rs2;
-  // added for STR as STR's input looks like "STR R3,R4,R5" and we need the third variable,
-  // and in addition R3 is also a known value unless like rd
-  int rs3;
-  int rd;
-  int imm;
+  int insn; /* Index of the instruction in code memory */
   int rs1_value;
   int rs2_value;
   // added for STR as STR's input which looks like "STR R3,R4,R5" and we need the third variable,
@@ -55,37 +56,166 @@ typedef struct CPU_Stage
   int has_insn;
   // created as we have to check the flag for stalling functionality.
   int is_stalled;
+  int64_t seq;          /* Dynamic instruction number, given at fetch */
+  int zero_flag;        /* Zero flag the instruction sets, or the one a BZ/BNZ branches on */
+  int unit;             /* Instance of its FU class it was issued to */
+  int cycles_left;      /* Cycles it still spends in the FU, the result is computed in the last one */
+  int predicted;        /* BZ/BNZ: fetch predicted it taken and went on at its target */
+  unsigned int history; /* BZ/BNZ: global branch history when fetch predicted it */
 } CPU_Stage;
 
+/* Pipeline stages as observers see them */
+typedef enum APEX_Stage_Id
+{
+  APEX_STAGE_FETCH,
+  APEX_STAGE_DECODE,
+  APEX_STAGE_INT,
+  APEX_STAGE_MUL,
+  APEX_STAGE_LOAD,
+  APEX_STAGE_WRITEBACK,
+  APEX_STAGE_DIV, /* after the original stages, so the ids of trace files stay the same */
+  APEX_STAGE_COUNT
+} APEX_Stage_Id;
+
+struct APEX_CPU;
+
+/*
+ * Callbacks of the cycle engine, any of them may be NULL. 'stage' is told
+ * what every stage held in the cycle, the latch is NULL for an empty stage
+ * (it is the latch the instruction was in, has_insn may already be clear).
+ * 'sync' is called before the engine writes to stdout itself and before it
+ * returns, an observer printing from another thread catches up there.
+ * A cpu with no observer simulates without any of these calls.
+ */
+typedef struct APEX_Observer
+{
+  void (*cycle_begin)(const struct APEX_CPU *cpu, void *arg);
+  void (*stage)(const struct APEX_CPU *cpu, APEX_Stage_Id id, const CPU_Stage *stage, void *arg);
+  void (*cycle_end)(const struct APEX_CPU *cpu, void *arg);
+  void (*sync)(const struct APEX_CPU *cpu, void *arg);
+  void *arg;
+  struct APEX_Observer *next;
+} APEX_Observer;
+
 /* Model of APEX CPU */
 typedef struct APEX_CPU
 {
   int pc;                            /* Current program counter */
-  int clock;                         /* Clock cycles elapsed */
-  int insn_completed;                /* Instructions retired */
+  int64_t clock;                     /* Clock cycles elapsed */
+  int64_t insn_completed;            /* Instructions retired */
   int regs[REG_FILE_SIZE];           /* Integer register file */
   int code_memory_size;              /* Number of instruction in the input file */
   APEX_Instruction *code_memory;     /* Code Memory */
+  const int *branch_target;          /* Code memory index of every BZ/BNZ target, -1 otherwise */
+  void *image;                       /* Mapped .apexo image backing code memory, NULL if parsed */
+  size_t image_size;
+  void *threaded_code;               /* Code memory translated for threaded dispatch, built on first use */
+  void *block_cache;                 /* Basic blocks translated by the block cache dispatch */
   int data_memory[DATA_MEMORY_SIZE]; /* Data Memory */
   int single_step;                   /* Wait for user input after every cycle */
+  int quiet;                         /* No code listing or per-stage messages */
+  APEX_Observer *observers;          /* Called every cycle, NULL runs headless */
   int zero_flag;                     /* {TRUE, FALSE} Used by BZ and BNZ to branch */
   int fetch_from_next_cycle;
   int regCheck[REG_FILE_SIZE];
+  struct flagCheck check;            /* Stall flag values */
+  int fu_stalled;                    /* Decode waits for a free FU, or for a branch to resolve */
+  APEX_Stats stats;                  /* Event counters */
+  int64_t stats_next;                /* Cycle of the next snapshot of stats, -1 for none */
+  APEX_Stats_Series *stats_series;   /* Snapshots taken, NULL before the first */
+  APEX_Cpi_State cpi;                /* Cycle accounting of the CPI stack */
+  int64_t fetch_seq;                 /* Number of the next instruction fetch hands to decode */
+  APEX_Bpred bpred;                  /* Branch predictor tables */
+  APEX_Bpred_Row *bpred_rows;        /* Per code memory index, NULL unless a report asked for them */
+  APEX_Config config;                /* Run-time options */
 
   /* Pipeline stages */
   CPU_Stage fetch;
   CPU_Stage decode;
-  CPU_Stage int_operations;
-  CPU_Stage mul_operation;
-  CPU_Stage load_operations;
 
-  CPU_Stage writeback;
+  /* Instructions in the FUs, oldest first as decode issues in order */
+  CPU_Stage executing[COMPLETION_BUFFER_SIZE];
+  int executing_count;
+  int64_t fu_ready[FU_COUNT][FU_MAX_UNITS]; /* Cycle from which each FU instance takes another instruction */
+
+  /* Completion buffer, finished instructions waiting for writeback, oldest first */
+  CPU_Stage completion[COMPLETION_BUFFER_SIZE];
+  int completion_count;
 } APEX_CPU;
 
-APEX_Instruction *create_code_memory(const char *filename, int *size);
+APEX_Instruction *create_code_memory(const char *filename, int *size, int threads);
+int *resolve_branch_targets(const APEX_Instruction *code_memory, int size);
+void benchmark_code_memory_load(const char *filename, int repetitions, int threads);
 APEX_CPU *APEX_cpu_init(const char *filename);
-void APEX_cpu_run(APEX_CPU *cpu);
+APEX_CPU *APEX_cpu_init_with_config(const char *filename, const APEX_Config *config);
+int APEX_cpu_run(APEX_CPU *cpu);
 void APEX_cpu_stop(APEX_CPU *cpu);
+/* Threaded dispatch of the functional interpreter needs GCC labels as values */
+#if defined(__GNUC__)
+#define APEX_HAVE_THREADED_DISPATCH 1
+#else
+#define APEX_HAVE_THREADED_DISPATCH 0
+#endif
+/* Native code for hot blocks of the functional interpreter */
+#if defined(__x86_64__) && defined(__linux__)
+#define APEX_HAVE_JIT 1
+#else
+#define APEX_HAVE_JIT 0
+#endif
+/* Result of APEX_cpu_run_functional */
+enum
+{
+  APEX_FUNC_HALTED, /* HALT retired */
+  APEX_FUNC_LIMIT,  /* instruction limit reached */
+  APEX_FUNC_ERROR   /* pc left code memory, or an instruction faulted */
+};
+int APEX_cpu_run_functional(APEX_CPU *cpu, long max_insns);
+int APEX_cpu_run_warming(APEX_CPU *cpu, long max_insns);
+void APEX_cpu_benchmark_functional(APEX_CPU *cpu, int repetitions);
+int APEX_cpu_check_jit(APEX_CPU *cpu, long max_insns);
+void APEX_cpu_start_detailed(APEX_CPU *detail, const APEX_CPU *master);
+int64_t APEX_cpu_measure_window(APEX_CPU *detail, long warmup, long window);
+int APEX_cpu_run_sampled(APEX_CPU *cpu, long max_insns);
+int APEX_cpu_run_intervals(APEX_CPU *cpu, long max_insns);
+int APEX_cpu_stress(const char *filename, const APEX_Config *config, int max_cycles);
+int APEX_cpu_sweep(const APEX_CPU *master, int max_cycles, const char *matrix_file);
+void APEX_format_instruction(char *text, size_t size, const APEX_Instruction *ins);
+void APEX_print_fault(const APEX_Instruction *ins, int pc, int address);
+/* Result of a pipeline cycle */
+enum
+{
+  APEX_CYCLE_RUNNING,
+  APEX_CYCLE_HALTED, /* HALT retired */
+  APEX_CYCLE_FAULT   /* the next instruction to retire faulted, or the pc left code memory */
+};
+void APEX_stats_start(APEX_CPU *cpu);
+void APEX_stats_snapshot(APEX_CPU *cpu);
+void APEX_stats_free(APEX_CPU *cpu);
+void APEX_cpi_reset(APEX_CPU *cpu);
+int APEX_cpi_start(APEX_CPU *cpu);
+void APEX_cpi_print(const APEX_CPU *cpu, int64_t cycles);
+void APEX_bpred_reset(APEX_CPU *cpu);
+int APEX_bpred_predict(APEX_CPU *cpu, CPU_Stage *stage);
+int APEX_bpred_resolve(APEX_CPU *cpu, const CPU_Stage *stage, int taken);
+void APEX_bpred_train(APEX_CPU *cpu, int insn, int taken);
+int APEX_bpred_is_valid(const APEX_CPU *cpu, const APEX_Bpred *bpred);
+int APEX_bpred_start(APEX_CPU *cpu);
+void APEX_bpred_print(const APEX_CPU *cpu);
+int APEX_stats_write_json(const APEX_CPU *cpu, int64_t cycles, const char *status, const char *filename);
+void print_state_of_architectural_register_file(APEX_CPU *cpu);
+void print_state_of_data_memory(APEX_CPU *cpu);
+int APEX_cpu_cycle(APEX_CPU *cpu);
+void APEX_cpu_add_observer(APEX_CPU *cpu, APEX_Observer *observer);
+void APEX_cpu_remove_observer(APEX_CPU *cpu, APEX_Observer *observer);
+/* Result of APEX_cpu_run_cycles */
+enum
+{
+  APEX_RUN_HALTED, /* HALT retired */
+  APEX_RUN_FAULT,  /* an instruction faulted */
+  APEX_RUN_LIMIT,  /* cycle limit reached */
+  APEX_RUN_QUIT    /* the user quit a single-step run */
+};
+int APEX_cpu_run_cycles(APEX_CPU *cpu, long max_cycles, int single_step);
 // added to perforn display simulate and show_mem operations.
-void APEX_cpu_display_simulate_show_mem(APEX_CPU *cpu, int cyclesEntred, const char *functionType);
+int APEX_cpu_display_simulate_show_mem(APEX_CPU *cpu, int cyclesEntred, const char *functionType);
 #endif
@@ -0,0 +1,621 @@
+/*
+ * apex_func.c
+ * Contains the functional APEX interpreter, it executes the program one
+ * instruction per step and only keeps the architectural state (pc, regs,
+ * data_memory and zero_flag), without any of the pipeline timing
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "apex_cpu.h"
+#include "apex_func.h"
+#include "apex_macros.h"
+
+static int
+get_code_memory_index_from_pc(const int pc)
+{
+    return (pc - 4000) / 4;
+}
+
+/*
+ * Portable dispatch, one switch per instruction. With 'warm' (a constant at
+ * every call site) every BZ/BNZ also trains the branch predictor.
+ */
+static inline __attribute__((always_inline)) int
+run_switch_warming(APEX_CPU *cpu, int *index_io, long max_insns, long *executed_out, const int warm)
+{
+    int index = *index_io;
+    long executed = 0;
+    int status = APEX_FUNC_LIMIT;
+
+    while (max_insns == 0 || executed < max_insns)
+    {
+        const APEX_Instruction *ins;
+        int next = APEX_FUNC_FAULT;
+
+        if (index < 0 || index >= cpu->code_memory_size)
+        {
+            status = APEX_FUNC_ERROR;
+            break;
+        }
+
+        ins = &cpu->code_memory[index];
+        executed++;
+
+        if (ins->opcode == OPCODE_HALT)
+        {
+            status = APEX_FUNC_HALTED;
+            break;
+        }
+
+        switch (ins->opcode)
+        {
+#define APEX_FUNC_CASE(name, mnem, opc, fmt, src, dst, fu, alu, mem, br, zf) \
+    case opc:                                                                \
+        if (warm && (br == BR_Z || br == BR_NZ))                             \
+        {                                                                    \
+            APEX_bpred_train(cpu, index, (br == BR_Z) == cpu->zero_flag);    \
+        }                                                                    \
+        next = execute_insn(cpu, ins, index, src, dst, alu, mem, br, zf);    \
+        break;
+
+            APEX_ISA_TABLE(APEX_FUNC_CASE)
+
+#undef APEX_FUNC_CASE
+        }
+        if (next == APEX_FUNC_FAULT)
+        {
+            /* The run stops in front of it, as for a pc outside code memory */
+            executed--;
+            status = APEX_FUNC_ERROR;
+            break;
+        }
+        index = next;
+    }
+
+    *index_io = index;
+    *executed_out = executed;
+    return status;
+}
+
+static int
+run_switch(APEX_CPU *cpu, int *index_io, long max_insns, long *executed_out)
+{
+    return run_switch_warming(cpu, index_io, max_insns, executed_out, FALSE);
+}
+
+#if APEX_HAVE_THREADED_DISPATCH
+/* Threaded code, a copy of code memory where every instruction carries the
+ * address of its handler. One extra entry past the end catches fall-through. */
+typedef struct Threaded_Insn
+{
+    const void *handler;
+    APEX_Instruction ins;
+} Threaded_Insn;
+
+/*
+ * Threaded-code dispatch (GCC labels as values), every handler jumps
+ * straight to the handler of the next instruction
+ */
+static int
+run_threaded(APEX_CPU *cpu, int *index_io, long max_insns, long *executed_out)
+{
+#define APEX_THREADED_LABEL(name, mnem, opc, ...) [opc] = &&op_##name,
+    static const void *const handlers[APEX_OPCODE_LIMIT] = {APEX_ISA_TABLE(APEX_THREADED_LABEL)};
+#undef APEX_THREADED_LABEL
+
+    const unsigned int size = cpu->code_memory_size;
+    const long budget = max_insns ? max_insns : LONG_MAX;
+    long remaining = budget;
+    int index = *index_io;
+    int next;
+    Threaded_Insn *tc = cpu->threaded_code;
+    int status;
+
+    /* Translate code memory the first time it is run */
+    if (!tc)
+    {
+        unsigned int i;
+
+        tc = malloc((size + 1) * sizeof(Threaded_Insn));
+        if (!tc)
+        {
+            return run_switch(cpu, index_io, max_insns, executed_out);
+        }
+        for (i = 0; i < size; ++i)
+        {
+            unsigned char opcode = cpu->code_memory[i].opcode;
+
+            tc[i].ins = cpu->code_memory[i];
+            tc[i].handler = (opcode < APEX_OPCODE_LIMIT && handlers[opcode]) ? handlers[opcode] : &&op_invalid;
+        }
+        tc[size].handler = &&op_out_of_code;
+        cpu->threaded_code = tc;
+    }
+
+    /* Every dispatch uses up one instruction of the budget */
+#define DISPATCH()                   \
+    do                               \
+    {                                \
+        if (remaining-- == 0)        \
+        {                            \
+            goto limit;              \
+        }                            \
+        goto *tc[index].handler;     \
+    } while (0)
+
+    if ((unsigned int)index >= size)
+    {
+        status = APEX_FUNC_ERROR;
+        goto done;
+    }
+    DISPATCH();
+
+    /* Branch handlers can leave the program, the others at most run into the
+     * extra entry past the end. Only DIV and memory accesses fault. */
+#define APEX_THREADED_HANDLER(name, mnem, opc, fmt, src, dst, fu, alu, mem, br, zf) \
+    op_##name:                                                                      \
+    if (br == BR_HALT)                                                              \
+    {                                                                               \
+        goto halted;                                                                \
+    }                                                                               \
+    next = execute_insn(cpu, &tc[index].ins, index, src, dst, alu, mem, br, zf);    \
+    if ((alu == ALU_DIV || mem != MEM_NONE) && next == APEX_FUNC_FAULT)             \
+    {                                                                               \
+        goto fault;                                                                 \
+    }                                                                               \
+    index = next;                                                                   \
+    if (br != BR_NONE && (unsigned int)index > size)                                \
+    {                                                                               \
+        goto out_of_code;                                                           \
+    }                                                                               \
+    DISPATCH();
+
+    APEX_ISA_TABLE(APEX_THREADED_HANDLER)
+
+#undef APEX_THREADED_HANDLER
+#undef DISPATCH
+
+op_out_of_code:
+fault:
+    /* The dispatch to the extra entry was not an instruction, a faulting one is not executed */
+    remaining++;
+out_of_code:
+op_invalid:
+    status = APEX_FUNC_ERROR;
+    goto done;
+halted:
+    status = APEX_FUNC_HALTED;
+    goto done;
+limit:
+    /* The failed dispatch took the budget below zero */
+    remaining = 0;
+    status = APEX_FUNC_LIMIT;
+done:
+    *index_io = index;
+    *executed_out = budget - remaining;
+    return status;
+}
+#endif
+
+/*
+ * Says why a run stopped with APEX_FUNC_ERROR at code memory index 'index':
+ * the pc left code memory, or the instruction there faulted
+ */
+static void
+report_error(const APEX_CPU *cpu, int index)
+{
+    const APEX_Instruction *ins;
+    const APEX_Opcode_Info *info;
+    int a, b;
+
+    if (index < 0 || index >= cpu->code_memory_size)
+    {
+        fprintf(stderr, "APEX_Error: pc(%d) is outside code memory\n", 4000 + index * 4);
+        return;
+    }
+    ins = &cpu->code_memory[index];
+    if (ins->opcode >= APEX_OPCODE_LIMIT || !apex_isa[ins->opcode].mnemonic)
+    {
+        fprintf(stderr, "APEX_Error: invalid instruction at pc(%d)\n", 4000 + index * 4);
+        return;
+    }
+    info = &apex_isa[ins->opcode];
+    read_operands(cpu, ins, info->src, info->mem, &a, &b);
+    if (info->alu == ALU_DIV && b == 0)
+    {
+        APEX_print_fault(ins, 4000 + index * 4, 0);
+    }
+    else if (info->mem != MEM_NONE)
+    {
+        APEX_print_fault(ins, 4000 + index * 4, apex_alu(info->alu, a, b));
+    }
+}
+
+/*
+ * Runs the program architecturally from cpu->pc, one instruction per step,
+ * until HALT retires or max_insns instructions have executed (0 means no
+ * limit). Pipeline latches, regCheck and the clock are left alone, cpu->pc
+ * ends up at the next instruction to execute so the pipeline can carry on
+ * from there when the run stopped at the limit.
+ */
+int
+APEX_cpu_run_functional(APEX_CPU *cpu, long max_insns)
+{
+    int index = get_code_memory_index_from_pc(cpu->pc);
+    long executed = 0;
+    int status;
+
+    if (cpu->config.func_dispatch == FUNC_DISPATCH_BLOCK || cpu->config.func_dispatch == FUNC_DISPATCH_JIT)
+    {
+        status = APEX_block_run(cpu, &index, max_insns, &executed);
+    }
+    else
+#if APEX_HAVE_THREADED_DISPATCH
+    if (cpu->config.func_dispatch == FUNC_DISPATCH_THREADED)
+    {
+        status = run_threaded(cpu, &index, max_insns, &executed);
+    }
+    else
+#endif
+    {
+        status = run_switch(cpu, &index, max_insns, &executed);
+    }
+
+    if (status == APEX_FUNC_ERROR)
+    {
+        report_error(cpu, index);
+    }
+
+    cpu->pc = 4000 + index * 4;
+    cpu->insn_completed += executed;
+    return status;
+}
+
+/*
+ * Same as APEX_cpu_run_functional, and the branch predictor learns from
+ * every BZ/BNZ on the way (bp_warming) so the pipeline a fast-forward hands
+ * over to does not start with cold tables. Training needs every branch one
+ * by one, so this always runs on the switch dispatch.
+ */
+int
+APEX_cpu_run_warming(APEX_CPU *cpu, long max_insns)
+{
+    int index = get_code_memory_index_from_pc(cpu->pc);
+    long executed = 0;
+    int status;
+
+    if (!cpu->config.bp_warming || cpu->config.branch_predictor == BP_NOT_TAKEN)
+    {
+        return APEX_cpu_run_functional(cpu, max_insns);
+    }
+
+    status = run_switch_warming(cpu, &index, max_insns, &executed, TRUE);
+    if (status == APEX_FUNC_ERROR)
+    {
+        report_error(cpu, index);
+    }
+
+    cpu->pc = 4000 + index * 4;
+    cpu->insn_completed += executed;
+    return status;
+}
+
+/* Architectural state a benchmark run starts from */
+typedef struct Func_Snapshot
+{
+    int pc;
+    int zero_flag;
+    int regs[REG_FILE_SIZE];
+    int data_memory[DATA_MEMORY_SIZE];
+} Func_Snapshot;
+
+static void
+save_snapshot(const APEX_CPU *cpu, Func_Snapshot *snap)
+{
+    snap->pc = cpu->pc;
+    snap->zero_flag = cpu->zero_flag;
+    memcpy(snap->regs, cpu->regs, sizeof(snap->regs));
+    memcpy(snap->data_memory, cpu->data_memory, sizeof(snap->data_memory));
+}
+
+static void
+restore_snapshot(APEX_CPU *cpu, const Func_Snapshot *snap)
+{
+    cpu->pc = snap->pc;
+    cpu->zero_flag = snap->zero_flag;
+    memcpy(cpu->regs, snap->regs, sizeof(snap->regs));
+    memcpy(cpu->data_memory, snap->data_memory, sizeof(snap->data_memory));
+}
+
+/*
+ * Counts user-space host instructions through perf, -1 when the kernel does
+ * not give access to the hardware counter
+ */
+static int
+open_instruction_counter(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/* Host cost of one benchmark configuration */
+typedef struct Func_Bench_Result
+{
+    double seconds;
+    long long host_insns; /* -1 when not counted */
+    int64_t insns;
+} Func_Bench_Result;
+
+/*
+ * Runs the program 'repetitions' times from the same snapshot. With
+ * run_program FALSE only the snapshot restores are done, which gives the
+ * overhead that is subtracted from the real runs.
+ */
+static Func_Bench_Result
+bench_dispatch(APEX_CPU *cpu, const Func_Snapshot *snap, int repetitions,
+               int dispatch, int run_program, int counter)
+{
+    Func_Bench_Result result = {0, -1, 0};
+    struct timespec start, stop;
+    int saved_dispatch = cpu->config.func_dispatch;
+    int64_t saved_completed = cpu->insn_completed;
+    int i;
+
+    cpu->config.func_dispatch = dispatch;
+    cpu->insn_completed = 0;
+    /* Blocks translated for another dispatch are not reused */
+    APEX_block_cache_free(cpu);
+
+#ifdef __linux__
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < repetitions; ++i)
+    {
+        restore_snapshot(cpu, snap);
+        if (run_program)
+        {
+            APEX_cpu_run_functional(cpu, 0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+#ifdef __linux__
+    if (counter >= 0)
+    {
+        long long count;
+
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &count, sizeof(count)) == sizeof(count))
+        {
+            result.host_insns = count;
+        }
+    }
+#endif
+
+    result.seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    result.insns = cpu->insn_completed;
+    cpu->config.func_dispatch = saved_dispatch;
+    cpu->insn_completed = saved_completed;
+    return result;
+}
+
+static void
+print_bench_line(const char *name, Func_Bench_Result run, Func_Bench_Result overhead)
+{
+    double seconds = run.seconds - overhead.seconds;
+
+    if (seconds <= 0)
+    {
+        seconds = run.seconds;
+    }
+    printf("APEX_FUNC_BENCH: %-9s %" PRId64 " insns, %.3f ms, %.2f ns/insn, %.1f MIPS", name, run.insns,
+           seconds * 1e3, seconds * 1e9 / run.insns, run.insns / seconds / 1e6);
+    if (run.host_insns >= 0 && overhead.host_insns >= 0)
+    {
+        printf(", %.1f host insns/insn\n", (double)(run.host_insns - overhead.host_insns) / run.insns);
+    }
+    else
+    {
+        printf(", host insns/insn n/a\n");
+    }
+}
+
+/*
+ * Times one more dispatch method and compares its speed and final state
+ * with the switch run
+ */
+static void
+bench_against_switch(APEX_CPU *cpu, const Func_Snapshot *snap, int repetitions, const char *name,
+                     int dispatch, int counter, const Func_Snapshot *switch_state,
+                     Func_Bench_Result switch_run, Func_Bench_Result overhead)
+{
+    Func_Snapshot *state = malloc(sizeof(Func_Snapshot));
+    Func_Bench_Result run;
+
+    if (!state)
+    {
+        return;
+    }
+    run = bench_dispatch(cpu, snap, repetitions, dispatch, TRUE, counter);
+    print_bench_line(name, run, overhead);
+    save_snapshot(cpu, state);
+    printf("APEX_FUNC_BENCH: %s/switch speedup %.2fx, final states %s\n", name,
+           (switch_run.seconds - overhead.seconds) / (run.seconds - overhead.seconds),
+           memcmp(switch_state, state, sizeof(Func_Snapshot)) == 0 ? "match" : "DIFFER");
+    free(state);
+}
+
+/*
+ * Benchmark of the functional interpreter, runs the whole program
+ * 'repetitions' times with the switch dispatch, threaded dispatch, the
+ * block cache and the JIT and compares host time (and host instructions, when perf counters are
+ * available) per simulated instruction. Loops like the one in input.asm are
+ * where the dispatch cost shows.
+ */
+void
+APEX_cpu_benchmark_functional(APEX_CPU *cpu, int repetitions)
+{
+    Func_Snapshot *snap = malloc(sizeof(Func_Snapshot));
+    Func_Snapshot *switch_state = malloc(sizeof(Func_Snapshot));
+    int counter = open_instruction_counter();
+    Func_Bench_Result overhead, switch_run;
+
+    if (!snap || !switch_state)
+    {
+        free(snap);
+        free(switch_state);
+        return;
+    }
+    if (repetitions < 1)
+    {
+        repetitions = 1;
+    }
+
+    save_snapshot(cpu, snap);
+    overhead = bench_dispatch(cpu, snap, repetitions, FUNC_DISPATCH_SWITCH, FALSE, counter);
+
+    printf("APEX_FUNC_BENCH: %d runs of the program, state restore overhead subtracted%s\n", repetitions,
+           counter >= 0 ? "" : " (perf counters unavailable)");
+
+    switch_run = bench_dispatch(cpu, snap, repetitions, FUNC_DISPATCH_SWITCH, TRUE, counter);
+    print_bench_line("switch", switch_run, overhead);
+    save_snapshot(cpu, switch_state);
+
+#if APEX_HAVE_THREADED_DISPATCH
+    bench_against_switch(cpu, snap, repetitions, "threaded", FUNC_DISPATCH_THREADED, counter,
+                         switch_state, switch_run, overhead);
+#else
+    printf("APEX_FUNC_BENCH: threaded dispatch needs GCC labels as values, not built\n");
+#endif
+    bench_against_switch(cpu, snap, repetitions, "block", FUNC_DISPATCH_BLOCK, counter,
+                         switch_state, switch_run, overhead);
+    bench_against_switch(cpu, snap, repetitions, "jit", FUNC_DISPATCH_JIT, counter,
+                         switch_state, switch_run, overhead);
+
+    APEX_block_cache_free(cpu);
+    restore_snapshot(cpu, snap);
+    if (counter >= 0)
+    {
+        close(counter);
+    }
+    free(switch_state);
+    free(snap);
+}
+
+/*
+ * Differential test of the JIT, runs the program (up to max_insns, 0 until
+ * HALT) with the switch dispatch and again with every block compiled on its
+ * first run, then compares how the runs stopped (a fault included), pc,
+ * zero_flag, regs and data_memory. Returns 0 when both runs end in the same
+ * state.
+ */
+int
+APEX_cpu_check_jit(APEX_CPU *cpu, long max_insns)
+{
+    static const char *const status_names[] = {"halted", "stopped at the limit", "failed"};
+    Func_Snapshot *snap = malloc(sizeof(Func_Snapshot));
+    Func_Snapshot *expected = malloc(sizeof(Func_Snapshot));
+    Func_Snapshot *actual = malloc(sizeof(Func_Snapshot));
+    APEX_Config saved_config = cpu->config;
+    int64_t saved_completed = cpu->insn_completed;
+    int expected_status, actual_status;
+    int64_t expected_insns, actual_insns;
+    int differences = 0;
+    int i;
+
+    if (!snap || !expected || !actual)
+    {
+        free(snap);
+        free(expected);
+        free(actual);
+        return 1;
+    }
+
+    save_snapshot(cpu, snap);
+    cpu->insn_completed = 0;
+    cpu->config.func_dispatch = FUNC_DISPATCH_SWITCH;
+    expected_status = APEX_cpu_run_functional(cpu, max_insns);
+    expected_insns = cpu->insn_completed;
+    save_snapshot(cpu, expected);
+
+    restore_snapshot(cpu, snap);
+    APEX_block_cache_free(cpu);
+    cpu->insn_completed = 0;
+    cpu->config.func_dispatch = FUNC_DISPATCH_JIT;
+    cpu->config.jit_threshold = 1;
+    actual_status = APEX_cpu_run_functional(cpu, max_insns);
+    actual_insns = cpu->insn_completed;
+    save_snapshot(cpu, actual);
+    APEX_block_cache_print_stats(cpu);
+
+    if (expected_status != actual_status || expected_insns != actual_insns || expected->pc != actual->pc)
+    {
+        printf("APEX_JIT_CHECK: switch %s at pc(%d) after %" PRId64 " insns, JIT %s at pc(%d) after %" PRId64
+               " insns\n",
+               status_names[expected_status], expected->pc, expected_insns, status_names[actual_status], actual->pc,
+               actual_insns);
+        differences++;
+    }
+    if (expected->zero_flag != actual->zero_flag)
+    {
+        printf("APEX_JIT_CHECK: zero_flag switch = %d, JIT = %d\n", expected->zero_flag, actual->zero_flag);
+        differences++;
+    }
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (expected->regs[i] != actual->regs[i])
+        {
+            printf("APEX_JIT_CHECK: R%d switch = %d, JIT = %d\n", i, expected->regs[i], actual->regs[i]);
+            differences++;
+        }
+    }
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        if (expected->data_memory[i] != actual->data_memory[i])
+        {
+            printf("APEX_JIT_CHECK: MEM[%d] switch = %d, JIT = %d\n", i, expected->data_memory[i],
+                   actual->data_memory[i]);
+            differences++;
+        }
+    }
+    printf("APEX_JIT_CHECK: %" PRId64 " insns, %s\n", expected_insns,
+           differences ? "JIT and interpreter DIFFER" : "JIT and interpreter match");
+
+    cpu->config = saved_config;
+    cpu->insn_completed = saved_completed;
+    free(snap);
+    free(expected);
+    free(actual);
+    return differences ? 1 : 0;
+}
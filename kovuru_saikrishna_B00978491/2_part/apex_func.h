@@ -0,0 +1,112 @@
+/*
+ * apex_func.h
+ * Contains what the functional interpreter shares with the block cache and
+ * the JIT, the per-instruction semantics and their entry points
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_FUNC_H_
+#define _APEX_FUNC_H_
+
+#include <limits.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* Returned by execute_insn in place of the next index when the instruction
+ * divides by zero or accesses data memory out of range, it changes nothing */
+#define APEX_FUNC_FAULT INT_MIN
+
+/* The two ALU operands of an instruction, from the register file */
+static inline __attribute__((always_inline)) void
+read_operands(const APEX_CPU *cpu, const APEX_Instruction *ins, int src, int mem, int *a, int *b)
+{
+    if (mem == MEM_STORE)
+    {
+        *a = cpu->regs[ins->rs2];
+        *b = (src & OPND_RS3) ? cpu->regs[ins->rs3] : ins->imm;
+    }
+    else
+    {
+        *a = (src & OPND_RS1) ? cpu->regs[ins->rs1] : 0;
+        *b = (src & OPND_RS2) ? cpu->regs[ins->rs2] : ins->imm;
+    }
+}
+
+/*
+ * Executes one instruction and returns the code memory index of the next
+ * one, or APEX_FUNC_FAULT. Every call site passes the ISA table columns as
+ * constants, so the compiler turns this into a specialised body per opcode.
+ */
+static inline __attribute__((always_inline)) int
+execute_insn(APEX_CPU *cpu, const APEX_Instruction *ins, int index,
+             int src, int dst, int alu, int mem, int branch, int zero_flag)
+{
+    int a, b, value = 0;
+
+    /* All sources are read before the destination is written */
+    read_operands(cpu, ins, src, mem, &a, &b);
+
+    if (alu == ALU_DIV && b == 0)
+    {
+        return APEX_FUNC_FAULT;
+    }
+    if (alu != ALU_NONE)
+    {
+        value = apex_alu(alu, a, b);
+    }
+    if (mem != MEM_NONE && (unsigned int)value >= DATA_MEMORY_SIZE)
+    {
+        return APEX_FUNC_FAULT;
+    }
+    if (mem == MEM_LOAD)
+    {
+        value = cpu->data_memory[value];
+    }
+    else if (mem == MEM_STORE)
+    {
+        cpu->data_memory[value] = cpu->regs[ins->rs1];
+    }
+
+    if (zero_flag == ZF_RESULT)
+    {
+        cpu->zero_flag = (value == 0) ? TRUE : FALSE;
+    }
+    else if (zero_flag == ZF_COMPARE)
+    {
+        cpu->zero_flag = (cpu->regs[ins->rs1] == cpu->regs[ins->rs2]) ? TRUE : FALSE;
+    }
+
+    if (dst & OPND_RD)
+    {
+        cpu->regs[ins->rd] = value;
+    }
+
+    if ((branch == BR_Z && cpu->zero_flag == TRUE) ||
+        (branch == BR_NZ && cpu->zero_flag == FALSE))
+    {
+        // branch_target is -1 for targets outside the program, the run then stops on the next step.
+        return cpu->branch_target[index] >= 0 ? cpu->branch_target[index] : index + ins->imm / 4;
+    }
+    return index + 1;
+}
+
+/* Longest straight-line block, longer runs are split into chained blocks */
+#define MAX_BLOCK_OPS 1024
+
+/* Native code of a block, returns the micro-ops it completed */
+typedef int (*APEX_Jit_Fn)(APEX_CPU *cpu);
+typedef struct APEX_Jit APEX_Jit;
+
+APEX_Jit *APEX_jit_create(void);
+void APEX_jit_free(APEX_Jit *jit);
+APEX_Jit_Fn APEX_jit_compile(APEX_Jit *jit, const APEX_Instruction *ops, int count);
+void APEX_jit_print_stats(const APEX_Jit *jit);
+
+int APEX_block_run(APEX_CPU *cpu, int *index_io, long max_insns, long *executed_out);
+void APEX_block_cache_print_stats(const APEX_CPU *cpu);
+void APEX_block_cache_free(APEX_CPU *cpu);
+
+#endif
@@ -0,0 +1,346 @@
+/*
+ * apex_interval.c
+ * Contains interval-parallel detailed simulation. A functional pass cuts
+ * the run into intervals of interval_size instructions and keeps the
+ * architectural state at the start of each one, then every interval goes
+ * through the pipeline on its own thread (after interval_warmup
+ * instructions of the previous interval to fill the pipeline) and the
+ * cycles of all the intervals are added up.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_cpu.h"
+#include "apex_func.h"
+#include "apex_macros.h"
+
+/* Architectural state the detailed run of an interval starts from */
+typedef struct Interval_Start
+{
+    int pc;
+    int zero_flag;
+    int regs[REG_FILE_SIZE];
+    int data_memory[DATA_MEMORY_SIZE];
+} Interval_Start;
+
+/* One interval and what its detailed run found */
+typedef struct Interval
+{
+    Interval_Start *start;           /* State 'warmup' instructions before the interval */
+    long warmup;                     /* Instructions of the previous interval simulated first */
+    int64_t insns;                   /* Instructions of the interval */
+    int end_regs[REG_FILE_SIZE];     /* Registers after the interval, from the functional pass */
+    unsigned int end_memory_hash;    /* Data memory after the interval, from the functional pass */
+    int64_t cycles;                  /* Measured cycles, -1 if the detailed run failed */
+    int state_matches;               /* Detailed state after the interval equals the functional one */
+} Interval;
+
+typedef struct Interval_Run
+{
+    const APEX_CPU *master;
+    Interval *intervals;
+    long count;
+    long next; /* Next interval to hand out, taken with an atomic add */
+} Interval_Run;
+
+static unsigned int
+hash_data_memory(const int *data_memory)
+{
+    const unsigned char *p = (const unsigned char *)data_memory;
+    unsigned int hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < DATA_MEMORY_SIZE * sizeof(int); ++i)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static Interval_Start *
+save_interval_start(const APEX_CPU *cpu)
+{
+    Interval_Start *start = malloc(sizeof(Interval_Start));
+
+    if (start)
+    {
+        start->pc = cpu->pc;
+        start->zero_flag = cpu->zero_flag;
+        memcpy(start->regs, cpu->regs, sizeof(start->regs));
+        memcpy(start->data_memory, cpu->data_memory, sizeof(start->data_memory));
+    }
+    return start;
+}
+
+/*
+ * Worker thread, takes intervals until there are none left and simulates
+ * each on a private cpu, the code memory is shared read-only
+ */
+static void *
+run_intervals(void *arg)
+{
+    Interval_Run *run = arg;
+    APEX_CPU *detail = malloc(sizeof(APEX_CPU));
+    long i;
+
+    if (!detail)
+    {
+        return NULL;
+    }
+    while ((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->count)
+    {
+        Interval *interval = &run->intervals[i];
+
+        APEX_cpu_start_detailed(detail, run->master);
+        detail->pc = interval->start->pc;
+        detail->zero_flag = interval->start->zero_flag;
+        memcpy(detail->regs, interval->start->regs, sizeof(detail->regs));
+        memcpy(detail->data_memory, interval->start->data_memory, sizeof(detail->data_memory));
+
+        interval->cycles = APEX_cpu_measure_window(detail, interval->warmup, interval->insns);
+        /* Registers and memory are only written in writeback, so they match
+         * the functional state as soon as the last instruction retired */
+        interval->state_matches = interval->cycles >= 0 &&
+                                  memcmp(detail->regs, interval->end_regs, sizeof(detail->regs)) == 0 &&
+                                  hash_data_memory(detail->data_memory) == interval->end_memory_hash;
+    }
+    free(detail);
+    return NULL;
+}
+
+/* Grows the interval array by one, NULL when out of memory */
+static Interval *
+add_interval(Interval **intervals, long *count, long *capacity)
+{
+    if (*count == *capacity)
+    {
+        long grown_capacity = *capacity ? *capacity * 2 : 64;
+        Interval *grown = realloc(*intervals, grown_capacity * sizeof(Interval));
+
+        if (!grown)
+        {
+            return NULL;
+        }
+        *intervals = grown;
+        *capacity = grown_capacity;
+    }
+    memset(&(*intervals)[*count], 0, sizeof(Interval));
+    return &(*intervals)[(*count)++];
+}
+
+/*
+ * Functional pass, cuts the run into intervals of 'size' instructions and
+ * saves the state every interval's detailed run starts from, 'warmup'
+ * instructions before it. Returns the number of intervals (their array in
+ * *intervals_out) and leaves the cpu in its final functional state.
+ */
+static long
+cut_into_intervals(APEX_CPU *cpu, long max_insns, long size, long warmup, Interval **intervals_out,
+                   int *status_out)
+{
+    Interval *intervals = NULL;
+    Interval *interval;
+    long count = 0, capacity = 0;
+    int64_t base = cpu->insn_completed;
+    int status = APEX_FUNC_LIMIT;
+
+    interval = add_interval(&intervals, &count, &capacity);
+    if (!interval || !(interval->start = save_interval_start(cpu)))
+    {
+        free(intervals);
+        return -1;
+    }
+
+    for (;;)
+    {
+        long begin = cpu->insn_completed - base;
+        long end = begin + size;
+        Interval_Start *next_start = NULL;
+
+        if (max_insns > 0 && end > max_insns)
+        {
+            end = max_insns;
+        }
+
+        /* The next interval's warm-up starts 'warmup' instructions before the end,
+         * a limit of 0 would run to HALT so a short last interval is run whole */
+        if (warmup > 0 && end - begin > warmup)
+        {
+            status = APEX_cpu_run_functional(cpu, end - begin - warmup);
+            if (status == APEX_FUNC_LIMIT)
+            {
+                next_start = save_interval_start(cpu);
+                status = APEX_cpu_run_functional(cpu, warmup);
+            }
+        }
+        else
+        {
+            status = APEX_cpu_run_functional(cpu, end - begin);
+        }
+
+        interval = &intervals[count - 1];
+        interval->insns = cpu->insn_completed - base - begin;
+        memcpy(interval->end_regs, cpu->regs, sizeof(interval->end_regs));
+        interval->end_memory_hash = hash_data_memory(cpu->data_memory);
+
+        if (status != APEX_FUNC_LIMIT || (max_insns > 0 && cpu->insn_completed - base >= max_insns))
+        {
+            free(next_start);
+            break;
+        }
+        if (!next_start && !(next_start = save_interval_start(cpu)))
+        {
+            status = APEX_FUNC_ERROR;
+            break;
+        }
+        interval = add_interval(&intervals, &count, &capacity);
+        if (!interval)
+        {
+            free(next_start);
+            status = APEX_FUNC_ERROR;
+            break;
+        }
+        interval->start = next_start;
+        interval->warmup = warmup;
+    }
+
+    *intervals_out = intervals;
+    *status_out = status;
+    return count;
+}
+
+static double
+elapsed_seconds(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Detailed simulation of the program from the current state, up to
+ * max_insns instructions (0 until HALT), split into intervals that are
+ * simulated in parallel. The cpu ends in the final functional state.
+ * Returns the APEX_FUNC_* status of the functional pass.
+ */
+int
+APEX_cpu_run_intervals(APEX_CPU *cpu, long max_insns)
+{
+    const long size = cpu->config.interval_size;
+    const long warmup = cpu->config.interval_warmup < size ? cpu->config.interval_warmup : size - 1;
+    int threads = APEX_config_resolve_threads(cpu->config.interval_threads);
+    Interval_Run run;
+    Interval *intervals;
+    pthread_t *workers;
+    struct timespec start;
+    double functional_time;
+    int64_t total_cycles = 0, total_insns = 0;
+    long failed = 0, mismatched = 0;
+    double min_cpi = 0, max_cpi = 0;
+    long count, i;
+    int status;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    count = cut_into_intervals(cpu, max_insns, size, warmup, &intervals, &status);
+    if (count < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the intervals\n");
+        return APEX_FUNC_ERROR;
+    }
+    functional_time = elapsed_seconds(&start);
+
+    if (threads > count)
+    {
+        threads = count;
+    }
+    run.master = cpu;
+    run.intervals = intervals;
+    run.count = count;
+    run.next = 0;
+    workers = malloc(threads * sizeof(pthread_t));
+    for (i = 0; workers && i < threads; ++i)
+    {
+        if (pthread_create(&workers[i], NULL, run_intervals, &run) != 0)
+        {
+            break;
+        }
+    }
+    /* Whatever could not be handed to a thread runs here */
+    if (!workers || i == 0)
+    {
+        run_intervals(&run);
+    }
+    threads = workers ? i : 0;
+    for (i = 0; i < threads; ++i)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    /* Stitch the intervals together */
+    for (i = 0; i < count; ++i)
+    {
+        const Interval *interval = &intervals[i];
+        double cpi;
+
+        total_insns += interval->insns;
+        if (interval->cycles < 0)
+        {
+            failed++;
+            continue;
+        }
+        total_cycles += interval->cycles;
+        mismatched += !interval->state_matches;
+        cpi = interval->insns ? (double)interval->cycles / interval->insns : 0;
+        /* Every interval before this one failed when i == failed, this is the first measured */
+        if (i == failed || cpi < min_cpi)
+        {
+            min_cpi = cpi;
+        }
+        if (i == failed || cpi > max_cpi)
+        {
+            max_cpi = cpi;
+        }
+        if (count <= 16)
+        {
+            printf("APEX_INTERVAL: #%ld insns = %" PRId64 ", warmup = %ld, cycles = %" PRId64 ", CPI = %.4f%s\n", i,
+                   interval->insns, interval->warmup, interval->cycles, cpi,
+                   interval->state_matches ? "" : " (state differs from the functional pass)");
+        }
+    }
+
+    printf("APEX_INTERVAL: %ld intervals of %ld instructions, warmup = %ld, %d threads\n", count, size, warmup,
+           threads ? threads : 1);
+    printf("APEX_INTERVAL: functional pass %.3f s, detailed %.3f s\n", functional_time,
+           elapsed_seconds(&start) - functional_time);
+    if (failed)
+    {
+        printf("APEX_INTERVAL: %ld intervals did not complete in the pipeline\n", failed);
+    }
+    if (mismatched)
+    {
+        printf("APEX_INTERVAL: %ld intervals ended in a different state than the functional pass\n", mismatched);
+    }
+    if (failed < count)
+    {
+        printf("APEX_INTERVAL: CPI per interval %.4f .. %.4f\n", min_cpi, max_cpi);
+    }
+    printf("APEX_CPU: Simulation %s, cycles = %" PRId64 " instructions = %" PRId64 "\n",
+           status == APEX_FUNC_HALTED ? "Complete" : "Stopped", total_cycles, total_insns);
+
+    for (i = 0; i < count; ++i)
+    {
+        free(intervals[i].start);
+    }
+    free(intervals);
+    return status;
+}
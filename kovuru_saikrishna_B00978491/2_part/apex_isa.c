@@ -0,0 +1,110 @@
+/*
+ * apex_isa.c
+ * Contains the APEX instruction set table and mnemonic lookup
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "apex_isa.h"
+
+#define APEX_ISA_INFO(name, mnem, opc, fmt, src, dst, fu, alu, mem, br, zf) \
+  [opc] = {mnem, fmt, src, dst, fu, alu, mem, br, zf},
+
+const APEX_Opcode_Info apex_isa[APEX_OPCODE_LIMIT] = {
+    APEX_ISA_TABLE(APEX_ISA_INFO)};
+
+#undef APEX_ISA_INFO
+
+const unsigned char apex_isa_format_fields[FMT_COUNT][4] = {
+    [FMT_NONE] = {0},
+    [FMT_RRR] = {OPND_RD, OPND_RS1, OPND_RS2, 0},
+    [FMT_RI] = {OPND_RD, OPND_IMM, 0},
+    [FMT_RRI] = {OPND_RD, OPND_RS1, OPND_IMM, 0},
+    [FMT_SRRI] = {OPND_RS1, OPND_RS2, OPND_IMM, 0},
+    [FMT_SRRR] = {OPND_RS1, OPND_RS2, OPND_RS3, 0},
+    [FMT_RR] = {OPND_RS1, OPND_RS2, 0},
+    [FMT_I] = {OPND_IMM, 0},
+};
+
+/*
+ * Mnemonic hash, (5 * s[0] + s[1] + s[len - 1]) mod 64 is collision free
+ * for the current mnemonics. The slot table is built from apex_isa[] once,
+ * a new mnemonic that collides trips the assert in build_mnemonic_slots.
+ */
+#define MNEMONIC_SLOTS 64
+
+static signed char mnemonic_slots[MNEMONIC_SLOTS];
+static pthread_once_t mnemonic_slots_once = PTHREAD_ONCE_INIT;
+
+static unsigned int
+hash_mnemonic(const char *s, int len)
+{
+    return (5u * (unsigned char)s[0] + (unsigned char)s[1] +
+            (unsigned char)s[len - 1]) &
+           (MNEMONIC_SLOTS - 1);
+}
+
+static void
+build_mnemonic_slots(void)
+{
+    int opcode;
+
+    memset(mnemonic_slots, -1, sizeof(mnemonic_slots));
+    for (opcode = 0; opcode < APEX_OPCODE_LIMIT; ++opcode)
+    {
+        const char *mnemonic = apex_isa[opcode].mnemonic;
+        unsigned int slot;
+
+        if (!mnemonic)
+        {
+            continue;
+        }
+        slot = hash_mnemonic(mnemonic, strlen(mnemonic));
+        assert(mnemonic_slots[slot] == -1 && "mnemonic hash collision, adjust hash_mnemonic");
+        mnemonic_slots[slot] = opcode;
+    }
+}
+
+/*
+ * Returns the opcode of a mnemonic of the given length (the string does not
+ * need to be NUL terminated), or -1 if it is not an APEX instruction
+ */
+int
+apex_isa_lookup(const char *mnemonic, int len)
+{
+    int opcode;
+
+    pthread_once(&mnemonic_slots_once, build_mnemonic_slots);
+
+    if (len < 2)
+    {
+        return -1;
+    }
+
+    opcode = mnemonic_slots[hash_mnemonic(mnemonic, len)];
+    if (opcode < 0 || strncmp(apex_isa[opcode].mnemonic, mnemonic, len) != 0 ||
+        apex_isa[opcode].mnemonic[len] != '\0')
+    {
+        return -1;
+    }
+    return opcode;
+}
+
+/*
+ * Returns the mnemonic of a numeric opcode, code memory only keeps the
+ * numeric opcode so the string is rebuilt here when printing
+ */
+const char *
+get_opcode_str(int opcode)
+{
+    if (opcode < 0 || opcode >= APEX_OPCODE_LIMIT || !apex_isa[opcode].mnemonic)
+    {
+        return "???";
+    }
+    return apex_isa[opcode].mnemonic;
+}
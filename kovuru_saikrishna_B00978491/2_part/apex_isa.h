@@ -0,0 +1,176 @@
+/*
+ * apex_isa.h
+ * Contains the APEX instruction set table, every stage of the simulator
+ * (parser, printer, decode, execute and writeback) reads its per-opcode
+ * knowledge from here
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_ISA_H_
+#define _APEX_ISA_H_
+
+/* Operand formats, the order of the fields is the order in the assembly text */
+enum
+{
+  FMT_NONE, /* HALT                */
+  FMT_RRR,  /* ADD R1,R2,R3        */
+  FMT_RI,   /* MOVC R1,#5          */
+  FMT_RRI,  /* LOAD R1,R2,#5       */
+  FMT_SRRI, /* STORE R1,R2,#5      */
+  FMT_SRRR, /* STR R1,R2,R3        */
+  FMT_RR,   /* CMP R1,R2           */
+  FMT_I,    /* BZ #-8              */
+  FMT_COUNT
+};
+
+/* Operand fields, also used as bits of the source / destination masks */
+#define OPND_RD 0x1
+#define OPND_RS1 0x2
+#define OPND_RS2 0x4
+#define OPND_RS3 0x8
+#define OPND_IMM 0x10
+
+/* Functional unit class an instruction is issued to from decode */
+enum
+{
+  FU_INT,
+  FU_MUL,
+  FU_DIV,
+  FU_MEM,
+  FU_COUNT
+};
+
+/* Operation performed on the two operand values in the functional unit */
+enum
+{
+  ALU_NONE,
+  ALU_ADD,
+  ALU_SUB,
+  ALU_MUL,
+  ALU_DIV,
+  ALU_AND,
+  ALU_OR,
+  ALU_XOR,
+  ALU_MOV /* result is the second operand (the immediate for MOVC) */
+};
+
+/* Data memory access */
+enum
+{
+  MEM_NONE,
+  MEM_LOAD,
+  MEM_STORE
+};
+
+/* Control transfer */
+enum
+{
+  BR_NONE,
+  BR_Z,  /* taken when the zero flag is set */
+  BR_NZ, /* taken when the zero flag is clear */
+  BR_HALT
+};
+
+/* How the instruction updates the zero flag */
+enum
+{
+  ZF_NONE,
+  ZF_RESULT, /* zero flag = (result == 0) */
+  ZF_COMPARE /* zero flag = (rs1 == rs2) */
+};
+
+/*
+ * The instruction set.
+ *
+ * X(name, mnemonic, opcode, format, src mask, dest mask, FU, ALU op,
+ *   memory access, branch, zero flag)
+ *
+ * Adding an instruction only needs a new line here plus its semantics if it
+ * needs a new ALU op. XOR is spelled EXOR in assembly as in the spec.
+ */
+#define APEX_ISA_TABLE(X)                                                                                        \
+  X(ADD, "ADD", 0x0, FMT_RRR, OPND_RS1 | OPND_RS2, OPND_RD, FU_INT, ALU_ADD, MEM_NONE, BR_NONE, ZF_RESULT)       \
+  X(SUB, "SUB", 0x1, FMT_RRR, OPND_RS1 | OPND_RS2, OPND_RD, FU_INT, ALU_SUB, MEM_NONE, BR_NONE, ZF_RESULT)       \
+  X(MUL, "MUL", 0x2, FMT_RRR, OPND_RS1 | OPND_RS2, OPND_RD, FU_MUL, ALU_MUL, MEM_NONE, BR_NONE, ZF_RESULT)       \
+  X(DIV, "DIV", 0x3, FMT_RRR, OPND_RS1 | OPND_RS2, OPND_RD, FU_DIV, ALU_DIV, MEM_NONE, BR_NONE, ZF_RESULT)       \
+  X(AND, "AND", 0x4, FMT_RRR, OPND_RS1 | OPND_RS2, OPND_RD, FU_INT, ALU_AND, MEM_NONE, BR_NONE, ZF_RESULT)       \
+  X(OR, "OR", 0x5, FMT_RRR, OPND_RS1 | OPND_RS2, OPND_RD, FU_INT, ALU_OR, MEM_NONE, BR_NONE, ZF_RESULT)          \
+  X(XOR, "EXOR", 0x6, FMT_RRR, OPND_RS1 | OPND_RS2, OPND_RD, FU_INT, ALU_XOR, MEM_NONE, BR_NONE, ZF_RESULT)      \
+  X(MOVC, "MOVC", 0x7, FMT_RI, 0, OPND_RD, FU_INT, ALU_MOV, MEM_NONE, BR_NONE, ZF_RESULT)                        \
+  X(LOAD, "LOAD", 0x8, FMT_RRI, OPND_RS1, OPND_RD, FU_MEM, ALU_ADD, MEM_LOAD, BR_NONE, ZF_NONE)                  \
+  X(STORE, "STORE", 0x9, FMT_SRRI, OPND_RS1 | OPND_RS2, 0, FU_MEM, ALU_ADD, MEM_STORE, BR_NONE, ZF_NONE)         \
+  X(BZ, "BZ", 0xa, FMT_I, 0, 0, FU_INT, ALU_NONE, MEM_NONE, BR_Z, ZF_NONE)                                       \
+  X(BNZ, "BNZ", 0xb, FMT_I, 0, 0, FU_INT, ALU_NONE, MEM_NONE, BR_NZ, ZF_NONE)                                    \
+  X(HALT, "HALT", 0xc, FMT_NONE, 0, 0, FU_INT, ALU_NONE, MEM_NONE, BR_HALT, ZF_NONE)                             \
+  X(ADDL, "ADDL", 0x10, FMT_RRI, OPND_RS1, OPND_RD, FU_INT, ALU_ADD, MEM_NONE, BR_NONE, ZF_RESULT)               \
+  X(SUBL, "SUBL", 0x11, FMT_RRI, OPND_RS1, OPND_RD, FU_INT, ALU_SUB, MEM_NONE, BR_NONE, ZF_RESULT)               \
+  X(LDR, "LDR", 0x12, FMT_RRR, OPND_RS1 | OPND_RS2, OPND_RD, FU_MEM, ALU_ADD, MEM_LOAD, BR_NONE, ZF_NONE)        \
+  X(STR, "STR", 0x13, FMT_SRRR, OPND_RS1 | OPND_RS2 | OPND_RS3, 0, FU_MEM, ALU_ADD, MEM_STORE, BR_NONE, ZF_NONE) \
+  X(CMP, "CMP", 0x14, FMT_RR, OPND_RS1 | OPND_RS2, 0, FU_INT, ALU_NONE, MEM_NONE, BR_NONE, ZF_COMPARE)           \
+  X(NOP, "NOP", 0x15, FMT_NONE, 0, 0, FU_INT, ALU_NONE, MEM_NONE, BR_NONE, ZF_NONE)
+
+/* Numeric OPCODE identifiers for instructions */
+#define APEX_ISA_OPCODE(name, mnem, opc, ...) OPCODE_##name = opc,
+enum
+{
+  APEX_ISA_TABLE(APEX_ISA_OPCODE)
+      APEX_OPCODE_LIMIT /* one past the largest opcode value */
+};
+#undef APEX_ISA_OPCODE
+
+/* Decoded view of one line of the table */
+typedef struct APEX_Opcode_Info
+{
+  const char *mnemonic;
+  unsigned char format;
+  unsigned char src;
+  unsigned char dst;
+  unsigned char fu;
+  unsigned char alu;
+  unsigned char mem;
+  unsigned char branch;
+  unsigned char zero_flag;
+} APEX_Opcode_Info;
+
+/* Indexed by opcode, holes between opcode values have a NULL mnemonic */
+extern const APEX_Opcode_Info apex_isa[APEX_OPCODE_LIMIT];
+
+/* Operand fields of every format, in assembly order, terminated by 0 */
+extern const unsigned char apex_isa_format_fields[FMT_COUNT][4];
+
+/*
+ * Performs the ALU operation of the ISA table on two operand values. A DIV
+ * by zero has no result, the callers stop the program before it gets here.
+ */
+static inline int
+apex_alu(int alu, int a, int b)
+{
+  switch (alu)
+  {
+  case ALU_ADD:
+    return a + b;
+  case ALU_SUB:
+    return a - b;
+  case ALU_MUL:
+    return a * b;
+  case ALU_DIV:
+    /* INT_MIN / -1 wraps around like the other operations instead of trapping */
+    return b == -1 ? (int)(0u - (unsigned int)a) : a / b;
+  case ALU_AND:
+    return a & b;
+  case ALU_OR:
+    return a | b;
+  case ALU_XOR:
+    return a ^ b;
+  case ALU_MOV:
+    return b;
+  }
+  return 0;
+}
+
+int apex_isa_lookup(const char *mnemonic, int len);
+const char *get_opcode_str(int opcode);
+
+#endif
@@ -0,0 +1,622 @@
+/*
+ * apex_jit.c
+ * Contains the x86-64 back end of the block cache. A hot basic block is
+ * compiled into native code in an mmap'd buffer, the most used APEX
+ * registers of the block live in host registers while it runs and every
+ * data memory access is bounds checked. Anything the native code cannot do
+ * (an out of range address, a divisor of 0 or -1) makes it return early and
+ * the interpreter carries on from that instruction, which stops the run
+ * with APEX_FUNC_ERROR when the instruction faults.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_func.h"
+#include "apex_macros.h"
+
+#if APEX_HAVE_JIT
+#include <sys/mman.h>
+
+/* Size of the executable buffer, blocks that do not fit stay interpreted */
+#define JIT_BUFFER_SIZE (16 << 20)
+
+/* Upper bound of the native code of one micro-op, including its bail stub */
+#define JIT_MAX_OP_BYTES 96
+
+/* Host registers, numbered as in the instruction encoding */
+enum
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+/*
+ * rdi holds the APEX_CPU pointer, rax/rcx/rdx are scratch (rdx for idiv),
+ * r11 holds the zero flag, the rest cache APEX registers
+ */
+static const unsigned char cache_pool[] = {RSI, R8, R9, R10, RBX, RBP, R12, R13, R14, R15};
+#define CACHE_POOL_SIZE ((int)sizeof(cache_pool))
+#define ZF_REG R11
+
+static int
+is_callee_saved(int reg)
+{
+    return reg == RBX || reg == RBP || reg >= R12;
+}
+
+struct APEX_Jit
+{
+    unsigned char *buffer; /* RX while running, RW while a block is emitted */
+    size_t used;
+    long blocks;           /* Blocks compiled */
+};
+
+/* Emit state of one block */
+typedef struct Jit_Emit
+{
+    unsigned char *p;
+    signed char host[REG_FILE_SIZE]; /* Host register caching each APEX register, -1 if none */
+    int dirty[REG_FILE_SIZE];        /* APEX register written by the block */
+    int writes_zf;
+    struct
+    {
+        unsigned char *rel; /* rel32 field of the jump to patch */
+        int op;             /* Micro-ops completed when the bail is taken */
+    } bails[MAX_BLOCK_OPS];
+    int bail_count;
+} Jit_Emit;
+
+static void
+emit_byte(Jit_Emit *e, int b)
+{
+    *e->p++ = (unsigned char)b;
+}
+
+static void
+emit_u32(Jit_Emit *e, unsigned int v)
+{
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+/* REX prefix for a 32-bit operation, only emitted when an extended register is used */
+static void
+emit_rex(Jit_Emit *e, int reg, int rm)
+{
+    if (reg >= 8 || rm >= 8)
+    {
+        emit_byte(e, 0x40 | ((reg >> 3) << 2) | (rm >> 3));
+    }
+}
+
+/* op r/m32, r32 (or op r32, r/m32) between two host registers */
+static void
+emit_rr(Jit_Emit *e, int opcode, int reg, int rm)
+{
+    emit_rex(e, reg, rm);
+    if (opcode > 0xff)
+    {
+        emit_byte(e, opcode >> 8);
+    }
+    emit_byte(e, opcode & 0xff);
+    emit_byte(e, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* op between a host register and [rdi + disp32] */
+static void
+emit_rm_cpu(Jit_Emit *e, int opcode, int reg, int disp)
+{
+    emit_rex(e, reg, 0);
+    if (opcode > 0xff)
+    {
+        emit_byte(e, opcode >> 8);
+    }
+    emit_byte(e, opcode & 0xff);
+    emit_byte(e, 0x80 | ((reg & 7) << 3) | RDI);
+    emit_u32(e, disp);
+}
+
+static int
+reg_offset(int r)
+{
+    return offsetof(APEX_CPU, regs) + r * sizeof(int);
+}
+
+/* host = APEX register r */
+static void
+emit_load_reg(Jit_Emit *e, int host, int r)
+{
+    if (e->host[r] >= 0)
+    {
+        emit_rr(e, 0x89, e->host[r], host);
+    }
+    else
+    {
+        emit_rm_cpu(e, 0x8b, host, reg_offset(r));
+    }
+}
+
+/* APEX register r = eax */
+static void
+emit_store_eax(Jit_Emit *e, int r)
+{
+    if (e->host[r] >= 0)
+    {
+        emit_rr(e, 0x89, RAX, e->host[r]);
+    }
+    else
+    {
+        emit_rm_cpu(e, 0x89, RAX, reg_offset(r));
+    }
+    e->dirty[r] = TRUE;
+}
+
+static void
+emit_mov_imm(Jit_Emit *e, int host, int imm)
+{
+    emit_rex(e, 0, host);
+    emit_byte(e, 0xb8 + (host & 7));
+    emit_u32(e, imm);
+}
+
+/* eax = eax <alu> operand, where the operand is an APEX register or an immediate */
+static void
+emit_alu_eax(Jit_Emit *e, int alu, int is_reg, int operand)
+{
+    /* op r/m32,r32 ; op r32,r/m32 ; op eax,imm32 */
+    static const int ops[][3] = {
+        [ALU_ADD] = {0x01, 0x03, 0x05},
+        [ALU_SUB] = {0x29, 0x2b, 0x2d},
+        [ALU_AND] = {0x21, 0x23, 0x25},
+        [ALU_OR] = {0x09, 0x0b, 0x0d},
+        [ALU_XOR] = {0x31, 0x33, 0x35},
+    };
+
+    if (alu == ALU_MUL)
+    {
+        if (!is_reg)
+        {
+            emit_byte(e, 0x69); /* imul eax, eax, imm32 */
+            emit_byte(e, 0xc0);
+            emit_u32(e, operand);
+        }
+        else if (e->host[operand] >= 0)
+        {
+            emit_rr(e, 0x0faf, RAX, e->host[operand]);
+        }
+        else
+        {
+            emit_rm_cpu(e, 0x0faf, RAX, reg_offset(operand));
+        }
+        return;
+    }
+
+    if (!is_reg)
+    {
+        emit_byte(e, ops[alu][2]);
+        emit_u32(e, operand);
+    }
+    else if (e->host[operand] >= 0)
+    {
+        emit_rr(e, ops[alu][0], e->host[operand], RAX);
+    }
+    else
+    {
+        emit_rm_cpu(e, ops[alu][1], RAX, reg_offset(operand));
+    }
+}
+
+/* Conditional jump (0x0f 0x80 + cc) to the bail stub of micro-op 'op' */
+static void
+emit_bail_if(Jit_Emit *e, int cc, int op)
+{
+    emit_byte(e, 0x0f);
+    emit_byte(e, 0x80 + cc);
+    e->bails[e->bail_count].rel = e->p;
+    e->bails[e->bail_count].op = op;
+    e->bail_count++;
+    emit_u32(e, 0);
+}
+
+#define CC_E 0x4
+#define CC_AE 0x3
+#define CC_BE 0x6
+
+/* r11 = (eax == 0) */
+static void
+emit_set_zf_result(Jit_Emit *e)
+{
+    emit_rr(e, 0x31, ZF_REG, ZF_REG); /* xor r11d, r11d */
+    emit_rr(e, 0x85, RAX, RAX);       /* test eax, eax */
+    emit_byte(e, 0x41);               /* sete r11b */
+    emit_byte(e, 0x0f);
+    emit_byte(e, 0x94);
+    emit_byte(e, 0xc0 | (ZF_REG & 7));
+    e->writes_zf = TRUE;
+}
+
+/* Bounds check of the address in eax, then leaves rax ready as the index */
+static void
+emit_check_address(Jit_Emit *e, int op)
+{
+    emit_byte(e, 0x3d); /* cmp eax, DATA_MEMORY_SIZE */
+    emit_u32(e, DATA_MEMORY_SIZE);
+    emit_bail_if(e, CC_AE, op);
+}
+
+/*
+ * Emits one micro-op, mirroring execute_insn, returns FALSE for opcodes
+ * the back end does not know
+ */
+static int
+emit_op(Jit_Emit *e, const APEX_Instruction *ins, int op)
+{
+    const APEX_Opcode_Info *info;
+    int b_is_reg, b;
+
+    if (ins->opcode >= APEX_OPCODE_LIMIT || !apex_isa[ins->opcode].mnemonic)
+    {
+        return FALSE;
+    }
+    info = &apex_isa[ins->opcode];
+
+    /* eax = first operand, second operand is a register or the immediate */
+    if (info->mem == MEM_STORE)
+    {
+        emit_load_reg(e, RAX, ins->rs2);
+        b_is_reg = (info->src & OPND_RS3) != 0;
+        b = b_is_reg ? ins->rs3 : ins->imm;
+    }
+    else
+    {
+        if (info->src & OPND_RS1)
+        {
+            emit_load_reg(e, RAX, ins->rs1);
+        }
+        else
+        {
+            emit_rr(e, 0x31, RAX, RAX);
+        }
+        b_is_reg = (info->src & OPND_RS2) != 0;
+        b = b_is_reg ? ins->rs2 : ins->imm;
+    }
+
+    switch (info->alu)
+    {
+    case ALU_NONE:
+        break;
+    case ALU_MOV:
+        if (b_is_reg)
+        {
+            emit_load_reg(e, RAX, b);
+        }
+        else
+        {
+            emit_mov_imm(e, RAX, b);
+        }
+        break;
+    case ALU_DIV:
+        if (b_is_reg)
+        {
+            emit_load_reg(e, RCX, b);
+        }
+        else
+        {
+            emit_mov_imm(e, RCX, b);
+        }
+        /* idiv traps on 0 and on INT_MIN / -1, the interpreter does both */
+        emit_byte(e, 0x8d); /* lea edx, [rcx + 1] */
+        emit_byte(e, 0x51);
+        emit_byte(e, 0x01);
+        emit_byte(e, 0x83); /* cmp edx, 1 */
+        emit_byte(e, 0xfa);
+        emit_byte(e, 0x01);
+        emit_bail_if(e, CC_BE, op);
+        emit_byte(e, 0x99); /* cdq */
+        emit_byte(e, 0xf7); /* idiv ecx */
+        emit_byte(e, 0xf9);
+        break;
+    default:
+        emit_alu_eax(e, info->alu, b_is_reg, b);
+        break;
+    }
+
+    if (info->mem == MEM_LOAD)
+    {
+        emit_check_address(e, op);
+        emit_byte(e, 0x8b); /* mov eax, [rdi + rax*4 + data_memory] */
+        emit_byte(e, 0x84);
+        emit_byte(e, 0x87);
+        emit_u32(e, offsetof(APEX_CPU, data_memory));
+    }
+    else if (info->mem == MEM_STORE)
+    {
+        emit_check_address(e, op);
+        emit_load_reg(e, RCX, ins->rs1);
+        emit_byte(e, 0x89); /* mov [rdi + rax*4 + data_memory], ecx */
+        emit_byte(e, 0x8c);
+        emit_byte(e, 0x87);
+        emit_u32(e, offsetof(APEX_CPU, data_memory));
+    }
+
+    if (info->zero_flag == ZF_RESULT)
+    {
+        emit_set_zf_result(e);
+    }
+    else if (info->zero_flag == ZF_COMPARE)
+    {
+        emit_rr(e, 0x31, ZF_REG, ZF_REG);
+        emit_load_reg(e, RAX, ins->rs1);
+        if (e->host[ins->rs2] >= 0)
+        {
+            emit_rr(e, 0x39, e->host[ins->rs2], RAX); /* cmp eax, reg */
+        }
+        else
+        {
+            emit_rm_cpu(e, 0x3b, RAX, reg_offset(ins->rs2));
+        }
+        emit_byte(e, 0x41);
+        emit_byte(e, 0x0f);
+        emit_byte(e, 0x94);
+        emit_byte(e, 0xc0 | (ZF_REG & 7));
+        e->writes_zf = TRUE;
+    }
+
+    if (info->dst & OPND_RD)
+    {
+        emit_store_eax(e, ins->rd);
+    }
+    return TRUE;
+}
+
+/*
+ * Gives the APEX registers used most by the block a host register each
+ */
+static void
+allocate_registers(Jit_Emit *e, const APEX_Instruction *ops, int count)
+{
+    int uses[REG_FILE_SIZE] = {0};
+    int i, n;
+
+    for (i = 0; i < count; ++i)
+    {
+        const APEX_Opcode_Info *info = &apex_isa[ops[i].opcode];
+        int fields = info->src | info->dst;
+
+        uses[ops[i].rd] += (fields & OPND_RD) != 0;
+        uses[ops[i].rs1] += (fields & OPND_RS1) != 0;
+        uses[ops[i].rs2] += (fields & OPND_RS2) != 0;
+        uses[ops[i].rs3] += (fields & OPND_RS3) != 0;
+    }
+
+    memset(e->host, -1, sizeof(e->host));
+    for (n = 0; n < CACHE_POOL_SIZE; ++n)
+    {
+        int best = -1;
+
+        for (i = 0; i < REG_FILE_SIZE; ++i)
+        {
+            if (e->host[i] < 0 && uses[i] > 0 && (best < 0 || uses[i] > uses[best]))
+            {
+                best = i;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        e->host[best] = cache_pool[n];
+    }
+}
+
+APEX_Jit *
+APEX_jit_create(void)
+{
+    APEX_Jit *jit = calloc(1, sizeof(APEX_Jit));
+    void *buffer;
+
+    if (!jit)
+    {
+        return NULL;
+    }
+    buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+    {
+        free(jit);
+        return NULL;
+    }
+    jit->buffer = buffer;
+    return jit;
+}
+
+void
+APEX_jit_free(APEX_Jit *jit)
+{
+    if (jit)
+    {
+        munmap(jit->buffer, JIT_BUFFER_SIZE);
+        free(jit);
+    }
+}
+
+/*
+ * Compiles 'count' straight-line micro-ops (no branches) into a native
+ * function. It returns the number of micro-ops it completed, which is less
+ * than 'count' when it bailed out. NULL if the block cannot be compiled.
+ */
+APEX_Jit_Fn
+APEX_jit_compile(APEX_Jit *jit, const APEX_Instruction *ops, int count)
+{
+    Jit_Emit *e;
+    unsigned char *start;
+    unsigned char *exit_label;
+    int saved[CACHE_POOL_SIZE];
+    int saved_count = 0;
+    int i;
+
+    if (!jit || count <= 0 || count > MAX_BLOCK_OPS ||
+        jit->used + (size_t)(count + 4) * JIT_MAX_OP_BYTES + 256 > JIT_BUFFER_SIZE)
+    {
+        return NULL;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        if (ops[i].opcode >= APEX_OPCODE_LIMIT || !apex_isa[ops[i].opcode].mnemonic ||
+            apex_isa[ops[i].opcode].branch != BR_NONE || ops[i].rd >= REG_FILE_SIZE ||
+            ops[i].rs1 >= REG_FILE_SIZE || ops[i].rs2 >= REG_FILE_SIZE || ops[i].rs3 >= REG_FILE_SIZE)
+        {
+            return NULL;
+        }
+    }
+
+    e = calloc(1, sizeof(Jit_Emit));
+    if (!e)
+    {
+        return NULL;
+    }
+    if (mprotect(jit->buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        free(e);
+        return NULL;
+    }
+
+    start = jit->buffer + jit->used;
+    e->p = start;
+    allocate_registers(e, ops, count);
+
+    /* Prologue, save the callee-saved registers in use, load the cached ones */
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (e->host[i] >= 0 && is_callee_saved(e->host[i]))
+        {
+            saved[saved_count++] = e->host[i];
+            emit_rex(e, 0, e->host[i]);
+            emit_byte(e, 0x50 + (e->host[i] & 7)); /* push */
+        }
+    }
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (e->host[i] >= 0)
+        {
+            emit_rm_cpu(e, 0x8b, e->host[i], reg_offset(i));
+        }
+    }
+    emit_rm_cpu(e, 0x8b, ZF_REG, offsetof(APEX_CPU, zero_flag));
+
+    for (i = 0; i < count; ++i)
+    {
+        emit_op(e, &ops[i], i);
+    }
+    emit_mov_imm(e, RDX, count);
+    emit_byte(e, 0xe9); /* jmp exit */
+    {
+        unsigned char *rel = e->p;
+
+        emit_u32(e, 0);
+
+        /* Bail stubs, rdx = micro-ops completed */
+        for (i = 0; i < e->bail_count; ++i)
+        {
+            int disp = e->p - (e->bails[i].rel + 4);
+
+            memcpy(e->bails[i].rel, &disp, 4);
+            emit_mov_imm(e, RDX, e->bails[i].op);
+            emit_byte(e, 0xe9);
+            e->bails[i].rel = e->p;
+            emit_u32(e, 0);
+        }
+
+        exit_label = e->p;
+        {
+            int disp = exit_label - (rel + 4);
+
+            memcpy(rel, &disp, 4);
+        }
+        for (i = 0; i < e->bail_count; ++i)
+        {
+            int disp = exit_label - (e->bails[i].rel + 4);
+
+            memcpy(e->bails[i].rel, &disp, 4);
+        }
+    }
+
+    /* Epilogue, write back what the block changed */
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (e->host[i] >= 0 && e->dirty[i])
+        {
+            emit_rm_cpu(e, 0x89, e->host[i], reg_offset(i));
+        }
+    }
+    if (e->writes_zf)
+    {
+        emit_rm_cpu(e, 0x89, ZF_REG, offsetof(APEX_CPU, zero_flag));
+    }
+    emit_rr(e, 0x89, RDX, RAX); /* mov eax, edx */
+    while (saved_count > 0)
+    {
+        int reg = saved[--saved_count];
+
+        emit_rex(e, 0, reg);
+        emit_byte(e, 0x58 + (reg & 7)); /* pop */
+    }
+    emit_byte(e, 0xc3);
+
+    jit->used += e->p - start;
+    jit->used = (jit->used + 15) & ~(size_t)15;
+    jit->blocks++;
+    free(e);
+
+    mprotect(jit->buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+    __builtin___clear_cache((char *)start, (char *)jit->buffer + jit->used);
+    return (APEX_Jit_Fn)(void *)start;
+}
+
+void
+APEX_jit_print_stats(const APEX_Jit *jit)
+{
+    if (jit)
+    {
+        printf("APEX_JIT: blocks compiled = %ld, native code = %zu bytes\n", jit->blocks, jit->used);
+    }
+}
+
+#else
+
+/* No native back end on this host, every block stays interpreted */
+APEX_Jit *
+APEX_jit_create(void)
+{
+    return NULL;
+}
+
+void
+APEX_jit_free(APEX_Jit *jit)
+{
+    (void)jit;
+}
+
+APEX_Jit_Fn
+APEX_jit_compile(APEX_Jit *jit, const APEX_Instruction *ops, int count)
+{
+    (void)jit;
+    (void)ops;
+    (void)count;
+    return NULL;
+}
+
+void
+APEX_jit_print_stats(const APEX_Jit *jit)
+{
+    (void)jit;
+    printf("APEX_JIT: no native back end for this host, blocks were interpreted\n");
+}
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * apex_kanata.c
+ * Contains the Kanata (version 0004) log writer. Every dynamic instruction
+ * is followed by its fetch number through fetch, decode, the int, mul, div
+ * or load unit and writeback, a stage lasts until the instruction shows up in
+ * the next one so stalls show as longer stages. Instructions flushed by a
+ * mispredicted BZ/BNZ are retired as squashed. The log is streamed out through a
+ * large buffer, only the instructions in flight are kept.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_kanata.h"
+#include "apex_macros.h"
+
+#define KANATA_BUFFER_SIZE (1 << 20)
+#define KANATA_MAX_LINE 256
+/* More than the instructions the pipeline can hold at once */
+#define KANATA_SLOTS 128
+
+/* Order of the stages, an instruction never goes back to an earlier one */
+enum
+{
+    KANATA_FETCH,
+    KANATA_DECODE,
+    KANATA_EXECUTE,
+    KANATA_WRITEBACK
+};
+
+/* One instruction in flight */
+typedef struct Kanata_Insn
+{
+    int64_t seq; /* Fetch number, -1 for a free slot */
+    long id;     /* Number in the log */
+    int stage;   /* APEX_Stage_Id it is in */
+} Kanata_Insn;
+
+struct APEX_Kanata_Writer
+{
+    FILE *fp;
+    APEX_Observer observer;
+    int64_t cycle; /* Cycle of the last line, -1 before the first */
+    long next_id;  /* Log number of the next new instruction */
+    long retired;
+    int64_t retired_seq; /* Fetch number of the last instruction retired */
+    int error;
+    Kanata_Insn insns[KANATA_SLOTS];
+    /* Instructions that leave the pipeline at the end of this cycle, written at the start of the next */
+    Kanata_Insn ending[KANATA_SLOTS];
+    int ending_squashed[KANATA_SLOTS];
+    int ending_count;
+    size_t used;
+    char buffer[KANATA_BUFFER_SIZE];
+};
+
+/* Names Konata shows for the stages */
+static const char *const kanata_stage_names[APEX_STAGE_COUNT] = {"F", "D", "Int", "Mul", "Ld", "Wb", "Div"};
+
+static int
+stage_order(int stage)
+{
+    switch (stage)
+    {
+    case APEX_STAGE_FETCH:
+        return KANATA_FETCH;
+    case APEX_STAGE_DECODE:
+        return KANATA_DECODE;
+    case APEX_STAGE_WRITEBACK:
+        return KANATA_WRITEBACK;
+    default:
+        return KANATA_EXECUTE;
+    }
+}
+
+static void
+flush_buffer(APEX_Kanata_Writer *writer)
+{
+    if (writer->used && fwrite(writer->buffer, 1, writer->used, writer->fp) != writer->used)
+    {
+        writer->error = TRUE;
+    }
+    writer->used = 0;
+}
+
+/* Appends one line to the log, moving the log's clock to 'cycle' first */
+static void __attribute__((format(printf, 3, 4)))
+emit(APEX_Kanata_Writer *writer, int64_t cycle, const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    if (writer->used + 2 * KANATA_MAX_LINE > KANATA_BUFFER_SIZE)
+    {
+        flush_buffer(writer);
+    }
+    if (writer->cycle < 0)
+    {
+        writer->used += sprintf(writer->buffer + writer->used, "Kanata\t0004\nC=\t%" PRId64 "\n", cycle);
+        writer->cycle = cycle;
+    }
+    else if (cycle != writer->cycle)
+    {
+        writer->used += sprintf(writer->buffer + writer->used, "C\t%" PRId64 "\n", cycle - writer->cycle);
+        writer->cycle = cycle;
+    }
+    va_start(args, format);
+    len = vsnprintf(writer->buffer + writer->used, KANATA_MAX_LINE, format, args);
+    va_end(args);
+    writer->used += len < KANATA_MAX_LINE ? len : KANATA_MAX_LINE - 1;
+}
+
+/* Writes the retirements and squashes of the cycle before 'cycle' */
+static void
+end_instructions(APEX_Kanata_Writer *writer, int64_t cycle)
+{
+    int i;
+
+    for (i = 0; i < writer->ending_count; ++i)
+    {
+        const Kanata_Insn *insn = &writer->ending[i];
+
+        emit(writer, cycle, "E\t%ld\t0\t%s\n", insn->id, kanata_stage_names[insn->stage]);
+        if (writer->ending_squashed[i])
+        {
+            emit(writer, cycle, "R\t%ld\t%ld\t1\n", insn->id, insn->id);
+        }
+        else
+        {
+            emit(writer, cycle, "R\t%ld\t%ld\t0\n", insn->id, writer->retired++);
+        }
+    }
+    writer->ending_count = 0;
+}
+
+/* Takes the instruction out of the pipeline at the end of this cycle */
+static void
+end_instruction(APEX_Kanata_Writer *writer, Kanata_Insn *insn, int squashed)
+{
+    if (writer->ending_count < KANATA_SLOTS)
+    {
+        writer->ending[writer->ending_count] = *insn;
+        writer->ending_squashed[writer->ending_count] = squashed;
+        writer->ending_count++;
+    }
+    insn->seq = -1;
+}
+
+/* Records that the instruction of 'latch' is in stage 'id' in 'cycle' */
+static Kanata_Insn *
+enter_stage(APEX_Kanata_Writer *writer, const APEX_CPU *cpu, int64_t cycle, APEX_Stage_Id id, const CPU_Stage *latch)
+{
+    Kanata_Insn *insn = &writer->insns[latch->seq & (KANATA_SLOTS - 1)];
+
+    if (insn->seq != latch->seq)
+    {
+        char text[64];
+
+        /* A latch still holding an instruction that has retired */
+        if (latch->seq <= writer->retired_seq)
+        {
+            return NULL;
+        }
+        /* Slots are reused in fetch order, the one being replaced is long gone */
+        if (insn->seq >= 0)
+        {
+            end_instruction(writer, insn, TRUE);
+        }
+        insn->seq = latch->seq;
+        insn->id = writer->next_id++;
+        insn->stage = id;
+        APEX_format_instruction(text, sizeof(text), &cpu->code_memory[latch->insn]);
+        emit(writer, cycle, "I\t%ld\t%" PRId64 "\t0\n", insn->id, latch->seq);
+        emit(writer, cycle, "L\t%ld\t0\t%d: %s\n", insn->id, latch->pc, text);
+        emit(writer, cycle, "S\t%ld\t0\t%s\n", insn->id, kanata_stage_names[id]);
+        return insn;
+    }
+    /* Still there (a stall), or seen again by a stage it already left */
+    if (stage_order(id) <= stage_order(insn->stage))
+    {
+        return insn;
+    }
+    emit(writer, cycle, "E\t%ld\t0\t%s\n", insn->id, kanata_stage_names[insn->stage]);
+    emit(writer, cycle, "S\t%ld\t0\t%s\n", insn->id, kanata_stage_names[id]);
+    insn->stage = id;
+    return insn;
+}
+
+static void
+kanata_cycle_begin(const APEX_CPU *cpu, void *arg)
+{
+    APEX_Kanata_Writer *writer = arg;
+    const int64_t cycle = cpu->clock + 1;
+
+    end_instructions(writer, cycle);
+    /* What fetch handed over last cycle, or what could not issue, is in decode all this cycle */
+    if (cpu->decode.has_insn && writer->insns[cpu->decode.seq & (KANATA_SLOTS - 1)].seq == cpu->decode.seq)
+    {
+        enter_stage(writer, cpu, cycle, APEX_STAGE_DECODE, &cpu->decode);
+    }
+}
+
+static void
+kanata_stage(const APEX_CPU *cpu, APEX_Stage_Id id, const CPU_Stage *stage, void *arg)
+{
+    APEX_Kanata_Writer *writer = arg;
+    const int64_t cycle = cpu->clock + 1;
+    Kanata_Insn *insn;
+    int i;
+
+    if (!stage)
+    {
+        return;
+    }
+    insn = enter_stage(writer, cpu, cycle, id, stage);
+    if (!insn)
+    {
+        return;
+    }
+    if (id == APEX_STAGE_WRITEBACK)
+    {
+        writer->retired_seq = stage->seq;
+        end_instruction(writer, insn, FALSE);
+    }
+    /* A mispredicted BZ/BNZ has just flushed everything fetched after it */
+    else if (id == APEX_STAGE_INT && cpu->fetch_from_next_cycle)
+    {
+        for (i = 0; i < KANATA_SLOTS; ++i)
+        {
+            if (writer->insns[i].seq > stage->seq)
+            {
+                end_instruction(writer, &writer->insns[i], TRUE);
+            }
+        }
+    }
+}
+
+/*
+ * Creates 'filename' and returns a writer whose observer (see
+ * APEX_kanata_observer) logs the cycles of the cpu it is added to, NULL on
+ * error
+ */
+APEX_Kanata_Writer *
+APEX_kanata_open(const char *filename)
+{
+    APEX_Kanata_Writer *writer = calloc(1, sizeof(APEX_Kanata_Writer));
+
+    if (!writer)
+    {
+        return NULL;
+    }
+    writer->fp = fopen(filename, "w");
+    if (!writer->fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", filename);
+        free(writer);
+        return NULL;
+    }
+    for (int i = 0; i < KANATA_SLOTS; ++i)
+    {
+        writer->insns[i].seq = -1;
+    }
+    writer->cycle = -1;
+    writer->retired_seq = -1;
+    writer->observer.cycle_begin = kanata_cycle_begin;
+    writer->observer.stage = kanata_stage;
+    writer->observer.arg = writer;
+    return writer;
+}
+
+APEX_Observer *
+APEX_kanata_observer(APEX_Kanata_Writer *writer)
+{
+    return &writer->observer;
+}
+
+/*
+ * Ends the log and frees the writer. Returns the number of instructions
+ * logged, -1 if the file could not be written.
+ */
+long
+APEX_kanata_close(APEX_Kanata_Writer *writer)
+{
+    long count = writer->next_id;
+    int error;
+
+    /* Instructions that left the pipeline in the last cycle */
+    if (writer->cycle >= 0)
+    {
+        end_instructions(writer, writer->cycle + 1);
+    }
+    flush_buffer(writer);
+    error = fclose(writer->fp) != 0 || writer->error;
+    free(writer);
+    return error ? -1 : count;
+}
@@ -0,0 +1,22 @@
+/*
+ * apex_kanata.h
+ * Contains the Kanata log export, a pipeline timeline of every dynamic
+ * instruction that the Konata viewer draws, written by an observer of the
+ * cycle engine
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_KANATA_H_
+#define _APEX_KANATA_H_
+
+#include "apex_cpu.h"
+
+typedef struct APEX_Kanata_Writer APEX_Kanata_Writer;
+
+APEX_Kanata_Writer *APEX_kanata_open(const char *filename);
+APEX_Observer *APEX_kanata_observer(APEX_Kanata_Writer *writer);
+long APEX_kanata_close(APEX_Kanata_Writer *writer);
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ * apex_log.c
+ * Contains the asynchronous log sink. The ring has one producer (the
+ * simulation thread) and one consumer (the writer thread), each owns one
+ * index and only reads the other's, so neither ever takes a lock. A full
+ * ring either blocks the producer or drops the record, by policy.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_log.h"
+
+#define LOG_CACHE_LINE 64
+
+struct APEX_Log
+{
+    /* Written by the producer only */
+    unsigned long head __attribute__((aligned(LOG_CACHE_LINE)));
+    unsigned long cached_tail; /* Last tail the producer saw */
+    long dropped;
+    long pending; /* Dropped since the last DROPPED record */
+
+    /* Written by the consumer only */
+    unsigned long tail __attribute__((aligned(LOG_CACHE_LINE)));
+    unsigned long cached_head; /* Last head the consumer saw */
+
+    /* Set once */
+    int closing __attribute__((aligned(LOG_CACHE_LINE)));
+    int policy;
+    unsigned long mask;
+    APEX_Log_Format format;
+    void *arg;
+    APEX_Log_Record *records;
+    pthread_t thread;
+};
+
+/* Waits a little, yielding first so the other thread gets a single CPU */
+static void
+backoff(int *spins)
+{
+    if (++*spins < 64)
+    {
+        sched_yield();
+    }
+    else
+    {
+        struct timespec pause = {0, 50000};
+
+        nanosleep(&pause, NULL);
+    }
+}
+
+static void *
+log_writer(void *arg)
+{
+    APEX_Log *log = arg;
+    int spins = 0;
+
+    for (;;)
+    {
+        unsigned long tail = log->tail;
+
+        if (tail == log->cached_head)
+        {
+            log->cached_head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+            if (tail == log->cached_head)
+            {
+                /* Closing comes after a drain, so empty and closing means done */
+                if (__atomic_load_n(&log->closing, __ATOMIC_ACQUIRE))
+                {
+                    return NULL;
+                }
+                backoff(&spins);
+                continue;
+            }
+        }
+        spins = 0;
+        log->format(&log->records[tail & log->mask], log->arg);
+        __atomic_store_n(&log->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Free slots of the ring as the producer sees them */
+static unsigned long
+free_slots(APEX_Log *log)
+{
+    if (log->head - log->cached_tail > log->mask)
+    {
+        log->cached_tail = __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE);
+    }
+    return log->mask + 1 - (log->head - log->cached_tail);
+}
+
+static int
+try_push(APEX_Log *log, const APEX_Log_Record *record)
+{
+    if (free_slots(log) == 0)
+    {
+        return FALSE;
+    }
+    log->records[log->head & log->mask] = *record;
+    __atomic_store_n(&log->head, log->head + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+static void
+push_blocking(APEX_Log *log, const APEX_Log_Record *record)
+{
+    int spins = 0;
+
+    while (!try_push(log, record))
+    {
+        backoff(&spins);
+    }
+}
+
+/* Records how many were dropped at this point of the output */
+static void
+push_dropped(APEX_Log *log)
+{
+    APEX_Log_Record marker;
+
+    memset(&marker, 0, sizeof(marker));
+    marker.kind = APEX_LOG_DROPPED;
+    marker.clock = log->pending;
+    push_blocking(log, &marker);
+    log->pending = 0;
+}
+
+/*
+ * Starts the writer thread, 'format' is called on it for every record. The
+ * ring holds 'capacity' records (rounded up to a power of two), 'policy' is
+ * APEX_LOG_BLOCK or APEX_LOG_DROP. NULL on error.
+ */
+APEX_Log *
+APEX_log_open(APEX_Log_Format format, void *arg, int capacity, int policy)
+{
+    APEX_Log *log;
+    unsigned long size = 2;
+
+    while (size < (unsigned long)capacity)
+    {
+        size <<= 1;
+    }
+    if (posix_memalign((void **)&log, LOG_CACHE_LINE, sizeof(APEX_Log)) != 0)
+    {
+        return NULL;
+    }
+    memset(log, 0, sizeof(APEX_Log));
+    log->records = malloc(size * sizeof(APEX_Log_Record));
+    if (!log->records)
+    {
+        free(log);
+        return NULL;
+    }
+    log->mask = size - 1;
+    log->policy = policy;
+    log->format = format;
+    log->arg = arg;
+    if (pthread_create(&log->thread, NULL, log_writer, log) != 0)
+    {
+        free(log->records);
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+void
+APEX_log_push(APEX_Log *log, const APEX_Log_Record *record)
+{
+    if (log->policy == APEX_LOG_BLOCK)
+    {
+        push_blocking(log, record);
+        return;
+    }
+    /* The marker needs a slot of its own in front of the record */
+    if (log->pending && free_slots(log) >= 2)
+    {
+        push_dropped(log);
+    }
+    if (log->pending || !try_push(log, record))
+    {
+        log->dropped++;
+        log->pending++;
+    }
+}
+
+/*
+ * Waits until the writer thread has formatted everything pushed so far,
+ * output written after this comes after the log's
+ */
+void
+APEX_log_drain(APEX_Log *log)
+{
+    int spins = 0;
+
+    if (log->pending)
+    {
+        push_dropped(log);
+    }
+    while (__atomic_load_n(&log->tail, __ATOMIC_ACQUIRE) != log->head)
+    {
+        backoff(&spins);
+    }
+}
+
+/* Drains the log and stops the writer thread. Returns the records dropped. */
+long
+APEX_log_close(APEX_Log *log)
+{
+    long dropped;
+
+    APEX_log_drain(log);
+    __atomic_store_n(&log->closing, TRUE, __ATOMIC_RELEASE);
+    pthread_join(log->thread, NULL);
+    dropped = log->dropped;
+    free(log->records);
+    free(log);
+    return dropped;
+}
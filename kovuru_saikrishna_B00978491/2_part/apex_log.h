@@ -0,0 +1,55 @@
+/*
+ * apex_log.h
+ * Contains the asynchronous log sink, the simulation thread pushes raw
+ * records into a lock-free single-producer/single-consumer ring and a
+ * thread of its own formats and writes them
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_LOG_H_
+#define _APEX_LOG_H_
+
+#include <stdint.h>
+
+#include "apex_macros.h"
+
+/* Kinds of record */
+enum
+{
+  APEX_LOG_CYCLE,  /* a cycle starts, 'clock' is the cycle as printed */
+  APEX_LOG_STAGE,  /* what a stage held, 'empty' when it held nothing */
+  APEX_LOG_REGS,   /* register file at the end of a cycle */
+  APEX_LOG_DROPPED /* 'clock' records were dropped here, the ring was full */
+};
+
+/* What to do when the ring is full */
+enum
+{
+  APEX_LOG_BLOCK, /* wait for the writer thread */
+  APEX_LOG_DROP   /* drop the record and count it */
+};
+
+typedef struct APEX_Log_Record
+{
+  int kind;
+  int64_t clock;
+  int stage; /* APEX_Stage_Id */
+  int empty;
+  int pc;
+  int insn; /* Code memory index */
+  int regs[REG_FILE_SIZE];
+} APEX_Log_Record;
+
+/* Formats one record, called on the writer thread in push order */
+typedef void (*APEX_Log_Format)(const APEX_Log_Record *record, void *arg);
+
+typedef struct APEX_Log APEX_Log;
+
+APEX_Log *APEX_log_open(APEX_Log_Format format, void *arg, int capacity, int policy);
+void APEX_log_push(APEX_Log *log, const APEX_Log_Record *record);
+void APEX_log_drain(APEX_Log *log);
+long APEX_log_close(APEX_Log *log);
+
+#endif
@@ -18,26 +18,20 @@
 /* Size of integer register file */
 #define REG_FILE_SIZE 16
 
-/* Numeric OPCODE identifiers for instructions */
-#define OPCODE_ADD 0x0
-#define OPCODE_SUB 0x1
-#define OPCODE_MUL 0x2
-#define OPCODE_DIV 0x3
-#define OPCODE_AND 0x4
-#define OPCODE_OR 0x5
-#define OPCODE_XOR 0x6
-#define OPCODE_MOVC 0x7
-#define OPCODE_LOAD 0x8
-#define OPCODE_STORE 0x9
-#define OPCODE_BZ 0xa
-#define OPCODE_BNZ 0xb
-#define OPCODE_HALT 0xc
-#define OPCODE_ADDL 0x10
-#define OPCODE_SUBL 0x11
-#define OPCODE_LDR 0x12
-#define OPCODE_STR 0x13
-#define OPCODE_CMP 0x14
-#define OPCODE_NOP 0x15
+/* Entries of the completion buffer, the completion_size option uses up to this many */
+#define COMPLETION_BUFFER_SIZE 64
+
+/* Instances of one FU class, the *_units options use up to this many */
+#define FU_MAX_UNITS 4
+
+/* Log2 of the 2-bit counters of the branch predictor, bp_table_bits goes up to this */
+#define BP_MAX_TABLE_BITS 12
+
+/* Entries of the branch target buffer, btb_entries uses up to this many */
+#define BTB_MAX_ENTRIES 1024
+
+/* Numeric OPCODE identifiers for instructions come from the ISA table */
+#include "apex_isa.h"
 
 /* Set this flag to 1 to enable debug messages */
 #define ENABLE_DEBUG_MESSAGES 1
@@ -0,0 +1,268 @@
+/*
+ * apex_object.c
+ * Contains functions to write and map binary APEX object files (.apexo)
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+#include "apex_object.h"
+
+/* Section alignment inside the image */
+#define APEXO_ALIGN 64
+
+static uint64_t
+align_up(uint64_t offset)
+{
+    return (offset + APEXO_ALIGN - 1) & ~(uint64_t)(APEXO_ALIGN - 1);
+}
+
+/*
+ * Returns TRUE if the file starts with the .apexo magic
+ */
+int
+APEX_object_is_image(const char *filename)
+{
+    char magic[8];
+    FILE *fp = fopen(filename, "rb");
+    int is_image;
+
+    if (!fp)
+    {
+        return FALSE;
+    }
+    is_image = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+               memcmp(magic, APEXO_MAGIC, sizeof(APEXO_MAGIC)) == 0;
+    fclose(fp);
+    return is_image;
+}
+
+/*
+ * TRUE when every record of the code section is an instruction of the ISA
+ * whose registers are in the register file, and every branch target is the
+ * one the assembler resolves for it. Decode and execute index the ISA table
+ * and the register file with these fields as they are.
+ */
+static int
+records_are_valid(const APEX_Instruction *code, const int32_t *target, int count)
+{
+    int *expected;
+    int i, valid;
+
+    for (i = 0; i < count; ++i)
+    {
+        const APEX_Instruction *ins = &code[i];
+
+        if (ins->opcode >= APEX_OPCODE_LIMIT || !apex_isa[ins->opcode].mnemonic || ins->rd >= REG_FILE_SIZE ||
+            ins->rs1 >= REG_FILE_SIZE || ins->rs2 >= REG_FILE_SIZE || ins->rs3 >= REG_FILE_SIZE)
+        {
+            return FALSE;
+        }
+    }
+    expected = resolve_branch_targets(code, count);
+    if (!expected)
+    {
+        return FALSE;
+    }
+    valid = memcmp(expected, target, count * sizeof(int32_t)) == 0;
+    free(expected);
+    return valid;
+}
+
+/*
+ * Maps an .apexo image and uses it directly as the code memory of the cpu,
+ * the optional data segment is copied into data memory. Returns 0 on success.
+ */
+int
+APEX_object_load(APEX_CPU *cpu, const char *filename)
+{
+    int fd;
+    struct stat st;
+    void *map;
+    const APEX_Object_Header *header;
+    uint64_t code_bytes, data_bytes;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(APEX_Object_Header))
+    {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    header = map;
+    code_bytes = (uint64_t)header->code_count * sizeof(APEX_Instruction);
+    data_bytes = (uint64_t)header->data_count * sizeof(int32_t);
+
+    if (memcmp(header->magic, APEXO_MAGIC, sizeof(APEXO_MAGIC)) != 0 ||
+        header->version != APEXO_VERSION ||
+        header->insn_size != sizeof(APEX_Instruction))
+    {
+        fprintf(stderr, "APEX_Error: %s is not a version %d APEX object for this build\n",
+                filename, APEXO_VERSION);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    if (header->code_count == 0 || header->data_count > DATA_MEMORY_SIZE ||
+        header->code_offset % sizeof(int32_t) || header->target_offset % sizeof(int32_t) ||
+        header->data_offset % sizeof(int32_t) || header->code_offset > (uint64_t)st.st_size ||
+        header->target_offset > (uint64_t)st.st_size || header->data_offset > (uint64_t)st.st_size ||
+        header->code_offset + code_bytes > (uint64_t)st.st_size ||
+        header->target_offset + header->code_count * sizeof(int32_t) > (uint64_t)st.st_size ||
+        header->data_offset + data_bytes > (uint64_t)st.st_size)
+    {
+        fprintf(stderr, "APEX_Error: %s is truncated or corrupt\n", filename);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    if (!records_are_valid((const APEX_Instruction *)((char *)map + header->code_offset),
+                           (const int32_t *)((char *)map + header->target_offset), header->code_count))
+    {
+        fprintf(stderr, "APEX_Error: %s holds an invalid instruction or branch target\n", filename);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    cpu->code_memory = (APEX_Instruction *)((char *)map + header->code_offset);
+    cpu->code_memory_size = header->code_count;
+    cpu->branch_target = (const int *)((char *)map + header->target_offset);
+    memcpy(cpu->data_memory, (char *)map + header->data_offset, data_bytes);
+    cpu->image = map;
+    cpu->image_size = st.st_size;
+    return 0;
+}
+
+/*
+ * Reads whitespace separated integers, the initial data memory from address 0
+ */
+static int
+read_data_segment(const char *data_file, int32_t *data)
+{
+    FILE *fp = fopen(data_file, "r");
+    int count = 0;
+    int value;
+
+    if (!fp)
+    {
+        return -1;
+    }
+    while (fscanf(fp, "%d", &value) == 1)
+    {
+        if (count == DATA_MEMORY_SIZE)
+        {
+            fprintf(stderr, "APEX_Error: %s holds more than %d data words\n", data_file, DATA_MEMORY_SIZE);
+            fclose(fp);
+            return -1;
+        }
+        data[count++] = value;
+    }
+    if (!feof(fp))
+    {
+        fprintf(stderr, "APEX_Error: %s: data word %d is not a number\n", data_file, count);
+        count = -1;
+    }
+    fclose(fp);
+    return count;
+}
+
+/*
+ * Assembler mode, parses an assembly file and writes it out as an .apexo
+ * image with pre-resolved branch targets and, when data_file is given, an
+ * initial data memory segment. Returns 0 on success.
+ */
+int
+APEX_object_assemble(const char *asm_file, const char *object_file,
+                     const char *data_file, int threads)
+{
+    APEX_Object_Header header;
+    APEX_Instruction *code_memory;
+    int *branch_target;
+    int32_t data[DATA_MEMORY_SIZE];
+    int code_memory_size, data_count = 0;
+    FILE *fp;
+    int ok;
+
+    if (data_file)
+    {
+        data_count = read_data_segment(data_file, data);
+        if (data_count < 0)
+        {
+            fprintf(stderr, "APEX_Error: Unable to read data segment %s\n", data_file);
+            return -1;
+        }
+    }
+
+    code_memory = create_code_memory(asm_file, &code_memory_size, threads);
+    if (!code_memory)
+    {
+        fprintf(stderr, "APEX_Error: Unable to load %s\n", asm_file);
+        return -1;
+    }
+    branch_target = resolve_branch_targets(code_memory, code_memory_size);
+    if (!branch_target)
+    {
+        free(code_memory);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, APEXO_MAGIC, sizeof(APEXO_MAGIC));
+    header.version = APEXO_VERSION;
+    header.insn_size = sizeof(APEX_Instruction);
+    header.code_count = code_memory_size;
+    header.data_count = data_count;
+    header.code_offset = align_up(sizeof(header));
+    header.target_offset = align_up(header.code_offset + (uint64_t)code_memory_size * sizeof(APEX_Instruction));
+    header.data_offset = data_count ? align_up(header.target_offset + (uint64_t)code_memory_size * sizeof(int32_t)) : 0;
+
+    fp = fopen(object_file, "wb");
+    if (!fp)
+    {
+        free(branch_target);
+        free(code_memory);
+        return -1;
+    }
+
+    /* Sections are written in file order, fseek fills the alignment gaps with zeros */
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+         fseek(fp, header.code_offset, SEEK_SET) == 0 &&
+         fwrite(code_memory, sizeof(APEX_Instruction), code_memory_size, fp) == (size_t)code_memory_size &&
+         fseek(fp, header.target_offset, SEEK_SET) == 0 &&
+         fwrite(branch_target, sizeof(int32_t), code_memory_size, fp) == (size_t)code_memory_size &&
+         (!data_count || (fseek(fp, header.data_offset, SEEK_SET) == 0 &&
+                          fwrite(data, sizeof(int32_t), data_count, fp) == (size_t)data_count));
+    ok = (fclose(fp) == 0) && ok;
+
+    free(branch_target);
+    free(code_memory);
+
+    if (!ok)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", object_file);
+        remove(object_file);
+        return -1;
+    }
+    printf("APEX_ASM: %s -> %s, %d instructions, %d data words\n", asm_file, object_file,
+           code_memory_size, data_count);
+    return 0;
+}
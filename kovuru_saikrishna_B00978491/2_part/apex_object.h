@@ -0,0 +1,46 @@
+/*
+ * apex_object.h
+ * Contains the binary object format (.apexo) of assembled APEX programs
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_OBJECT_H_
+#define _APEX_OBJECT_H_
+
+#include <stdint.h>
+
+#include "apex_cpu.h"
+
+#define APEXO_MAGIC "APEXOBJ"
+/* Bump whenever the header or APEX_Instruction layout changes */
+#define APEXO_VERSION 1
+
+/*
+ * Layout of an .apexo file, all fields in host byte order:
+ *
+ *   header | code (code_count APEX_Instruction) | branch targets (code_count int32)
+ *          | data memory segment (data_count int32, optional)
+ *
+ * Sections start at the offsets given in the header, code is 64-byte aligned
+ * so a mapped image is used as code memory without any copying.
+ */
+typedef struct APEX_Object_Header
+{
+  char magic[8];          /* APEXO_MAGIC, NUL padded */
+  uint32_t version;       /* APEXO_VERSION */
+  uint32_t insn_size;     /* sizeof(APEX_Instruction) of the writer */
+  uint32_t code_count;    /* Instructions in the code section */
+  uint32_t data_count;    /* Words of initial data memory, from address 0 */
+  uint64_t code_offset;   /* File offset of the code section */
+  uint64_t target_offset; /* File offset of the branch target section */
+  uint64_t data_offset;   /* File offset of the data memory segment */
+} APEX_Object_Header;
+
+int APEX_object_is_image(const char *filename);
+int APEX_object_load(APEX_CPU *cpu, const char *filename);
+int APEX_object_assemble(const char *asm_file, const char *object_file,
+                         const char *data_file, int threads);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * apex_sample.c
+ * Contains the sampled simulation mode (SMARTS style). The program runs
+ * functionally, and at the start of every sample_interval instructions a
+ * copy of the architectural state is put through the pipeline: first
+ * sample_warmup instructions to fill it, then sample_window instructions
+ * whose cycles are measured. The CPI of the windows gives an estimate of
+ * the cycles of the whole run with a confidence interval.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_func.h"
+#include "apex_macros.h"
+
+/* Cycles a sample may take per instruction before it is given up on */
+#define SAMPLE_MAX_CPI 64
+
+/* z for a 95% confidence interval */
+#define SAMPLE_Z95 1.96
+
+/*
+ * Sets up 'detail' to simulate from the architectural state of 'master'
+ * with an empty pipeline. Long-lived microarchitectural state is carried
+ * over from the master here, the regCheck scoreboard only counts writes in
+ * flight so it is all clear for an empty pipeline.
+ */
+void
+APEX_cpu_start_detailed(APEX_CPU *detail, const APEX_CPU *master)
+{
+    *detail = *master;
+    memset(&detail->fetch, 0, sizeof(CPU_Stage));
+    memset(&detail->decode, 0, sizeof(CPU_Stage));
+    detail->executing_count = 0;
+    memset(detail->fu_ready, 0, sizeof(detail->fu_ready));
+    detail->completion_count = 0;
+    memset(detail->regCheck, 0, sizeof(detail->regCheck));
+    detail->clock = 0;
+    detail->insn_completed = 0;
+    detail->fetch_from_next_cycle = FALSE;
+    detail->fu_stalled = FALSE;
+    memset(&detail->stats, 0, sizeof(APEX_Stats));
+    /* Snapshots are only taken by a cpu of its own */
+    detail->stats_next = -1;
+    detail->stats_series = NULL;
+    APEX_cpi_reset(detail);
+    detail->bpred_rows = NULL;
+    detail->fetch_seq = 0;
+    detail->fetch.has_insn = TRUE;
+    detail->quiet = TRUE;
+    detail->observers = NULL;
+    /* Translation caches belong to the master */
+    detail->threaded_code = NULL;
+    detail->block_cache = NULL;
+}
+
+/*
+ * Simulates 'warmup' instructions and then 'window' more, returns the cycles
+ * from the retirement of the last warm-up instruction to the retirement of
+ * the last window instruction (from cycle 0 when there is no warm-up), or -1
+ * when the program ended, faulted or stopped making progress before that
+ */
+int64_t
+APEX_cpu_measure_window(APEX_CPU *detail, long warmup, long window)
+{
+    int64_t max_cycles = (int64_t)(warmup + window) * SAMPLE_MAX_CPI + 64;
+    int64_t window_start = warmup == 0 ? 0 : -1;
+
+    while (detail->clock < max_cycles)
+    {
+        int halted = APEX_cpu_cycle(detail);
+        /* 1-based cycle of this step, the clock is not advanced past HALT */
+        int64_t cycle = halted ? detail->clock + 1 : detail->clock;
+
+        if (halted == APEX_CYCLE_FAULT)
+        {
+            return -1;
+        }
+        if (window_start < 0 && detail->insn_completed >= warmup)
+        {
+            window_start = cycle;
+        }
+        if (detail->insn_completed >= warmup + window)
+        {
+            return cycle - window_start;
+        }
+        if (halted)
+        {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Sampled simulation of the program from the current state, up to
+ * max_insns instructions (0 until HALT). The cpu ends in the same state as
+ * after a functional run. Returns the APEX_FUNC_* status of that run.
+ */
+int
+APEX_cpu_run_sampled(APEX_CPU *cpu, long max_insns)
+{
+    const int interval = cpu->config.sample_interval;
+    const int warmup = cpu->config.sample_warmup;
+    const int window = cpu->config.sample_window;
+    APEX_CPU *detail;
+    double sum = 0, sum_sq = 0;
+    long samples = 0;
+    int64_t detailed = 0;
+    int64_t start_completed = cpu->insn_completed;
+    int status = APEX_FUNC_LIMIT;
+
+    if (warmup + window > interval)
+    {
+        fprintf(stderr, "APEX_Error: sample_warmup + sample_window must not be more than sample_interval\n");
+        return APEX_FUNC_ERROR;
+    }
+    detail = malloc(sizeof(APEX_CPU));
+    if (!detail)
+    {
+        return APEX_FUNC_ERROR;
+    }
+
+    while (status == APEX_FUNC_LIMIT)
+    {
+        int64_t done = cpu->insn_completed - start_completed;
+        long step = interval;
+        int64_t cycles;
+
+        if (max_insns > 0)
+        {
+            if (done >= max_insns)
+            {
+                break;
+            }
+            if (step > max_insns - done)
+            {
+                step = max_insns - done;
+            }
+        }
+
+        /* Measure at the start of the interval, then fast-forward over it */
+        APEX_cpu_start_detailed(detail, cpu);
+        cycles = APEX_cpu_measure_window(detail, warmup, window);
+        detailed += detail->insn_completed;
+        if (cycles >= 0)
+        {
+            double cpi = (double)cycles / window;
+
+            sum += cpi;
+            sum_sq += cpi * cpi;
+            samples++;
+        }
+
+        status = APEX_cpu_run_warming(cpu, step);
+    }
+    free(detail);
+
+    {
+        int64_t insns = cpu->insn_completed - start_completed;
+        double mean = samples ? sum / samples : 0;
+        double var = samples > 1 ? (sum_sq - samples * mean * mean) / (samples - 1) : 0;
+        double half = samples > 1 ? SAMPLE_Z95 * sqrt(var > 0 ? var : 0) / sqrt(samples) : 0;
+
+        printf("APEX_SAMPLE: interval = %d, warmup = %d, window = %d, samples = %ld\n", interval, warmup,
+               window, samples);
+        printf("APEX_SAMPLE: %" PRId64 " instructions, %" PRId64 " (%.2f%%) simulated in detail\n", insns, detailed,
+               insns ? 100.0 * detailed / insns : 0.0);
+        if (samples == 0)
+        {
+            printf("APEX_SAMPLE: no complete window, the program is shorter than one sample\n");
+        }
+        else
+        {
+            printf("APEX_SAMPLE: CPI = %.4f +/- %.4f (95%% confidence, +/- %.2f%%)\n", mean, half,
+                   mean > 0 ? 100.0 * half / mean : 0.0);
+            printf("APEX_SAMPLE: estimated cycles = %.0f (%.0f .. %.0f)\n", mean * insns, (mean - half) * insns,
+                   (mean + half) * insns);
+        }
+    }
+    return status;
+}
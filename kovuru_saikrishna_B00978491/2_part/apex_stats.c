@@ -0,0 +1,271 @@
+/*
+ * apex_stats.c
+ * Contains the snapshots of the pipeline counters and their JSON dump.
+ * The counters themselves are updated by the stages in apex_cpu.c, a
+ * snapshot only copies them, so a run without snapshots pays nothing more.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_isa.h"
+#include "apex_macros.h"
+#include "apex_stats.h"
+
+static const char *const fu_names[FU_COUNT] = {"int", "mul", "div", "load"};
+static const char *const cpi_names[APEX_CPI_COUNT] = {"base", "data", "branch", "structural", "drain", "fill"};
+
+/* First snapshot cycle after the cpu's clock, -1 when there are none */
+void
+APEX_stats_start(APEX_CPU *cpu)
+{
+    const long interval = cpu->config.stats_interval;
+
+    cpu->stats_next = interval > 0 ? (cpu->clock / interval + 1) * interval : -1;
+}
+
+/* Appends the counters of this cycle to the cpu's series */
+void
+APEX_stats_snapshot(APEX_CPU *cpu)
+{
+    APEX_Stats_Series *series = cpu->stats_series;
+    APEX_Stats_Snapshot *snapshot;
+
+    cpu->stats_next += cpu->config.stats_interval;
+    if (!series)
+    {
+        series = calloc(1, sizeof(APEX_Stats_Series));
+        if (!series)
+        {
+            return;
+        }
+        cpu->stats_series = series;
+    }
+    if (series->count == series->capacity)
+    {
+        long capacity = series->capacity ? series->capacity * 2 : 256;
+        APEX_Stats_Snapshot *grown = realloc(series->snapshots, capacity * sizeof(APEX_Stats_Snapshot));
+
+        /* Out of memory the series just stops growing */
+        if (!grown)
+        {
+            return;
+        }
+        series->snapshots = grown;
+        series->capacity = capacity;
+    }
+    snapshot = &series->snapshots[series->count++];
+    snapshot->cycle = cpu->clock;
+    snapshot->insn_completed = cpu->insn_completed;
+    snapshot->stats = cpu->stats;
+}
+
+void
+APEX_stats_free(APEX_CPU *cpu)
+{
+    if (cpu->stats_series)
+    {
+        free(cpu->stats_series->snapshots);
+        free(cpu->stats_series);
+        cpu->stats_series = NULL;
+    }
+    free(cpu->cpi.rows);
+    cpu->cpi.rows = NULL;
+    free(cpu->bpred_rows);
+    cpu->bpred_rows = NULL;
+}
+
+/*
+ * CPI stack state of an empty pipeline, the bubbles until the first
+ * instruction gets to writeback are the pipeline filling up. The rows are
+ * not freed, a cpu copied from another one does not own them.
+ */
+void
+APEX_cpi_reset(APEX_CPU *cpu)
+{
+    cpu->cpi.fetch = APEX_CPI_FILL;
+    cpu->cpi.issue = APEX_CPI_FILL;
+    cpu->cpi.complete = APEX_CPI_FILL;
+    memset(cpu->cpi.pending, 0, sizeof(cpu->cpi.pending));
+    cpu->cpi.rows = NULL;
+}
+
+/* Starts charging cycles to the static instructions from this cycle on, returns 0 on success */
+int
+APEX_cpi_start(APEX_CPU *cpu)
+{
+    free(cpu->cpi.rows);
+    memset(cpu->cpi.pending, 0, sizeof(cpu->cpi.pending));
+    cpu->cpi.rows = calloc(cpu->code_memory_size, sizeof(APEX_Cpi_Row));
+    return cpu->cpi.rows ? 0 : -1;
+}
+
+/*
+ * Prints the CPI stack of the run, 'cycles' is the cycle count as printed,
+ * then the cycles charged to every instruction since APEX_cpi_start
+ */
+void
+APEX_cpi_print(const APEX_CPU *cpu, int64_t cycles)
+{
+    int64_t insns = 0;
+    int64_t in_flight = 0;
+    int i, c;
+
+    /* Not insn_completed, that also counts what a fast-forward ran */
+    for (i = 0; i < APEX_OPCODE_LIMIT; ++i)
+    {
+        insns += cpu->stats.retired_opcode[i];
+    }
+
+    printf("APEX_CPI: cycles = %" PRId64 " instructions = %" PRId64 " CPI = %.4f\n", cycles, insns,
+           insns ? (double)cycles / insns : 0.0);
+    printf("%-12s %-12s %-8s %s\n", "category", "cycles", "CPI", "share");
+    for (c = 0; c < APEX_CPI_COUNT; ++c)
+    {
+        printf("%-12s %-12" PRId64 " %-8.4f %.2f%%\n", cpi_names[c], cpu->stats.cpi[c],
+               insns ? (double)cpu->stats.cpi[c] / insns : 0.0, cycles ? 100.0 * cpu->stats.cpi[c] / cycles : 0.0);
+    }
+    if (!cpu->cpi.rows)
+    {
+        return;
+    }
+
+    /* A bubble cycle is charged to the instruction it held back, the next one to retire */
+    printf("\n%-6s %-20s %-10s", "pc", "instruction", "retired");
+    for (c = 0; c < APEX_CPI_COUNT; ++c)
+    {
+        printf(" %-10s", cpi_names[c]);
+    }
+    printf(" %s\n", "CPI");
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        const APEX_Cpi_Row *row = &cpu->cpi.rows[i];
+        char text[64];
+        int64_t total = 0;
+
+        if (!row->retired)
+        {
+            continue;
+        }
+        APEX_format_instruction(text, sizeof(text), &cpu->code_memory[i]);
+        printf("%-6d %-20s %-10" PRId64, 4000 + 4 * i, text, row->retired);
+        for (c = 0; c < APEX_CPI_COUNT; ++c)
+        {
+            printf(" %-10" PRId64, row->cycles[c]);
+            total += row->cycles[c];
+        }
+        printf(" %.4f\n", (double)total / row->retired);
+    }
+    for (c = 0; c < APEX_CPI_COUNT; ++c)
+    {
+        in_flight += cpu->cpi.pending[c];
+    }
+    if (in_flight)
+    {
+        printf("APEX_CPI: %" PRId64 " bubble cycles at the end are not charged to any instruction\n", in_flight);
+    }
+}
+
+/* Writes the members of one set of counters, 'indent' spaces deep, without the newline after the last */
+static void
+write_counters(FILE *fp, int64_t cycles, int64_t insns, const APEX_Stats *stats, int indent)
+{
+    const char *sep = "";
+    int i;
+
+    fprintf(fp, "%*s\"cycles\": %" PRId64 ",\n", indent, "", cycles);
+    fprintf(fp, "%*s\"instructions\": %" PRId64 ",\n", indent, "", insns);
+    fprintf(fp, "%*s\"ipc\": %.6f,\n", indent, "", cycles ? (double)insns / cycles : 0.0);
+    fprintf(fp, "%*s\"retired\": {", indent, "");
+    for (i = 0; i < APEX_OPCODE_LIMIT; ++i)
+    {
+        if (apex_isa[i].mnemonic)
+        {
+            fprintf(fp, "%s\"%s\": %" PRId64, sep, apex_isa[i].mnemonic, stats->retired_opcode[i]);
+            sep = ", ";
+        }
+    }
+    fprintf(fp, "},\n");
+    fprintf(fp, "%*s\"decode_stall_data\": %" PRId64 ",\n", indent, "", stats->stall_data);
+    fprintf(fp, "%*s\"decode_stall_data_by_register\": {", indent, "");
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        fprintf(fp, "%s\"R%d\": %" PRId64, i ? ", " : "", i, stats->stall_data_reg[i]);
+    }
+    fprintf(fp, "},\n");
+    fprintf(fp, "%*s\"decode_stall_removed_by_forwarding\": %" PRId64 ",\n", indent, "", stats->stall_forwarded);
+    fprintf(fp, "%*s\"forwarded_operands\": {", indent, "");
+    for (i = 0; i < FU_COUNT; ++i)
+    {
+        fprintf(fp, "%s\"%s\": %" PRId64, i ? ", " : "", fu_names[i], stats->forwarded[i]);
+    }
+    fprintf(fp, "},\n");
+    fprintf(fp, "%*s\"decode_stall_structural\": %" PRId64 ",\n", indent, "", stats->stall_structural);
+    fprintf(fp, "%*s\"decode_stall_structural_by_fu\": {", indent, "");
+    for (i = 0; i < FU_COUNT; ++i)
+    {
+        fprintf(fp, "%s\"%s\": %" PRId64, i ? ", " : "", fu_names[i], stats->stall_fu[i]);
+    }
+    fprintf(fp, "},\n");
+    fprintf(fp, "%*s\"fetch_stall\": %" PRId64 ",\n", indent, "", stats->fetch_stall);
+    fprintf(fp, "%*s\"branches\": %" PRId64 ",\n", indent, "", stats->branches);
+    fprintf(fp, "%*s\"branch_flushes\": %" PRId64 ",\n", indent, "", stats->flushes);
+    fprintf(fp, "%*s\"btb_misses\": %" PRId64 ",\n", indent, "", stats->btb_misses);
+    fprintf(fp, "%*s\"fu_busy\": {", indent, "");
+    for (i = 0; i < FU_COUNT; ++i)
+    {
+        fprintf(fp, "%s\"%s\": %" PRId64, i ? ", " : "", fu_names[i], stats->fu_busy[i]);
+    }
+    fprintf(fp, "},\n");
+    fprintf(fp, "%*s\"cpi_stack\": {", indent, "");
+    for (i = 0; i < APEX_CPI_COUNT; ++i)
+    {
+        fprintf(fp, "%s\"%s\": %" PRId64, i ? ", " : "", cpi_names[i], stats->cpi[i]);
+    }
+    fprintf(fp, "}");
+}
+
+/*
+ * Writes the counters of the run and every snapshot as JSON to 'filename'
+ * ("-" is stdout). 'cycles' is the cycle count of the run as printed.
+ * Returns 0 on success.
+ */
+int
+APEX_stats_write_json(const APEX_CPU *cpu, int64_t cycles, const char *status, const char *filename)
+{
+    const APEX_Stats_Series *series = cpu->stats_series;
+    FILE *fp = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+    long i;
+    int ok;
+
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", filename);
+        return -1;
+    }
+    fprintf(fp, "{\n  \"status\": \"%s\",\n", status);
+    write_counters(fp, cycles, cpu->insn_completed, &cpu->stats, 2);
+    fprintf(fp, ",\n  \"stats_interval\": %d,\n  \"snapshots\": [", cpu->config.stats_interval);
+    for (i = 0; series && i < series->count; ++i)
+    {
+        const APEX_Stats_Snapshot *snapshot = &series->snapshots[i];
+
+        fprintf(fp, "%s\n    {\n", i ? "," : "");
+        write_counters(fp, snapshot->cycle, snapshot->insn_completed, &snapshot->stats, 6);
+        fprintf(fp, "\n    }");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    ok = fp == stdout ? fflush(fp) == 0 : fclose(fp) == 0;
+    if (!ok)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
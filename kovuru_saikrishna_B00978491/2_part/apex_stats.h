@@ -0,0 +1,90 @@
+/*
+ * apex_stats.h
+ * Contains the statistics of the pipeline, 64-bit event counters kept in
+ * APEX_CPU, their snapshots every stats_interval cycles and the JSON dump
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_STATS_H_
+#define _APEX_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "apex_macros.h"
+
+/*
+ * What the writeback slot did in a cycle. Every cycle is one of them: an
+ * instruction retired, or the bubble in its place came from decode waiting
+ * for a source register, a mispredicted BZ/BNZ refetching, a busy FU, fetch
+ * having stopped at HALT, or the empty pipeline filling up at the start.
+ */
+enum
+{
+  APEX_CPI_BASE,
+  APEX_CPI_DATA,
+  APEX_CPI_BRANCH,
+  APEX_CPI_STRUCTURAL,
+  APEX_CPI_DRAIN,
+  APEX_CPI_FILL,
+  APEX_CPI_COUNT
+};
+
+/* Counters of the pipeline, all of them only count up */
+typedef struct APEX_Stats
+{
+  int64_t retired_opcode[APEX_OPCODE_LIMIT]; /* Instructions retired by writeback, per opcode */
+  int64_t stall_data;                        /* Cycles decode waited for a source register */
+  int64_t stall_data_reg[REG_FILE_SIZE];     /* ... per register it waited for (the first busy source) */
+  int64_t stall_forwarded;                   /* Decode stalls on a source register that forwarding removed */
+  int64_t forwarded[FU_COUNT];               /* Source operands forwarded from the int, mul, div and load outputs */
+  int64_t stall_structural;                  /* Cycles decode waited for a busy FU or a completion buffer entry */
+  int64_t stall_fu[FU_COUNT];                /* ... per FU class all of whose instances were busy */
+  int64_t fetch_stall;                       /* Cycles fetch held an instruction decode could not take */
+  int64_t branches;                          /* BZ/BNZ resolved in an int unit */
+  int64_t flushes;                           /* ... of them mispredicted, they flushed fetch and decode */
+  int64_t btb_misses;                        /* BZ/BNZ fetch found no BTB entry for */
+  int64_t fu_busy[FU_COUNT];                 /* Cycles instructions spent in the int, mul, div and load units */
+  int64_t cpi[APEX_CPI_COUNT];               /* Cycles of every category of the CPI stack */
+} APEX_Stats;
+
+/* Cycles charged to one static instruction */
+typedef struct APEX_Cpi_Row
+{
+  int64_t retired;
+  int64_t cycles[APEX_CPI_COUNT];
+} APEX_Cpi_Row;
+
+/*
+ * State of the CPI stack. A bubble is given its category where it enters
+ * the pipeline and carries it down to writeback one stage a cycle, a
+ * bubble cycle is charged to the next instruction that retires.
+ */
+typedef struct APEX_Cpi_State
+{
+  int fetch;                       /* What fetch left in decode, APEX_CPI_BASE for an instruction */
+  int issue;                       /* What decode issued to the FUs */
+  int complete;                    /* What the FUs handed to writeback */
+  int64_t pending[APEX_CPI_COUNT]; /* Bubble cycles not charged yet */
+  APEX_Cpi_Row *rows;              /* Per code memory index, NULL unless a report asked for them */
+} APEX_Cpi_State;
+
+/* The counters at one cycle */
+typedef struct APEX_Stats_Snapshot
+{
+  int64_t cycle;
+  int64_t insn_completed;
+  APEX_Stats stats;
+} APEX_Stats_Snapshot;
+
+/* Snapshots taken so far, owned by the cpu that took them */
+typedef struct APEX_Stats_Series
+{
+  long count;
+  long capacity;
+  APEX_Stats_Snapshot *snapshots;
+} APEX_Stats_Series;
+
+#endif
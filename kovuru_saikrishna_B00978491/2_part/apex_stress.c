@@ -0,0 +1,265 @@
+/*
+ * apex_stress.c
+ * Contains the stress run of the simulator core, many threads load and
+ * simulate the same program at once, each on cpus of its own, and every
+ * result is compared with a reference run. Some pipeline runs have an
+ * observer feeding an asynchronous log, so its writer threads run as well.
+ * Build with -fsanitize=thread to check that the cpus share nothing.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_log.h"
+#include "apex_macros.h"
+
+/* What a run ended with */
+typedef struct Stress_Result
+{
+    int pc;
+    int64_t clock;
+    int64_t insn_completed;
+    int zero_flag;
+    int status;
+    long records; /* Stage records the log of an observed run formatted */
+    int regs[REG_FILE_SIZE];
+    int data_memory[DATA_MEMORY_SIZE];
+} Stress_Result;
+
+typedef struct Stress_Run
+{
+    const char *filename;
+    const APEX_Config *config;
+    const Stress_Result *pipeline; /* Reference of the pipeline runs */
+    const Stress_Result *observed; /* Reference of the observed pipeline runs */
+    const Stress_Result *functional; /* Reference of the functional runs */
+    int max_cycles;
+    int runs;
+    long mismatches; /* Updated with an atomic add */
+} Stress_Run;
+
+static void
+save_result(Stress_Result *result, const APEX_CPU *cpu, int status)
+{
+    result->pc = cpu->pc;
+    result->clock = cpu->clock;
+    result->insn_completed = cpu->insn_completed;
+    result->zero_flag = cpu->zero_flag;
+    result->status = status;
+    result->records = 0;
+    memcpy(result->regs, cpu->regs, sizeof(result->regs));
+    memcpy(result->data_memory, cpu->data_memory, sizeof(result->data_memory));
+}
+
+static int
+same_result(const Stress_Result *a, const Stress_Result *b)
+{
+    return a->pc == b->pc && a->clock == b->clock && a->insn_completed == b->insn_completed &&
+           a->zero_flag == b->zero_flag && a->status == b->status && a->records == b->records &&
+           memcmp(a->regs, b->regs, sizeof(a->regs)) == 0 &&
+           memcmp(a->data_memory, b->data_memory, sizeof(a->data_memory)) == 0;
+}
+
+/* Format of the stress log, counts the records on its writer thread */
+static void
+count_record(const APEX_Log_Record *record, void *arg)
+{
+    (void)record;
+    ++*(long *)arg;
+}
+
+/* Observer pushing what every stage held into its log, 'arg' is the log */
+static void
+log_stage(const APEX_CPU *cpu, APEX_Stage_Id id, const CPU_Stage *stage, void *arg)
+{
+    APEX_Log_Record record = {.kind = APEX_LOG_STAGE, .stage = id, .empty = !stage};
+
+    (void)cpu;
+    if (stage)
+    {
+        record.pc = stage->pc;
+        record.insn = stage->insn;
+    }
+    APEX_log_push(arg, &record);
+}
+
+static void
+log_sync(const APEX_CPU *cpu, void *arg)
+{
+    (void)cpu;
+    APEX_log_drain(arg);
+}
+
+/*
+ * Loads the program on a cpu of its own and runs the pipeline until HALT, a
+ * fault or max_cycles. An observed run sends every stage to an asynchronous
+ * log and saves how many records its writer thread formatted. Returns -1
+ * when the cpu or the log could not be set up.
+ */
+static int
+run_pipeline(const char *filename, const APEX_Config *config, int max_cycles, int observed, Stress_Result *result)
+{
+    APEX_CPU *cpu = APEX_cpu_init_with_config(filename, config);
+    APEX_Observer observer = {NULL, log_stage, NULL, log_sync, NULL, NULL};
+    long records = 0;
+    int stopped = APEX_CYCLE_RUNNING;
+
+    if (!cpu)
+    {
+        return -1;
+    }
+    if (observed)
+    {
+        observer.arg = APEX_log_open(count_record, &records, config->log_ring_size, APEX_LOG_BLOCK);
+        if (!observer.arg)
+        {
+            APEX_cpu_stop(cpu);
+            return -1;
+        }
+        APEX_cpu_add_observer(cpu, &observer);
+    }
+    while (stopped == APEX_CYCLE_RUNNING && cpu->clock < max_cycles)
+    {
+        stopped = APEX_cpu_cycle(cpu);
+    }
+    save_result(result, cpu, stopped);
+    if (observed)
+    {
+        APEX_cpu_remove_observer(cpu, &observer);
+        APEX_log_close(observer.arg);
+        result->records = records;
+    }
+    APEX_cpu_stop(cpu);
+    return 0;
+}
+
+/*
+ * Loads the program on a cpu of its own and runs the functional
+ * interpreter, every cpu translates the code for itself. Returns -1 when the
+ * cpu could not be set up.
+ */
+static int
+run_functional(const char *filename, const APEX_Config *config, long max_insns, Stress_Result *result)
+{
+    APEX_CPU *cpu = APEX_cpu_init_with_config(filename, config);
+
+    if (!cpu)
+    {
+        return -1;
+    }
+    save_result(result, cpu, APEX_cpu_run_functional(cpu, max_insns));
+    APEX_cpu_stop(cpu);
+    return 0;
+}
+
+static void *
+stress_worker(void *arg)
+{
+    Stress_Run *run = arg;
+    Stress_Result *result = malloc(sizeof(Stress_Result));
+    long mismatches = 0;
+    int i;
+
+    if (!result)
+    {
+        __atomic_fetch_add(&run->mismatches, 3L * run->runs, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    for (i = 0; i < run->runs; ++i)
+    {
+        mismatches += run_pipeline(run->filename, run->config, run->max_cycles, FALSE, result) != 0 ||
+                      !same_result(result, run->pipeline);
+        mismatches += run_pipeline(run->filename, run->config, run->max_cycles, TRUE, result) != 0 ||
+                      !same_result(result, run->observed);
+        mismatches += run_functional(run->filename, run->config, run->functional->insn_completed, result) != 0 ||
+                      !same_result(result, run->functional);
+    }
+    __atomic_fetch_add(&run->mismatches, mismatches, __ATOMIC_RELAXED);
+    free(result);
+    return NULL;
+}
+
+/*
+ * Runs the program on stress_cpus threads at once, each loads it on a cpu
+ * of its own stress_runs times for the pipeline (up to max_cycles), as many
+ * for the pipeline with an observer and as many for the functional
+ * interpreter, quiet whatever 'config' says.
+ * Returns 0 when every run ended in the same state as the reference run on
+ * this thread.
+ */
+int
+APEX_cpu_stress(const char *filename, const APEX_Config *config, int max_cycles)
+{
+    const int cpus = config->stress_cpus;
+    Stress_Result *pipeline = malloc(sizeof(Stress_Result));
+    Stress_Result *observed = malloc(sizeof(Stress_Result));
+    Stress_Result *functional = malloc(sizeof(Stress_Result));
+    pthread_t *workers = malloc(cpus * sizeof(pthread_t));
+    APEX_Config quiet_config = *config;
+    Stress_Run run;
+    int started = 0, i;
+
+    if (!pipeline || !observed || !functional || !workers)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the stress run\n");
+        free(pipeline);
+        free(observed);
+        free(functional);
+        free(workers);
+        return 1;
+    }
+    quiet_config.quiet = TRUE;
+
+    /* References, the functional one stops where the pipeline did */
+    if (run_pipeline(filename, &quiet_config, max_cycles, FALSE, pipeline) != 0 ||
+        run_pipeline(filename, &quiet_config, max_cycles, TRUE, observed) != 0 ||
+        run_functional(filename, &quiet_config, pipeline->insn_completed, functional) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
+        free(pipeline);
+        free(observed);
+        free(functional);
+        free(workers);
+        return 1;
+    }
+
+    run.filename = filename;
+    run.config = &quiet_config;
+    run.pipeline = pipeline;
+    run.observed = observed;
+    run.functional = functional;
+    run.max_cycles = max_cycles;
+    run.runs = config->stress_runs;
+    run.mismatches = 0;
+    for (i = 0; i < cpus; ++i)
+    {
+        if (pthread_create(&workers[i], NULL, stress_worker, &run) != 0)
+        {
+            fprintf(stderr, "APEX_Error: Unable to start stress thread %d\n", i);
+            break;
+        }
+        started++;
+    }
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    printf("APEX_STRESS: %d cpus x %d runs, pipeline cycles = %" PRId64 " instructions = %" PRId64
+           ", stage records = %ld, functional instructions = %" PRId64 "\n",
+           started, run.runs, pipeline->clock, pipeline->insn_completed, observed->records, functional->insn_completed);
+    printf("APEX_STRESS: %ld of %ld runs differ from the reference\n", run.mismatches, 3L * started * run.runs);
+
+    free(pipeline);
+    free(observed);
+    free(functional);
+    free(workers);
+    return run.mismatches == 0 && started == cpus ? 0 : 1;
+}
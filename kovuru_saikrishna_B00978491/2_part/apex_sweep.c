@@ -0,0 +1,285 @@
+/*
+ * apex_sweep.c
+ * Contains the parameter sweep, the program is simulated under every
+ * combination of the run-time options in a matrix file and one table row
+ * is printed per combination. All the cpus share the code image of the
+ * cpu the program was loaded into, read-only.
+ *
+ * Matrix file, one option per line (# starts a comment):
+ *
+ *   <name>=<value>[,<value> ...]
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+#define SWEEP_MAX_AXES 16
+#define SWEEP_MAX_VALUES 64
+#define SWEEP_MAX_POINTS 65536
+#define SWEEP_LINE_SIZE 1024
+#define SWEEP_NAME_SIZE 64
+
+/* One option of the matrix and the values it takes */
+typedef struct Sweep_Axis
+{
+    char name[SWEEP_NAME_SIZE];
+    int count;
+    long values[SWEEP_MAX_VALUES];
+} Sweep_Axis;
+
+/* One combination and what its run found */
+typedef struct Sweep_Point
+{
+    APEX_Config config;
+    int halted; /* APEX_CYCLE_HALTED or APEX_CYCLE_FAULT when the run stopped before max_cycles */
+    int64_t cycles;
+    int64_t insn_completed;
+    int64_t stall_data;
+    int64_t stall_forwarded;
+    int64_t stall_structural;
+    int64_t flushes;
+} Sweep_Point;
+
+typedef struct Sweep_Run
+{
+    const APEX_CPU *master;
+    Sweep_Point *points;
+    long count;
+    int max_cycles;
+    long next; /* Next point to hand out, taken with an atomic add */
+} Sweep_Run;
+
+/*
+ * Reads the matrix file into 'axes'. Returns the number of axes or -1 on
+ * error.
+ */
+static int
+read_matrix(const char *filename, Sweep_Axis *axes)
+{
+    char line[SWEEP_LINE_SIZE];
+    int count = 0, line_no = 0;
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to open sweep matrix %s\n", filename);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *comment = strchr(line, '#');
+        char *name, *values, *value, *end, *save;
+        Sweep_Axis *axis;
+
+        line_no++;
+        if (comment)
+        {
+            *comment = '\0';
+        }
+        name = strtok_r(line, " \t\r\n=", &save);
+        if (!name)
+        {
+            continue;
+        }
+        values = strtok_r(NULL, "=\r\n", &save);
+        if (!values || count == SWEEP_MAX_AXES || strlen(name) >= SWEEP_NAME_SIZE)
+        {
+            fprintf(stderr, "APEX_Error: %s:%d is not <name>=<value>[,<value> ...]\n", filename, line_no);
+            fclose(fp);
+            return -1;
+        }
+        axis = &axes[count++];
+        strcpy(axis->name, name);
+        axis->count = 0;
+        for (value = strtok_r(values, ", \t", &save); value; value = strtok_r(NULL, ", \t", &save))
+        {
+            if (axis->count == SWEEP_MAX_VALUES)
+            {
+                fprintf(stderr, "APEX_Error: %s:%d has more than %d values\n", filename, line_no,
+                        SWEEP_MAX_VALUES);
+                fclose(fp);
+                return -1;
+            }
+            axis->values[axis->count] = strtol(value, &end, 0);
+            if (*end != '\0')
+            {
+                fprintf(stderr, "APEX_Error: %s:%d value '%s' is not a number\n", filename, line_no, value);
+                fclose(fp);
+                return -1;
+            }
+            axis->count++;
+        }
+        if (axis->count == 0)
+        {
+            fprintf(stderr, "APEX_Error: %s:%d has no values\n", filename, line_no);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+static void *
+sweep_worker(void *arg)
+{
+    Sweep_Run *run = arg;
+    APEX_CPU *cpu = malloc(sizeof(APEX_CPU));
+    long i;
+
+    if (!cpu)
+    {
+        return NULL;
+    }
+    while ((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->count)
+    {
+        Sweep_Point *point = &run->points[i];
+        int halted = FALSE;
+
+        APEX_cpu_start_detailed(cpu, run->master);
+        cpu->config = point->config;
+        while (!halted && cpu->clock < run->max_cycles)
+        {
+            halted = APEX_cpu_cycle(cpu);
+        }
+        point->halted = halted;
+        point->cycles = halted ? cpu->clock + 1 : cpu->clock;
+        point->insn_completed = cpu->insn_completed;
+        point->stall_data = cpu->stats.stall_data;
+        point->stall_forwarded = cpu->stats.stall_forwarded;
+        point->stall_structural = cpu->stats.stall_structural;
+        point->flushes = cpu->stats.flushes;
+    }
+    free(cpu);
+    return NULL;
+}
+
+/*
+ * Simulates the program from the state of 'master' under every
+ * combination of the options in 'matrix_file', up to max_cycles each, and
+ * prints a table of the results. Returns 0 on success, 1 when a combination
+ * could not run or stopped on a fault.
+ */
+int
+APEX_cpu_sweep(const APEX_CPU *master, int max_cycles, const char *matrix_file)
+{
+    Sweep_Axis axes[SWEEP_MAX_AXES];
+    Sweep_Run run;
+    pthread_t *workers;
+    int axis_count, threads, started = 0, a;
+    long count = 1, faults = 0, i;
+
+    axis_count = read_matrix(matrix_file, axes);
+    if (axis_count < 0)
+    {
+        return 1;
+    }
+    for (a = 0; a < axis_count; ++a)
+    {
+        count *= axes[a].count;
+        if (count > SWEEP_MAX_POINTS)
+        {
+            fprintf(stderr, "APEX_Error: the sweep has more than %d combinations\n", SWEEP_MAX_POINTS);
+            return 1;
+        }
+    }
+
+    run.points = malloc(count * sizeof(Sweep_Point));
+    if (!run.points)
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate the sweep\n");
+        return 1;
+    }
+    /* Point i takes value (i / stride) % count of every axis, the last axis changes fastest */
+    for (i = 0; i < count; ++i)
+    {
+        Sweep_Point *point = &run.points[i];
+        long stride = 1;
+
+        memset(point, 0, sizeof(Sweep_Point));
+        point->config = master->config;
+        for (a = axis_count - 1; a >= 0; --a)
+        {
+            char option[SWEEP_NAME_SIZE + 32];
+
+            snprintf(option, sizeof(option), "%s=%ld", axes[a].name, axes[a].values[(i / stride) % axes[a].count]);
+            if (APEX_config_set(&point->config, option) != 0)
+            {
+                free(run.points);
+                return 1;
+            }
+            stride *= axes[a].count;
+        }
+    }
+
+    run.master = master;
+    run.count = count;
+    run.max_cycles = max_cycles;
+    run.next = 0;
+    threads = APEX_config_resolve_threads(master->config.sweep_threads);
+    if (threads > count)
+    {
+        threads = count;
+    }
+    workers = malloc(threads * sizeof(pthread_t));
+    for (i = 0; workers && i < threads; ++i)
+    {
+        if (pthread_create(&workers[i], NULL, sweep_worker, &run) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    /* Whatever could not be handed to a thread runs here */
+    if (started == 0)
+    {
+        sweep_worker(&run);
+    }
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    printf("APEX_SWEEP: %ld configurations on %d threads, up to %d cycles each\n", count, started ? started : 1,
+           max_cycles);
+    for (a = 0; a < axis_count; ++a)
+    {
+        printf("%-16s ", axes[a].name);
+    }
+    printf("%-8s %-12s %-12s %-8s %-12s %-12s %-12s %-12s\n", "status", "cycles", "insns", "CPI", "data_stall",
+           "fwd_saved", "fu_stall", "flushes");
+    for (i = 0; i < count; ++i)
+    {
+        const Sweep_Point *point = &run.points[i];
+        long stride = 1;
+        long values[SWEEP_MAX_AXES];
+
+        for (a = axis_count - 1; a >= 0; --a)
+        {
+            values[a] = axes[a].values[(i / stride) % axes[a].count];
+            stride *= axes[a].count;
+        }
+        for (a = 0; a < axis_count; ++a)
+        {
+            printf("%-16ld ", values[a]);
+        }
+        faults += point->halted == APEX_CYCLE_FAULT;
+        printf("%-8s %-12" PRId64 " %-12" PRId64 " %-8.4f %-12" PRId64 " %-12" PRId64 " %-12" PRId64
+               " %-12" PRId64 "\n",
+               point->halted == APEX_CYCLE_FAULT ? "fault" : (point->halted ? "halted" : "limit"), point->cycles,
+               point->insn_completed, point->insn_completed ? (double)point->cycles / point->insn_completed : 0.0,
+               point->stall_data, point->stall_forwarded, point->stall_structural, point->flushes);
+    }
+    free(run.points);
+    return faults ? 1 : 0;
+}
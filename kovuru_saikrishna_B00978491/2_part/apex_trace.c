@@ -0,0 +1,353 @@
+/*
+ * apex_trace.c
+ * Contains the writer and the reader of the binary pipeline trace. The
+ * writer is an observer of the cycle engine that encodes every stage
+ * record into a large buffer and only writes the file when it is full.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_isa.h"
+#include "apex_macros.h"
+#include "apex_trace.h"
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+/* Longest record: tag, cycle delta, pc delta, opcode and five values */
+#define TRACE_MAX_RECORD (1 + 10 + 5 + 1 + 5 * 5)
+
+struct APEX_Trace_Writer
+{
+    FILE *fp;
+    APEX_Observer observer;
+    int64_t cycle;               /* Cycle of the last record */
+    int pc[APEX_STAGE_COUNT];    /* pc of the last record of every stage */
+    long records;
+    int error;
+    size_t used;
+    unsigned char buffer[TRACE_BUFFER_SIZE];
+};
+
+struct APEX_Trace_Reader
+{
+    FILE *fp;
+    int64_t cycle;
+    int pc[APEX_STAGE_COUNT];
+    long records;
+};
+
+static const char *const trace_stage_names[APEX_STAGE_COUNT] = {"fetch", "decode", "int", "mul", "load",
+                                                                "writeback", "div"};
+
+const char *
+APEX_trace_stage_name(int stage)
+{
+    return stage >= 0 && stage < APEX_STAGE_COUNT ? trace_stage_names[stage] : "?";
+}
+
+/*
+ * Latch values worth recording for an opcode in a stage, operands are only
+ * read in decode and results only exist from the FUs on
+ */
+unsigned int
+APEX_trace_fields(int opcode, int stage)
+{
+    const APEX_Opcode_Info *info;
+    unsigned int fields = 0;
+
+    if (opcode < 0 || opcode >= APEX_OPCODE_LIMIT || stage == APEX_STAGE_FETCH)
+    {
+        return 0;
+    }
+    info = &apex_isa[opcode];
+    fields |= (info->src & OPND_RS1) ? APEX_TRACE_RS1 : 0;
+    fields |= (info->src & OPND_RS2) ? APEX_TRACE_RS2 : 0;
+    fields |= (info->src & OPND_RS3) ? APEX_TRACE_RS3 : 0;
+    if (stage != APEX_STAGE_DECODE)
+    {
+        fields |= ((info->dst & OPND_RD) || info->mem == MEM_STORE) ? APEX_TRACE_RESULT : 0;
+        fields |= info->mem != MEM_NONE ? APEX_TRACE_ADDRESS : 0;
+    }
+    return fields;
+}
+
+static unsigned char *
+put_varint(unsigned char *p, unsigned long value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+static unsigned char *
+put_zigzag(unsigned char *p, long value)
+{
+    return put_varint(p, ((unsigned long)value << 1) ^ (unsigned long)(value >> (sizeof(long) * 8 - 1)));
+}
+
+static void
+flush_buffer(APEX_Trace_Writer *writer)
+{
+    if (writer->used && fwrite(writer->buffer, 1, writer->used, writer->fp) != writer->used)
+    {
+        writer->error = TRUE;
+    }
+    writer->used = 0;
+}
+
+static void
+record_stage(const APEX_CPU *cpu, APEX_Stage_Id id, const CPU_Stage *stage, void *arg)
+{
+    APEX_Trace_Writer *writer = arg;
+    const int64_t cycle = cpu->clock + 1;
+    unsigned int fields;
+    unsigned char *p;
+    int opcode;
+
+    if (!stage)
+    {
+        return;
+    }
+    opcode = cpu->code_memory[stage->insn].opcode;
+    if (writer->used + TRACE_MAX_RECORD > TRACE_BUFFER_SIZE)
+    {
+        flush_buffer(writer);
+    }
+    p = writer->buffer + writer->used;
+
+    *p++ = id | (cycle != writer->cycle ? APEX_TRACE_TAG_CYCLE : 0);
+    if (cycle != writer->cycle)
+    {
+        p = put_varint(p, cycle - writer->cycle);
+        writer->cycle = cycle;
+    }
+    p = put_zigzag(p, (long)stage->pc - writer->pc[id]);
+    writer->pc[id] = stage->pc;
+    *p++ = (unsigned char)opcode;
+
+    fields = APEX_trace_fields(opcode, id);
+    if (fields & APEX_TRACE_RS1)
+    {
+        p = put_zigzag(p, stage->rs1_value);
+    }
+    if (fields & APEX_TRACE_RS2)
+    {
+        p = put_zigzag(p, stage->rs2_value);
+    }
+    if (fields & APEX_TRACE_RS3)
+    {
+        p = put_zigzag(p, stage->rs3_value);
+    }
+    if (fields & APEX_TRACE_RESULT)
+    {
+        p = put_zigzag(p, stage->result_buffer);
+    }
+    if (fields & APEX_TRACE_ADDRESS)
+    {
+        p = put_zigzag(p, stage->memory_address);
+    }
+    writer->used = p - writer->buffer;
+    writer->records++;
+}
+
+/*
+ * Creates 'filename' and returns a writer whose observer (see
+ * APEX_trace_observer) records the cycles of 'cpu', NULL on error
+ */
+APEX_Trace_Writer *
+APEX_trace_open(const char *filename, const APEX_CPU *cpu)
+{
+    APEX_Trace_Writer *writer = calloc(1, sizeof(APEX_Trace_Writer));
+    APEX_Trace_Header header;
+
+    if (!writer)
+    {
+        return NULL;
+    }
+    writer->fp = fopen(filename, "wb");
+    if (!writer->fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", filename);
+        free(writer);
+        return NULL;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, APEX_TRACE_MAGIC, sizeof(APEX_TRACE_MAGIC));
+    header.version = APEX_TRACE_VERSION;
+    header.code_count = cpu->code_memory_size;
+    memcpy(writer->buffer, &header, sizeof(header));
+    writer->used = sizeof(header);
+    /* The first record of every stage is a delta from the first pc */
+    for (int i = 0; i < APEX_STAGE_COUNT; ++i)
+    {
+        writer->pc[i] = 4000;
+    }
+    writer->observer.stage = record_stage;
+    writer->observer.arg = writer;
+    return writer;
+}
+
+APEX_Observer *
+APEX_trace_observer(APEX_Trace_Writer *writer)
+{
+    return &writer->observer;
+}
+
+/*
+ * Ends the trace and frees the writer. Returns the number of records
+ * written, -1 if the file could not be written.
+ */
+long
+APEX_trace_close(APEX_Trace_Writer *writer)
+{
+    long records = writer->records;
+    unsigned char *p;
+    int error;
+
+    if (writer->used + TRACE_MAX_RECORD > TRACE_BUFFER_SIZE)
+    {
+        flush_buffer(writer);
+    }
+    p = writer->buffer + writer->used;
+    *p++ = APEX_TRACE_TAG_END;
+    p = put_varint(p, records);
+    writer->used = p - writer->buffer;
+    flush_buffer(writer);
+    error = fclose(writer->fp) != 0 || writer->error;
+    free(writer);
+    return error ? -1 : records;
+}
+
+/* Opens a trace for reading, NULL if it is not a trace */
+APEX_Trace_Reader *
+APEX_trace_reader_open(const char *filename)
+{
+    APEX_Trace_Reader *reader;
+    APEX_Trace_Header header;
+    FILE *fp = fopen(filename, "rb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to open trace %s\n", filename);
+        return NULL;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, APEX_TRACE_MAGIC, sizeof(APEX_TRACE_MAGIC)) != 0 ||
+        header.version != APEX_TRACE_VERSION)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a version %d APEX trace\n", filename, APEX_TRACE_VERSION);
+        fclose(fp);
+        return NULL;
+    }
+    reader = calloc(1, sizeof(APEX_Trace_Reader));
+    if (!reader)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    reader->fp = fp;
+    for (int i = 0; i < APEX_STAGE_COUNT; ++i)
+    {
+        reader->pc[i] = 4000;
+    }
+    return reader;
+}
+
+static int
+get_varint(FILE *fp, unsigned long *value)
+{
+    int shift = 0, c;
+
+    *value = 0;
+    do
+    {
+        c = getc(fp);
+        if (c == EOF || shift > 63)
+        {
+            return -1;
+        }
+        *value |= (unsigned long)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 0;
+}
+
+static int
+get_zigzag(FILE *fp, int *value)
+{
+    unsigned long raw;
+
+    if (get_varint(fp, &raw) != 0)
+    {
+        return -1;
+    }
+    *value = (int)(long)((raw >> 1) ^ -(raw & 1));
+    return 0;
+}
+
+/*
+ * Reads the next record. Returns 1 for a record, 0 at the end of the trace
+ * and -1 if the trace is truncated or corrupt.
+ */
+int
+APEX_trace_read(APEX_Trace_Reader *reader, APEX_Trace_Record *record)
+{
+    unsigned long delta;
+    int tag = getc(reader->fp);
+    int pc_delta, opcode;
+
+    if (tag == APEX_TRACE_TAG_END)
+    {
+        return get_varint(reader->fp, &delta) == 0 && (long)delta == reader->records ? 0 : -1;
+    }
+    if (tag == EOF || (tag & 0x07) >= APEX_STAGE_COUNT || (tag & ~0x0f))
+    {
+        return -1;
+    }
+    memset(record, 0, sizeof(*record));
+    record->stage = tag & 0x07;
+    if (tag & APEX_TRACE_TAG_CYCLE)
+    {
+        if (get_varint(reader->fp, &delta) != 0)
+        {
+            return -1;
+        }
+        reader->cycle += delta;
+    }
+    record->cycle = reader->cycle;
+    if (get_zigzag(reader->fp, &pc_delta) != 0 || (opcode = getc(reader->fp)) == EOF)
+    {
+        return -1;
+    }
+    reader->pc[record->stage] += pc_delta;
+    record->pc = reader->pc[record->stage];
+    record->opcode = opcode;
+
+    record->fields = APEX_trace_fields(opcode, record->stage);
+    if (((record->fields & APEX_TRACE_RS1) && get_zigzag(reader->fp, &record->rs1_value) != 0) ||
+        ((record->fields & APEX_TRACE_RS2) && get_zigzag(reader->fp, &record->rs2_value) != 0) ||
+        ((record->fields & APEX_TRACE_RS3) && get_zigzag(reader->fp, &record->rs3_value) != 0) ||
+        ((record->fields & APEX_TRACE_RESULT) && get_zigzag(reader->fp, &record->result_buffer) != 0) ||
+        ((record->fields & APEX_TRACE_ADDRESS) && get_zigzag(reader->fp, &record->memory_address) != 0))
+    {
+        return -1;
+    }
+    reader->records++;
+    return 1;
+}
+
+void
+APEX_trace_reader_close(APEX_Trace_Reader *reader)
+{
+    fclose(reader->fp);
+    free(reader);
+}
@@ -0,0 +1,83 @@
+/*
+ * apex_trace.h
+ * Contains the binary pipeline trace (.apextrc), a record of what every
+ * stage held in every cycle, written by an observer of the cycle engine
+ * and read back by the apex_trace tool
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "apex_cpu.h"
+
+#define APEX_TRACE_MAGIC "APEXTRC"
+#define APEX_TRACE_VERSION 1
+
+/*
+ * Layout of a trace file:
+ *
+ *   header | records | end tag | record count (varint)
+ *
+ * A record is a tag byte, stage id in the low 3 bits and bit 3 set when the
+ * cycle moved on since the previous record (the cycle delta follows as a
+ * varint), then the pc as a zigzag varint delta from the previous record
+ * of the same stage, the opcode byte and the latch values the stage has
+ * for that opcode (see APEX_trace_fields) as zigzag varints. Empty stages
+ * are not recorded.
+ */
+typedef struct APEX_Trace_Header
+{
+  char magic[8];       /* APEX_TRACE_MAGIC, NUL padded */
+  uint32_t version;    /* APEX_TRACE_VERSION */
+  uint32_t code_count; /* Instructions of the traced program */
+} APEX_Trace_Header;
+
+#define APEX_TRACE_TAG_CYCLE 0x08
+#define APEX_TRACE_TAG_END 0xff
+
+/* Latch values a record may hold */
+enum
+{
+  APEX_TRACE_RS1 = 1 << 0,
+  APEX_TRACE_RS2 = 1 << 1,
+  APEX_TRACE_RS3 = 1 << 2,
+  APEX_TRACE_RESULT = 1 << 3,
+  APEX_TRACE_ADDRESS = 1 << 4
+};
+
+/* One decoded record */
+typedef struct APEX_Trace_Record
+{
+  int64_t cycle; /* 1-based, as the display prints it */
+  int stage;     /* APEX_Stage_Id */
+  int pc;
+  int opcode;
+  unsigned int fields; /* APEX_TRACE_* values present */
+  int rs1_value;
+  int rs2_value;
+  int rs3_value;
+  int result_buffer;
+  int memory_address;
+} APEX_Trace_Record;
+
+typedef struct APEX_Trace_Writer APEX_Trace_Writer;
+typedef struct APEX_Trace_Reader APEX_Trace_Reader;
+
+unsigned int APEX_trace_fields(int opcode, int stage);
+const char *APEX_trace_stage_name(int stage);
+
+APEX_Trace_Writer *APEX_trace_open(const char *filename, const APEX_CPU *cpu);
+APEX_Observer *APEX_trace_observer(APEX_Trace_Writer *writer);
+long APEX_trace_close(APEX_Trace_Writer *writer);
+
+APEX_Trace_Reader *APEX_trace_reader_open(const char *filename);
+int APEX_trace_read(APEX_Trace_Reader *reader, APEX_Trace_Record *record);
+void APEX_trace_reader_close(APEX_Trace_Reader *reader);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * apex_trace_tool.c
+ * Contains the apex_trace tool, it decodes a binary pipeline trace written
+ * by the trace mode of apex_sim and prints the records, optionally only
+ * those of a pc range, a cycle range or some of the stages.
+ *
+ *   apex_trace <trace.apextrc> [pc=LO-HI] [cycles=LO-HI] [stage=<name>[,<name> ...]]
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_isa.h"
+#include "apex_macros.h"
+#include "apex_trace.h"
+
+typedef struct Trace_Filter
+{
+    long pc_lo, pc_hi;
+    long cycle_lo, cycle_hi;
+    unsigned int stages; /* Bit per APEX_Stage_Id */
+} Trace_Filter;
+
+/* Parses "LO-HI", "LO-" or "-HI" into *lo and *hi. Returns 0 on success. */
+static int
+parse_range(const char *text, long *lo, long *hi)
+{
+    const char *dash = strchr(text, '-');
+    char *end;
+
+    if (!dash)
+    {
+        return -1;
+    }
+    if (dash != text)
+    {
+        *lo = strtol(text, &end, 0);
+        if (end != dash)
+        {
+            return -1;
+        }
+    }
+    if (dash[1] != '\0')
+    {
+        *hi = strtol(dash + 1, &end, 0);
+        if (*end != '\0')
+        {
+            return -1;
+        }
+    }
+    return *lo <= *hi ? 0 : -1;
+}
+
+static int
+parse_stages(const char *text, unsigned int *stages)
+{
+    char names[256];
+    char *name, *save;
+
+    if (strlen(text) >= sizeof(names))
+    {
+        return -1;
+    }
+    strcpy(names, text);
+    *stages = 0;
+    for (name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save))
+    {
+        int stage;
+
+        for (stage = 0; stage < APEX_STAGE_COUNT; ++stage)
+        {
+            if (strcmp(name, APEX_trace_stage_name(stage)) == 0)
+            {
+                break;
+            }
+        }
+        if (stage == APEX_STAGE_COUNT)
+        {
+            return -1;
+        }
+        *stages |= 1u << stage;
+    }
+    return *stages ? 0 : -1;
+}
+
+static void
+print_record(const APEX_Trace_Record *record)
+{
+    const char *mnemonic = record->opcode < APEX_OPCODE_LIMIT ? get_opcode_str(record->opcode) : NULL;
+
+    printf("%-8" PRId64 " %-10s pc(%d) %s", record->cycle, APEX_trace_stage_name(record->stage), record->pc,
+           mnemonic ? mnemonic : "?");
+    if (record->fields & APEX_TRACE_RS1)
+    {
+        printf(" rs1=%d", record->rs1_value);
+    }
+    if (record->fields & APEX_TRACE_RS2)
+    {
+        printf(" rs2=%d", record->rs2_value);
+    }
+    if (record->fields & APEX_TRACE_RS3)
+    {
+        printf(" rs3=%d", record->rs3_value);
+    }
+    if (record->fields & APEX_TRACE_RESULT)
+    {
+        printf(" result=%d", record->result_buffer);
+    }
+    if (record->fields & APEX_TRACE_ADDRESS)
+    {
+        printf(" addr=%d", record->memory_address);
+    }
+    printf("\n");
+}
+
+static void
+print_usage(const char *program)
+{
+    fprintf(stderr, "APEX_Help: Usage %s <trace.apextrc> [pc=LO-HI] [cycles=LO-HI] [stage=<name>[,<name> ...]]\n",
+            program);
+    fprintf(stderr, "APEX_Help: stages are fetch, decode, int, mul, div, load and writeback\n");
+}
+
+int
+main(int argc, char const *argv[])
+{
+    Trace_Filter filter = {LONG_MIN, LONG_MAX, LONG_MIN, LONG_MAX, (1u << APEX_STAGE_COUNT) - 1};
+    APEX_Trace_Reader *reader;
+    APEX_Trace_Record record;
+    long records_read = 0, shown = 0;
+    int status, i;
+
+    if (argc < 2)
+    {
+        print_usage(argv[0]);
+        exit(1);
+    }
+    for (i = 2; i < argc; ++i)
+    {
+        int ok;
+
+        if (strncmp(argv[i], "pc=", 3) == 0)
+        {
+            ok = parse_range(argv[i] + 3, &filter.pc_lo, &filter.pc_hi) == 0;
+        }
+        else if (strncmp(argv[i], "cycles=", 7) == 0)
+        {
+            ok = parse_range(argv[i] + 7, &filter.cycle_lo, &filter.cycle_hi) == 0;
+        }
+        else if (strncmp(argv[i], "stage=", 6) == 0)
+        {
+            ok = parse_stages(argv[i] + 6, &filter.stages) == 0;
+        }
+        else
+        {
+            ok = FALSE;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "APEX_Error: bad filter '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    reader = APEX_trace_reader_open(argv[1]);
+    if (!reader)
+    {
+        exit(1);
+    }
+    while ((status = APEX_trace_read(reader, &record)) > 0)
+    {
+        records_read++;
+        /* Records are in cycle order, nothing after the range can match */
+        if (record.cycle > filter.cycle_hi)
+        {
+            status = 0;
+            break;
+        }
+        if (record.cycle < filter.cycle_lo || record.pc < filter.pc_lo || record.pc > filter.pc_hi ||
+            !(filter.stages & (1u << record.stage)))
+        {
+            continue;
+        }
+        print_record(&record);
+        shown++;
+    }
+    APEX_trace_reader_close(reader);
+    if (status < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is truncated or corrupt after %ld records\n", argv[1], records_read);
+        return 1;
+    }
+    fprintf(stderr, "APEX_TRACE: %ld records shown of %ld read\n", shown, records_read);
+    return 0;
+}
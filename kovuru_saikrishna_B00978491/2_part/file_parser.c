@@ -7,323 +7,579 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
-#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "apex_cpu.h"
 #include "apex_macros.h"
 
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * This function is related to parsing input file, it returns the number that
+ * follows the register or immediate prefix of an operand ("R12", "#-56").
+ * The operand is not NUL terminated, it ends at 'end'.
  */
 static int
-get_num_from_string(const char *buffer)
+get_num_from_string(const char *p, const char *end)
 {
-    char str[16];
-    int i, j = 0;
+    int value = 0;
+    int negative = 0;
 
-    for (i = 1; buffer[i] != '\0'; ++i)
+    while (p < end && (*p == ' ' || *p == '\t'))
     {
-        str[j] = buffer[i];
-        j++;
+        p++;
     }
-    str[j] = '\0';
 
-    return atoi(str);
+    // skipping the 'R' or '#' prefix, the rest is read like atoi would.
+    if (p < end)
+    {
+        p++;
+    }
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+
+    return negative ? -value : value;
 }
 
 /*
  * This function sets the numeric opcode to an instruction based on string value
  *
- * Note : you can edit this function to add new instructions
+ * Note : new instructions are added to APEX_ISA_TABLE in apex_isa.h
  */
 static int
-set_opcode_str(const char *opcode_str)
+set_opcode_str(const char *opcode_str, int len)
 {
-    if (strcmp(opcode_str, "ADD") == 0)
-    {
-        return OPCODE_ADD;
-    }
-
-    if (strcmp(opcode_str, "ADDL") == 0)
-    {
-        return OPCODE_ADDL;
-    }
+    int opcode;
 
-    if (strcmp(opcode_str, "SUB") == 0)
+    // the line ending can still be attached ("HALT\r"), so it is trimmed before
+    // looking the mnemonic up.
+    while (len > 0 && (opcode_str[len - 1] == '\n' || opcode_str[len - 1] == '\r'))
     {
-        return OPCODE_SUB;
+        len--;
     }
 
-    if (strcmp(opcode_str, "SUBL") == 0)
+    opcode = apex_isa_lookup(opcode_str, len);
+    if (opcode < 0)
     {
-        return OPCODE_SUBL;
-    }
-
-    if (strcmp(opcode_str, "MUL") == 0)
-    {
-        return OPCODE_MUL;
-    }
-
-    if (strcmp(opcode_str, "DIV") == 0)
-    {
-        return OPCODE_DIV;
+        // an unknown mnemonic is reported by the caller, which knows the line it is on.
+        return -1;
     }
+    return opcode;
+}
 
-    if (strcmp(opcode_str, "AND") == 0)
-    {
-        return OPCODE_AND;
+/*
+ * This function is related to parsing input file, it returns -1 when the
+ * mnemonic of the line is not in the ISA table or a register is out of range
+ *
+ * Note : you can edit this function to add new instructions
+ */
+static int
+create_APEX_instruction(APEX_Instruction *ins, const char *line, const char *end, int line_number)
+{
+    const char *p = line;
+    const char *mnemonic;
+    const unsigned char *field;
+    int opcode;
+
+    /* The mnemonic is everything up to the first space or the line ending */
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    mnemonic = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+    {
+        p++;
+    }
+    opcode = set_opcode_str(mnemonic, p - mnemonic);
+    if (opcode < 0)
+    {
+        fprintf(stderr, "APEX_Error: line %d: unknown instruction \"%.*s\"\n", line_number, (int)(p - mnemonic),
+                mnemonic);
+        return -1;
+    }
+    ins->opcode = opcode;
+
+    /* Operands are comma separated and filled in the order the instruction
+     * format lists them, they are parsed in place without copying the line */
+    field = apex_isa_format_fields[apex_isa[ins->opcode].format];
+    while (p < end && *field)
+    {
+        const char *comma = memchr(p, ',', end - p);
+        const char *operand_end = comma ? comma : end;
+        int value = get_num_from_string(p, operand_end);
+
+        // register numbers are checked before they are narrowed to the unsigned char fields,
+        // a register past the file would otherwise index past regs[] in every stage.
+        if (*field != OPND_IMM && (value < 0 || value >= REG_FILE_SIZE))
+        {
+            fprintf(stderr, "APEX_Error: line %d: register R%d is outside R0-R%d\n", line_number, value,
+                    REG_FILE_SIZE - 1);
+            return -1;
+        }
+
+        switch (*field)
+        {
+        case OPND_RD:
+            ins->rd = value;
+            break;
+        case OPND_RS1:
+            ins->rs1 = value;
+            break;
+        case OPND_RS2:
+            ins->rs2 = value;
+            break;
+        case OPND_RS3:
+            ins->rs3 = value;
+            break;
+        case OPND_IMM:
+            ins->imm = value;
+            break;
+        }
+
+        field++;
+        p = comma ? comma + 1 : end;
     }
+    return 0;
+}
 
-    if (strcmp(opcode_str, "OR") == 0)
-    {
-        return OPCODE_OR;
-    }
+/*
+ * Parses the line starting at p into ins and returns the start of the next
+ * line, or NULL when the line is not a valid instruction. Keeps no state of
+ * its own, so chunks can be parsed concurrently.
+ */
+static const char *
+parse_next_line(APEX_Instruction *ins, const char *p, const char *end, int line_number)
+{
+    const char *eol = memchr(p, '\n', end - p);
 
-    if (strcmp(opcode_str, "EXOR") == 0)
+    memset(ins, 0, sizeof(APEX_Instruction));
+    if (create_APEX_instruction(ins, p, eol ? eol : end, line_number) < 0)
     {
-        return OPCODE_XOR;
+        return NULL;
     }
+    return eol ? eol + 1 : end;
+}
 
-    if (strcmp(opcode_str, "MOVC") == 0)
-    {
-        return OPCODE_MOVC;
-    }
+/*
+ * Parses a whole program held in memory, one instruction per line, in a
+ * single pass. Code memory grows geometrically as lines are found.
+ */
+static APEX_Instruction *
+create_code_memory_from_buffer(const char *buffer, size_t len, int *size)
+{
+    const char *p = buffer;
+    const char *end = buffer + len;
+    int code_memory_size = 0;
+    // most lines are around 12 characters, so this guess avoids most of the regrowing.
+    size_t capacity = len / 12 + 16;
+    APEX_Instruction *code_memory;
 
-    if (strcmp(opcode_str, "LOAD") == 0)
+    code_memory = malloc(capacity * sizeof(APEX_Instruction));
+    if (!code_memory)
     {
-        return OPCODE_LOAD;
+        return NULL;
     }
 
-    if (strcmp(opcode_str, "STORE") == 0)
-    {
-        return OPCODE_STORE;
+    while (p < end)
+    {
+        if ((size_t)code_memory_size == capacity)
+        {
+            APEX_Instruction *grown;
+
+            capacity *= 2;
+            grown = realloc(code_memory, capacity * sizeof(APEX_Instruction));
+            if (!grown)
+            {
+                free(code_memory);
+                return NULL;
+            }
+            code_memory = grown;
+        }
+
+        // line numbers in error messages start at 1, like an editor shows them.
+        p = parse_next_line(&code_memory[code_memory_size], p, end, code_memory_size + 1);
+        if (!p)
+        {
+            free(code_memory);
+            return NULL;
+        }
+        code_memory_size++;
     }
 
-    if (strcmp(opcode_str, "BZ") == 0)
+    *size = code_memory_size;
+    if (!code_memory_size)
     {
-        return OPCODE_BZ;
+        free(code_memory);
+        return NULL;
     }
 
-    if (strcmp(opcode_str, "BNZ") == 0)
-    {
-        return OPCODE_BNZ;
-    }
+    /* Give back the unused tail of the last growth step */
+    APEX_Instruction *shrunk = realloc(code_memory, code_memory_size * sizeof(APEX_Instruction));
+    return shrunk ? shrunk : code_memory;
+}
 
-    // used strncmp because for some reason HALT instruction is not being recognized when it's placed
-    //   in between so used strncmp to over come that. strncmp checks the two strings and letter by letter
-    // since there are 4 letters in the HALT i compated with 4 in strncmp.
-    if (strncmp(opcode_str, "HALT", 4) == 0)
-    {
-        return OPCODE_HALT;
-    }
+/* Chunks smaller than this are not worth a thread of their own */
+#define MIN_PARSE_CHUNK_BYTES (256 * 1024)
 
-    if (strcmp(opcode_str, "LDR") == 0)
-    {
-        return OPCODE_LDR;
-    }
+/* Slice of the input file parsed by one thread */
+typedef struct Parse_Chunk
+{
+    const char *begin;
+    const char *end;
+    int first_line;                /* Index of the chunk's first line in code memory */
+    int num_lines;                 /* Lines in the chunk */
+    int failed;                    /* Set when a line of the chunk is not a valid instruction */
+    APEX_Instruction *code_memory; /* Whole code memory, shared by all chunks */
+} Parse_Chunk;
+
+static void *
+count_chunk_lines(void *arg)
+{
+    Parse_Chunk *chunk = arg;
+    const char *p = chunk->begin;
 
-    if (strcmp(opcode_str, "STR") == 0)
+    chunk->num_lines = 0;
+    while (p < chunk->end)
     {
-        return OPCODE_STR;
-    }
+        const char *eol = memchr(p, '\n', chunk->end - p);
 
-    if (strcmp(opcode_str, "CMP") == 0)
-    {
-        return OPCODE_CMP;
+        chunk->num_lines++;
+        p = eol ? eol + 1 : chunk->end;
     }
+    return NULL;
+}
 
-    // used strncmp because for some reason HALT instruction is not being recognized when it's placed
-    //   in between so used strncmp to over come that. strncmp checks the two strings and letter by letter
-    // since there are 4 letters in the NOP i compated with 3 in strncmp.
+static void *
+parse_chunk(void *arg)
+{
+    Parse_Chunk *chunk = arg;
+    const char *p = chunk->begin;
+    int line = chunk->first_line;
 
-    // the reason I did the same to NOP like HALT is, NOP has to be passed throught out all instructions and has
-    // to perform nothing and has to be passed to writeBack stage
-    if (strncmp(opcode_str, "NOP", 3) == 0)
+    while (p < chunk->end)
     {
-        return OPCODE_NOP;
+        p = parse_next_line(&chunk->code_memory[line], p, chunk->end, line + 1);
+        if (!p)
+        {
+            chunk->failed = 1;
+            break;
+        }
+        line++;
     }
-
-    // assert(0 && "Invalid opcode");
-    return 0;
+    return NULL;
 }
 
+/*
+ * Runs fn on every chunk, one thread per chunk. A chunk whose thread cannot
+ * be started is run on the calling thread instead.
+ */
 static void
-split_opcode_from_insn_string(char *buffer, char tokens[2][128])
+run_on_chunks(void *(*fn)(void *), Parse_Chunk *chunks, int num_chunks)
 {
-    int token_num = 0;
-
-    char *token = strtok(buffer, " ");
+    pthread_t threads[num_chunks];
+    int started[num_chunks];
+    int i;
 
-    while (token != NULL)
+    for (i = 1; i < num_chunks; ++i)
     {
-        strcpy(tokens[token_num], token);
-        token_num++;
-        token = strtok(NULL, " ");
+        started[i] = pthread_create(&threads[i], NULL, fn, &chunks[i]) == 0;
+        if (!started[i])
+        {
+            fn(&chunks[i]);
+        }
+    }
+    fn(&chunks[0]);
+    for (i = 1; i < num_chunks; ++i)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
     }
 }
 
 /*
- * This function is related to parsing input file
- *
- * Note : you can edit this function to add new instructions
+ * Parses a program held in memory on several threads. The buffer is split
+ * at newline boundaries, every chunk counts its lines, and once the first
+ * line of every chunk is known each thread parses straight into its slice of
+ * code memory. The result is identical to create_code_memory_from_buffer.
  */
-static void
-create_APEX_instruction(APEX_Instruction *ins, char *buffer)
+static APEX_Instruction *
+create_code_memory_parallel(const char *buffer, size_t len, int *size, int threads)
 {
-    int i, token_num = 0;
-    char tokens[6][128];
-    char top_level_tokens[2][128];
+    int num_chunks = 0;
+    int i, code_memory_size = 0;
+    const char *p = buffer;
+    const char *end = buffer + len;
+    Parse_Chunk *chunks;
+    APEX_Instruction *code_memory;
 
-    for (i = 0; i < 2; ++i)
+    if ((size_t)threads > len / MIN_PARSE_CHUNK_BYTES + 1)
     {
-        strcpy(top_level_tokens[i], "");
+        threads = len / MIN_PARSE_CHUNK_BYTES + 1;
     }
-
-    split_opcode_from_insn_string(buffer, top_level_tokens);
-
-    char *token = strtok(top_level_tokens[1], ",");
-
-    while (token != NULL)
+    if (threads <= 1)
     {
-        strcpy(tokens[token_num], token);
-        token_num++;
-        token = strtok(NULL, ",");
+        return create_code_memory_from_buffer(buffer, len, size);
     }
 
-    strcpy(ins->opcode_str, top_level_tokens[0]);
-    ins->opcode = set_opcode_str(ins->opcode_str);
-
-    switch (ins->opcode)
-    {
-    case OPCODE_ADD:
-    case OPCODE_SUB:
-    case OPCODE_MUL:
-    case OPCODE_DIV:
-    case OPCODE_AND:
-    case OPCODE_OR:
-    case OPCODE_XOR:
-    case OPCODE_LDR:
+    chunks = calloc(threads, sizeof(Parse_Chunk));
+    if (!chunks)
     {
-        // as the ADD and above functions has the
-        ins->rd = get_num_from_string(tokens[0]);
-        ins->rs1 = get_num_from_string(tokens[1]);
-        ins->rs2 = get_num_from_string(tokens[2]);
-        break;
+        return NULL;
     }
 
-    case OPCODE_MOVC:
+    /* Every chunk ends just after a newline, except possibly the last one */
+    for (i = 1; i <= threads && p < end; ++i)
     {
-        ins->rd = get_num_from_string(tokens[0]);
-        ins->imm = get_num_from_string(tokens[1]);
-        break;
+        const char *split = (i == threads) ? end : buffer + len / threads * i;
+
+        if (split < p)
+        {
+            split = p;
+        }
+        if (split < end)
+        {
+            const char *eol = memchr(split, '\n', end - split);
+            split = eol ? eol + 1 : end;
+        }
+        chunks[num_chunks].begin = p;
+        chunks[num_chunks].end = split;
+        num_chunks++;
+        p = split;
     }
 
-    case OPCODE_LOAD:
-    case OPCODE_ADDL:
-    case OPCODE_SUBL:
+    run_on_chunks(count_chunk_lines, chunks, num_chunks);
+    for (i = 0; i < num_chunks; ++i)
     {
-        ins->rd = get_num_from_string(tokens[0]);
-        ins->rs1 = get_num_from_string(tokens[1]);
-        ins->imm = get_num_from_string(tokens[2]);
-        break;
+        chunks[i].first_line = code_memory_size;
+        code_memory_size += chunks[i].num_lines;
     }
 
-    case OPCODE_STORE:
+    *size = code_memory_size;
+    code_memory = code_memory_size ? malloc(code_memory_size * sizeof(APEX_Instruction)) : NULL;
+    if (!code_memory)
     {
-        ins->rs1 = get_num_from_string(tokens[0]);
-        ins->rs2 = get_num_from_string(tokens[1]);
-        ins->imm = get_num_from_string(tokens[2]);
-        break;
+        free(chunks);
+        return NULL;
     }
 
-    case OPCODE_STR:
+    for (i = 0; i < num_chunks; ++i)
     {
-        ins->rs1 = get_num_from_string(tokens[0]);
-        ins->rs2 = get_num_from_string(tokens[1]);
-        ins->rs3 = get_num_from_string(tokens[2]);
-        break;
+        chunks[i].code_memory = code_memory;
     }
+    run_on_chunks(parse_chunk, chunks, num_chunks);
 
-    case OPCODE_BZ:
-    case OPCODE_BNZ:
+    for (i = 0; i < num_chunks; ++i)
     {
-        ins->imm = get_num_from_string(tokens[0]);
-        break;
+        if (chunks[i].failed)
+        {
+            free(code_memory);
+            code_memory = NULL;
+            break;
+        }
     }
 
-    case OPCODE_HALT:
-    case OPCODE_NOP:
+    free(chunks);
+    return code_memory;
+}
+
+/*
+ * Reads a file that cannot be mapped (a pipe for example) into memory
+ */
+static char *
+read_whole_file(int fd, size_t *len)
+{
+    size_t capacity = 1 << 16;
+    char *buffer = malloc(capacity);
+    ssize_t nread;
+
+    *len = 0;
+    if (!buffer)
     {
-        break;
+        return NULL;
     }
-    case OPCODE_CMP:
+
+    while ((nread = read(fd, buffer + *len, capacity - *len)) > 0)
     {
-        ins->rs1 = get_num_from_string(tokens[0]);
-        ins->rs2 = get_num_from_string(tokens[1]);
-        break;
+        *len += nread;
+        if (*len == capacity)
+        {
+            char *grown;
+
+            capacity *= 2;
+            grown = realloc(buffer, capacity);
+            if (!grown)
+            {
+                free(buffer);
+                return NULL;
+            }
+            buffer = grown;
+        }
     }
+
+    if (nread < 0)
+    {
+        free(buffer);
+        return NULL;
     }
-    /* Fill in rest of the instructions accordingly */
+    return buffer;
 }
 
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * This function is related to parsing input file, the file is memory mapped
+ * and parsed in a single pass, on 'threads' threads when it is more than one
  */
 APEX_Instruction *
-create_code_memory(const char *filename, int *size)
+create_code_memory(const char *filename, int *size, int threads)
 {
-    FILE *fp;
-    ssize_t nread;
-    size_t len = 0;
-    char *line = NULL;
-    int code_memory_size = 0;
-    int current_instruction = 0;
+    int fd;
+    struct stat st;
     APEX_Instruction *code_memory;
 
+    *size = 0;
     if (!filename)
     {
         return NULL;
     }
 
-    fp = fopen(filename, "r");
-    if (!fp)
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
     {
         return NULL;
     }
 
-    while ((nread = getline(&line, &len, fp)) != -1)
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
     {
-        code_memory_size++;
+        void *map;
+
+        if (st.st_size == 0)
+        {
+            close(fd);
+            return NULL;
+        }
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            return NULL;
+        }
+
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        code_memory = create_code_memory_parallel(map, st.st_size, size, threads);
+        munmap(map, st.st_size);
     }
-    *size = code_memory_size;
-    if (!code_memory_size)
+    else
     {
-        fclose(fp);
-        return NULL;
+        size_t len;
+        char *buffer = read_whole_file(fd, &len);
+
+        close(fd);
+        if (!buffer)
+        {
+            return NULL;
+        }
+        code_memory = create_code_memory_parallel(buffer, len, size, threads);
+        free(buffer);
     }
 
-    code_memory = calloc(code_memory_size, sizeof(APEX_Instruction));
-    if (!code_memory)
+    return code_memory;
+}
+
+/*
+ * Resolves the code memory index every BZ / BNZ jumps to, -1 for other
+ * instructions and for branches that leave the program
+ */
+int *
+resolve_branch_targets(const APEX_Instruction *code_memory, int size)
+{
+    int i;
+    int *branch_target = malloc((size ? size : 1) * sizeof(int));
+
+    if (!branch_target)
     {
-        fclose(fp);
         return NULL;
     }
 
-    rewind(fp);
-    while ((nread = getline(&line, &len, fp)) != -1)
+    for (i = 0; i < size; ++i)
     {
-        create_APEX_instruction(&code_memory[current_instruction], line);
-        current_instruction++;
+        const APEX_Opcode_Info *info = &apex_isa[code_memory[i].opcode];
+        // the immediate is a byte offset from the branch pc and instructions are 4 bytes apart.
+        int target = i + code_memory[i].imm / 4;
+
+        branch_target[i] = -1;
+        if ((info->branch == BR_Z || info->branch == BR_NZ) && code_memory[i].imm % 4 == 0 &&
+            target >= 0 && target < size)
+        {
+            branch_target[i] = target;
+        }
     }
+    return branch_target;
+}
 
-    free(line);
-    fclose(fp);
-    return code_memory;
-}
\ No newline at end of file
+static double
+elapsed_seconds(const struct timespec *start, const struct timespec *stop)
+{
+    return (stop->tv_sec - start->tv_sec) + (stop->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Load-time benchmark, loads the file 'repetitions' times on 'threads'
+ * threads and reports the best and average load time in lines per second
+ */
+void
+benchmark_code_memory_load(const char *filename, int repetitions, int threads)
+{
+    int i, size = 0;
+    double best = 0, total = 0;
+
+    if (repetitions < 1)
+    {
+        repetitions = 1;
+    }
+
+    for (i = 0; i < repetitions; ++i)
+    {
+        struct timespec start, stop;
+        APEX_Instruction *code_memory;
+        double seconds;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        code_memory = create_code_memory(filename, &size, threads);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        if (!code_memory)
+        {
+            fprintf(stderr, "APEX_Error: Unable to load %s\n", filename);
+            return;
+        }
+        free(code_memory);
+
+        seconds = elapsed_seconds(&start, &stop);
+        total += seconds;
+        if (i == 0 || seconds < best)
+        {
+            best = seconds;
+        }
+    }
+
+    printf("APEX_LOAD: %s, %d lines, %d runs, %d parse threads\n", filename, size, repetitions, threads);
+    printf("APEX_LOAD: best %.3f ms (%.0f lines/sec), average %.3f ms (%.0f lines/sec)\n",
+           best * 1e3, size / best, total / repetitions * 1e3, size / (total / repetitions));
+}
@@ -7,7 +7,7 @@ MOVC R6,#0
 STORE R3,R1,#3
 STORE R4,R1,#4
 STORE R5,R1,#2
-XOR R7,R6,R2
+EXOR R7,R6,R2
 CMP R7,R1
 BNZ #16
 LOAD R8,R1,#2
@@ -5,14 +5,39 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "apex_checkpoint.h"
 #include "apex_cpu.h"
+#include "apex_kanata.h"
+#include "apex_object.h"
+#include "apex_trace.h"
 
-int main(int argc, char const *argv[])
+int main(int argc_all, char const *argv_all[])
 {
   APEX_CPU *cpu;
+  APEX_Config config;
+  const char *argv[argc_all];
+  int argc = 0;
+
+  // arguments of the form name=value are run-time options (see apex_config.h), they can be
+  // given anywhere after the program name. All the other arguments keep their usual positions.
+  APEX_config_init(&config);
+  for (int i = 0; i < argc_all; ++i)
+  {
+    if (i > 0 && strchr(argv_all[i], '='))
+    {
+      if (APEX_config_set(&config, argv_all[i]) != 0)
+      {
+        APEX_config_print_usage();
+        exit(1);
+      }
+      continue;
+    }
+    argv[argc++] = argv_all[i];
+  }
 
   // fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
   // input arguments entred must be always between 2 and 4,
@@ -22,15 +47,17 @@ int main(int argc, char const *argv[])
   case 2:
   case 3:
   case 4:
+  case 5:
   {
-    // only acceptes the input values between 2 to 4 else the error would be thrown saying
+    // only acceptes the input values between 2 to 5 (5 only for assemble) else the error would be thrown saying
     // the printf statemetn in the default statement.
     break;
   }
   default:
   {
-    // default message will be pirnted if teh  input arguments less than 2 or greater than 4.
-    fprintf(stderr, "APEX_Help: Usage %s <input_file>\n", argv[0]);
+    // default message will be pirnted if teh  input arguments less than 2 or greater than 5.
+    fprintf(stderr, "APEX_Help: Usage %s <input_file> [name=value ...]\n", argv[0]);
+    APEX_config_print_usage();
     exit(1);
   }
   }
@@ -41,8 +68,39 @@ int main(int argc, char const *argv[])
   //   exit(1);
   // }
 
-  //
-  cpu = APEX_cpu_init(argv[1]);
+  // assemble writes the input file out as a binary .apexo image which can be given to
+  // apex_sim in place of the assembly file, the optional data file holds the initial data memory.
+  // usage: apex_sim <input_file> assemble <output.apexo> [<data_file>]
+  if (argc >= 4 && strcmp(argv[2], "assemble") == 0)
+  {
+    return APEX_object_assemble(argv[1], argv[3], argc == 5 ? argv[4] : NULL,
+                                APEX_config_resolve_threads(config.parse_threads)) == 0
+               ? 0
+               : 1;
+  }
+  if (argc == 5 && strcmp(argv[2], "display") != 0 && strcmp(argv[2], "simulate") != 0 &&
+      strcmp(argv[2], "show_mem") != 0 && strcmp(argv[2], "checkpoint") != 0 && strcmp(argv[2], "sweep") != 0 &&
+      strcmp(argv[2], "trace") != 0 && strcmp(argv[2], "kanata") != 0 &&
+      strcmp(argv[2], "stats") != 0)
+  {
+    fprintf(stderr, "APEX_Help: Usage %s <input_file> [name=value ...]\n", argv[0]);
+    exit(1);
+  }
+
+  // load_bench only measures how fast the input file is loaded, no CPU is needed for it.
+  // usage: apex_sim <input_file> load_bench <repetitions>
+  if (argc == 4 && strcmp(argv[2], "load_bench") == 0)
+  {
+    benchmark_code_memory_load(argv[1], atoi(argv[3]), APEX_config_resolve_threads(config.parse_threads));
+    return 0;
+  }
+
+  // the JSON of the stats mode may go to stdout, nothing else is printed there
+  if (argc == 5 && strcmp(argv[2], "stats") == 0)
+  {
+    config.quiet = TRUE;
+  }
+  cpu = APEX_cpu_init_with_config(argv[1], &config);
   if (!cpu)
   {
     // if argument one is not the valid one then we have to throe an error message,
@@ -52,23 +110,206 @@ int main(int argc, char const *argv[])
     exit(1);
   }
 
+  // checkpoint runs the pipeline for the given number of cycles and saves the whole simulator state,
+  // display, simulate and show_mem resume from such a file when it is given after the cycle count.
+  // usage: apex_sim <input_file> checkpoint <cycles> <output.apexckp>
+  //        apex_sim <input_file> display <cycles> <input.apexckp>
+  if (argc == 5 && strcmp(argv[2], "checkpoint") == 0)
+  {
+    int cycles = atoi(argv[3]);
+    int status;
+
+    cpu->quiet = TRUE;
+    for (int i = 0; i < cycles; ++i)
+    {
+      int stopped = APEX_cpu_cycle(cpu);
+
+      if (stopped == APEX_CYCLE_FAULT)
+      {
+        // nothing worth resuming from, the program cannot go on.
+        printf("APEX_CPU: Simulation Stopped, cycles = %" PRId64 " instructions = %" PRId64 "\n", cpu->clock + 1,
+               cpu->insn_completed);
+        APEX_cpu_stop(cpu);
+        return 1;
+      }
+      if (stopped)
+      {
+        printf("APEX_CPU: Simulation Complete, cycles = %" PRId64 " instructions = %" PRId64 "\n", cpu->clock + 1,
+               cpu->insn_completed);
+        break;
+      }
+    }
+    status = APEX_checkpoint_save(cpu, argv[4]);
+    if (status == 0)
+    {
+      printf("APEX_CPU: Checkpoint of cycle %" PRId64 " saved to %s\n", cpu->clock, argv[4]);
+    }
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
+  // sweep simulates the program under every combination of the options in the matrix file, at once,
+  // and prints a table of cycles, CPI and stalls.
+  // usage: apex_sim <input_file> sweep <max_cycles> <matrix_file>
+  if (argc == 5 && strcmp(argv[2], "sweep") == 0)
+  {
+    int status = APEX_cpu_sweep(cpu, atoi(argv[3]), argv[4]);
+
+    APEX_cpu_stop(cpu);
+    return status;
+  }
+  // trace runs the pipeline for the given number of cycles and writes what every stage held in every cycle
+  // to a binary trace, the apex_trace tool decodes and filters it.
+  // usage: apex_sim <input_file> trace <cycles> <output.apextrc>
+  if (argc == 5 && strcmp(argv[2], "trace") == 0)
+  {
+    APEX_Trace_Writer *writer = APEX_trace_open(argv[4], cpu);
+    long records;
+    int faulted;
+
+    if (!writer)
+    {
+      APEX_cpu_stop(cpu);
+      exit(1);
+    }
+    APEX_cpu_add_observer(cpu, APEX_trace_observer(writer));
+    // the trace of a run that faulted is still saved, it shows what led up to the fault.
+    faulted = (APEX_cpu_run_cycles(cpu, atoi(argv[3]), FALSE) == APEX_RUN_FAULT);
+    APEX_cpu_remove_observer(cpu, APEX_trace_observer(writer));
+    records = APEX_trace_close(writer);
+    if (records >= 0)
+    {
+      printf("APEX_CPU: %ld trace records saved to %s\n", records, argv[4]);
+    }
+    APEX_cpu_stop(cpu);
+    return records >= 0 && !faulted ? 0 : 1;
+  }
+  // kanata writes a pipeline timeline of the given number of cycles that the Konata viewer draws, every
+  // instruction from fetch to writeback, stalls as longer stages and flushed instructions as squashed.
+  // usage: apex_sim <input_file> kanata <cycles> <output.kanata>
+  if (argc == 5 && strcmp(argv[2], "kanata") == 0)
+  {
+    APEX_Kanata_Writer *writer = APEX_kanata_open(argv[4]);
+    long insns;
+    int faulted;
+
+    if (!writer)
+    {
+      APEX_cpu_stop(cpu);
+      exit(1);
+    }
+    APEX_cpu_add_observer(cpu, APEX_kanata_observer(writer));
+    faulted = (APEX_cpu_run_cycles(cpu, atoi(argv[3]), FALSE) == APEX_RUN_FAULT);
+    APEX_cpu_remove_observer(cpu, APEX_kanata_observer(writer));
+    insns = APEX_kanata_close(writer);
+    if (insns >= 0)
+    {
+      printf("APEX_CPU: %ld instructions logged to %s\n", insns, argv[4]);
+    }
+    APEX_cpu_stop(cpu);
+    return insns >= 0 && !faulted ? 0 : 1;
+  }
+  // stats runs the pipeline for up to the given number of cycles and writes its counters as JSON, with a
+  // snapshot of them every stats_interval cycles. "-" writes to stdout and prints nothing else. The counters
+  // of a run that faulted are written as well, with the status "fault".
+  // usage: apex_sim <input_file> stats <max_cycles> <output.json|->
+  if (argc == 5 && strcmp(argv[2], "stats") == 0)
+  {
+    long max_cycles = atol(argv[3]);
+    int halted = APEX_CYCLE_RUNNING;
+    int status;
+
+    while (halted == APEX_CYCLE_RUNNING && cpu->clock < max_cycles)
+    {
+      halted = APEX_cpu_cycle(cpu);
+    }
+    // same cycle count as the display mode prints, the clock does not advance past HALT or a fault
+    status = APEX_stats_write_json(cpu, halted ? cpu->clock + 1 : cpu->clock,
+                                   halted == APEX_CYCLE_FAULT ? "fault" : (halted ? "halted" : "limit"), argv[4]);
+    if (status == 0 && strcmp(argv[4], "-") != 0)
+    {
+      printf("APEX_CPU: Statistics of %" PRId64 " cycles saved to %s\n", halted ? cpu->clock + 1 : cpu->clock, argv[4]);
+    }
+    APEX_cpu_stop(cpu);
+    return status == 0 && halted != APEX_CYCLE_FAULT ? 0 : 1;
+  }
+  if (argc == 5)
+  {
+    if (APEX_checkpoint_restore(cpu, argv[4]) != 0)
+    {
+      APEX_cpu_stop(cpu);
+      exit(1);
+    }
+    fprintf(stderr, "APEX_CPU: Resuming from %s at cycle %" PRId64 "\n", argv[4], cpu->clock);
+  }
+
+  // func_bench times the functional interpreter with both dispatch methods.
+  // usage: apex_sim <input_file> func_bench <repetitions>
+  if (argc == 4 && strcmp(argv[2], "func_bench") == 0)
+  {
+    APEX_cpu_benchmark_functional(cpu, atoi(argv[3]));
+    APEX_cpu_stop(cpu);
+    return 0;
+  }
+
+  // jit_check runs the program with the interpreter and with the JIT and compares the final states,
+  // the exit status is 1 if they differ.
+  // usage: apex_sim <input_file> jit_check <max_insns>
+  if (argc == 4 && strcmp(argv[2], "jit_check") == 0)
+  {
+    int status = APEX_cpu_check_jit(cpu, atol(argv[3]));
+
+    APEX_cpu_stop(cpu);
+    return status;
+  }
+
+  // stress simulates the program on many cpus at once (stress_cpus, stress_runs) and checks every run
+  // against a reference, the exit status is 1 if any differs. Build with -fsanitize=thread to look for races.
+  // usage: apex_sim <input_file> stress <max_cycles>
+  if (argc == 4 && strcmp(argv[2], "stress") == 0)
+  {
+    int status = APEX_cpu_stress(argv[1], &config, atoi(argv[3]));
+
+    APEX_cpu_stop(cpu);
+    return status;
+  }
+
+  // fast_forward skips the start of the program with the functional interpreter, the
+  // pipeline then starts from wherever it stopped with the branch predictor warmed up (bp_warming).
+  if (config.fast_forward > 0)
+  {
+    int status = APEX_cpu_run_warming(cpu, config.fast_forward);
+
+    fprintf(stderr, "APEX_CPU: Fast-forwarded %" PRId64 " instructions to pc(%d)\n", cpu->insn_completed, cpu->pc);
+    if (status != APEX_FUNC_LIMIT)
+    {
+      // the program ended (or failed) before the region of interest, nothing left to simulate.
+      print_state_of_architectural_register_file(cpu);
+      print_state_of_data_memory(cpu);
+      APEX_cpu_stop(cpu);
+      return status == APEX_FUNC_HALTED ? 0 : 1;
+    }
+  }
+
   // the argument lenght must be greater than 2 and must be less than 4.
   // enters into this function when arguments are greater than 2 or 3 or equla to 4.
   // that means we are entering either simulate or display or show_mem followed by the no. of cycles.
-  if (argc > 2 && argc > 3 && argc == 4)
+  if (argc > 2 && argc > 3 && (argc == 4 || argc == 5))
   {
-    APEX_cpu_display_simulate_show_mem(cpu, atoi(argv[3]), argv[2]);
+    int faulted = APEX_cpu_display_simulate_show_mem(cpu, atoi(argv[3]), argv[2]);
+
     APEX_cpu_stop(cpu);
-    // return 0;
+    // a program that stopped on a fault exits with 1, like an unloadable one.
+    return faulted ? 1 : 0;
   }
 
   // if we only run the simulator only eith the two commands then the APEX_cup run and stop will be executed
   // sinlge_step prodess will the executes we have to keep pressing command/enter to execute the further cycles.
   else if (argc == 2 && !(argc == 3) && !(argc == 4))
   {
-    APEX_cpu_run(cpu);
+    int faulted = APEX_cpu_run(cpu);
+
     APEX_cpu_stop(cpu);
-    // return 0;
+    return faulted ? 1 : 0;
   }
   return 0;
 }